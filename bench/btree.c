@@ -0,0 +1,309 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* B+Tree benchmark.
+ *
+ * The B+Tree in util/btree.c is compared against the implementation
+ * it replaced (bench/btree_old.c), using trees shaped like the symbol
+ * table's: 512-byte name keys, address data and 32 branches. Each
+ * implementation is given the same sequence of inserts, lookups,
+ * scans and deletes, and the results are checked. Bulk loading and
+ * pointer cursors exist only in the new implementation.
+ *
+ * Usage: bench/btree [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "btree.h"
+#include "stab.h"
+
+/* The old implementation (see btree_old.c) */
+btree_t btree_old_alloc(const struct btree_def *def);
+void btree_old_free(btree_t bt);
+void btree_old_clear(btree_t bt);
+int btree_old_put(btree_t bt, const void *key, const void *data);
+int btree_old_delete(btree_t bt, const void *key);
+int btree_old_get(btree_t bt, const void *key, void *data);
+int btree_old_select(btree_t bt, const void *key, btree_selmode_t mode,
+		     void *key_ret, void *data_ret);
+
+struct impl {
+	const char	*name;
+
+	btree_t		(*alloc)(const struct btree_def *def);
+	void		(*free)(btree_t bt);
+	void		(*clear)(btree_t bt);
+	int		(*put)(btree_t bt, const void *key, const void *data);
+	int		(*del)(btree_t bt, const void *key);
+	int		(*get)(btree_t bt, const void *key, void *data);
+	int		(*select)(btree_t bt, const void *key,
+				  btree_selmode_t mode,
+				  void *key_ret, void *data_ret);
+};
+
+static const struct impl impls[2] = {
+	{
+		.name = "old",
+		.alloc = btree_old_alloc,
+		.free = btree_old_free,
+		.clear = btree_old_clear,
+		.put = btree_old_put,
+		.del = btree_old_delete,
+		.get = btree_old_get,
+		.select = btree_old_select
+	},
+	{
+		.name = "new",
+		.alloc = btree_alloc,
+		.free = btree_free,
+		.clear = btree_clear,
+		.put = btree_put,
+		.del = btree_delete,
+		.get = btree_get,
+		.select = btree_select
+	}
+};
+
+struct sym_key {
+	char name[MAX_SYMBOL_LENGTH];
+};
+
+static const struct sym_key sym_key_zero;
+
+static int sym_key_compare(const void *left, const void *right)
+{
+	return strcmp(((const struct sym_key *)left)->name,
+		      ((const struct sym_key *)right)->name);
+}
+
+static const struct btree_def sym_def = {
+	.compare = sym_key_compare,
+	.zero = &sym_key_zero,
+	.branches = 32,
+	.key_size = sizeof(struct sym_key),
+	.data_size = sizeof(address_t)
+};
+
+#define SCAN_REPS	10
+#define LOOKUP_REPS	4
+
+static int count = 50000;
+static struct sym_key *keys;
+static address_t *values;
+static int *perm;
+static int errors;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void report(const char *what, const char *impl, double t, int n)
+{
+	printf("  %-18s %s %10.1f ns/rec\n", what, impl, t * 1e9 / n);
+}
+
+static void check(int cond, const char *what, const char *impl)
+{
+	if (!cond) {
+		printf("  %s: %s gave the wrong result\n", impl, what);
+		errors++;
+	}
+}
+
+/* Check that every key maps to its value, and a full scan visits each
+ * record once, in order.
+ */
+static int verify(const struct impl *im, btree_t bt)
+{
+	struct sym_key k;
+	address_t v;
+	int i = 0;
+	int r;
+
+	r = im->select(bt, NULL, BTREE_FIRST, &k, &v);
+	while (!r) {
+		if (i >= count || strcmp(k.name, keys[i].name) ||
+		    v != values[i])
+			return 0;
+
+		i++;
+		r = im->select(bt, NULL, BTREE_NEXT, &k, &v);
+	}
+
+	if (i != count)
+		return 0;
+
+	for (i = 0; i < count; i++)
+		if (im->get(bt, &keys[i], &v) || v != values[i])
+			return 0;
+
+	return 1;
+}
+
+static void run(const struct impl *im)
+{
+	btree_t bt = im->alloc(&sym_def);
+	struct sym_key k;
+	address_t v;
+	unsigned long long sum = 0;
+	double start;
+	int i;
+	int r;
+
+	if (!bt) {
+		printf("  %s: can't allocate tree\n", im->name);
+		errors++;
+		return;
+	}
+
+	/* Sequential insert, as when symbols arrive in order */
+	start = now();
+	for (i = 0; i < count; i++)
+		im->put(bt, &keys[i], &values[i]);
+	report("sequential insert", im->name, now() - start, count);
+	check(verify(im, bt), "sequential insert", im->name);
+	im->clear(bt);
+
+	/* Random insert */
+	start = now();
+	for (i = 0; i < count; i++)
+		im->put(bt, &keys[perm[i]], &values[perm[i]]);
+	report("random insert", im->name, now() - start, count);
+	check(verify(im, bt), "random insert", im->name);
+
+	if (im->alloc == btree_alloc) {
+		btree_clear(bt);
+		start = now();
+		btree_bulk_load(bt, keys, values, count);
+		report("bulk load", im->name, now() - start, count);
+		check(verify(im, bt), "bulk load", im->name);
+	}
+
+	/* Lookups in random order */
+	start = now();
+	for (r = 0; r < LOOKUP_REPS; r++)
+		for (i = 0; i < count; i++) {
+			im->get(bt, &keys[perm[i]], &v);
+			sum += v;
+		}
+	report("lookup", im->name, now() - start, count * LOOKUP_REPS);
+
+	/* Full scans, with the key and data copied out */
+	start = now();
+	for (r = 0; r < SCAN_REPS; r++) {
+		int x = im->select(bt, NULL, BTREE_FIRST, &k, &v);
+
+		while (!x) {
+			sum += v;
+			x = im->select(bt, NULL, BTREE_NEXT, &k, &v);
+		}
+	}
+	report("scan, copying", im->name, now() - start, count * SCAN_REPS);
+
+	if (im->alloc == btree_alloc) {
+		start = now();
+		for (r = 0; r < SCAN_REPS; r++) {
+			const void *kp;
+			void *dp;
+			int x = btree_select_ptr(bt, NULL, BTREE_FIRST,
+						 &kp, &dp);
+
+			while (!x) {
+				sum += *(const address_t *)dp;
+				x = btree_select_ptr(bt, NULL, BTREE_NEXT,
+						     &kp, &dp);
+			}
+		}
+		report("scan, pointers", im->name, now() - start,
+		       count * SCAN_REPS);
+	}
+
+	/* Every pass above adds up all of the values */
+	r = LOOKUP_REPS + SCAN_REPS;
+	if (im->alloc == btree_alloc)
+		r += SCAN_REPS;
+	check(sum == (unsigned long long)r * count * (count - 1) / 2,
+	      "lookup and scan", im->name);
+
+	/* Random delete */
+	start = now();
+	for (i = 0; i < count; i++)
+		im->del(bt, &keys[perm[i]]);
+	report("random delete", im->name, now() - start, count);
+	check(im->select(bt, NULL, BTREE_FIRST, &k, &v) == 1,
+	      "random delete", im->name);
+
+	im->free(bt);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t seed = 1;
+	int i;
+
+	if (argc > 1)
+		count = atoi(argv[1]);
+
+	if (count < 1) {
+		fprintf(stderr, "usage: bench/btree [count]\n");
+		return -1;
+	}
+
+	keys = calloc(count, sizeof(keys[0]));
+	values = malloc(count * sizeof(values[0]));
+	perm = malloc(count * sizeof(perm[0]));
+	if (!keys || !values || !perm) {
+		perror("btree: malloc");
+		return -1;
+	}
+
+	/* Keys are generated in sorted order, for bulk loading */
+	for (i = 0; i < count; i++) {
+		sprintf(keys[i].name, "sym_%08d", i);
+		values[i] = i;
+		perm[i] = i;
+	}
+
+	for (i = count - 1; i > 0; i--) {
+		int j;
+		int t;
+
+		seed = seed * 1103515245 + 12345;
+		j = (seed >> 8) % (i + 1);
+		t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+
+	printf("%d records, %d-byte keys:\n", count,
+	       (int)sizeof(struct sym_key));
+	for (i = 0; i < 2; i++)
+		run(&impls[i]);
+
+	free(keys);
+	free(values);
+	free(perm);
+	return errors ? -1 : 0;
+}
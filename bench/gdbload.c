@@ -0,0 +1,293 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* GDB load throughput benchmark.
+ *
+ * Starts MSPDebug's GDB stub on the simulator, then acts as GDB: a
+ * 32 KiB image is written repeatedly using hex (M) or binary (X)
+ * packets of various sizes, and read back to check it. The result is
+ * reported in KiB/s for each packet type and size.
+ *
+ * Usage: bench/gdbload [path-to-mspdebug [port]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define IMAGE_BASE	0x8000
+#define IMAGE_SIZE	0x8000
+#define REPS		20
+
+static uint8_t image[IMAGE_SIZE];
+static char pkt_buf[IMAGE_SIZE * 2 + 64];
+static char rx_buf[IMAGE_SIZE * 2 + 64];
+static int rx_len;
+static int sock = -1;
+
+static unsigned long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static int sock_fill(void)
+{
+	int r = recv(sock, rx_buf + rx_len, sizeof(rx_buf) - rx_len, 0);
+
+	if (r <= 0) {
+		fprintf(stderr, "gdbload: connection lost\n");
+		return -1;
+	}
+
+	rx_len += r;
+	return 0;
+}
+
+/* Send a packet with the given body, and wait for the reply. The
+ * reply body is returned, nul-terminated, in rx_buf.
+ */
+static const char *transact(const char *body, int len)
+{
+	static char reply[sizeof(rx_buf)];
+	uint8_t sum = 0;
+	char trailer[4];
+	int i;
+
+	for (i = 0; i < len; i++)
+		sum += (uint8_t)body[i];
+
+	snprintf(trailer, sizeof(trailer), "#%02x", sum);
+	if (send(sock, "$", 1, 0) < 0 || send(sock, body, len, 0) < 0 ||
+	    send(sock, trailer, 3, 0) < 0) {
+		perror("gdbload: send");
+		return NULL;
+	}
+
+	for (;;) {
+		char *start = memchr(rx_buf, '$', rx_len);
+		char *end = start ?
+			memchr(start, '#', rx_len - (start - rx_buf)) : NULL;
+
+		if (end && end + 3 <= rx_buf + rx_len) {
+			int n = end - start - 1;
+
+			memcpy(reply, start + 1, n);
+			reply[n] = 0;
+
+			rx_len -= end + 3 - rx_buf;
+			memmove(rx_buf, end + 3, rx_len);
+
+			if (send(sock, "+", 1, 0) < 0)
+				return NULL;
+
+			return reply;
+		}
+
+		if (sock_fill() < 0)
+			return NULL;
+	}
+}
+
+/* Build a write packet for len bytes of the image at the given offset */
+static int build_write(int binary, int offset, int len)
+{
+	static const char hexdig[] = "0123456789abcdef";
+	int n = sprintf(pkt_buf, "%c%x,%x:", binary ? 'X' : 'M',
+			IMAGE_BASE + offset, len);
+	int i;
+
+	for (i = 0; i < len; i++) {
+		const uint8_t c = image[offset + i];
+
+		if (!binary) {
+			pkt_buf[n++] = hexdig[c >> 4];
+			pkt_buf[n++] = hexdig[c & 15];
+		} else if (c == '#' || c == '$' || c == '}' || c == '*') {
+			pkt_buf[n++] = '}';
+			pkt_buf[n++] = c ^ 0x20;
+		} else {
+			pkt_buf[n++] = c;
+		}
+	}
+
+	return n;
+}
+
+static int check_image(void)
+{
+	int offset;
+
+	for (offset = 0; offset < IMAGE_SIZE; offset += 4096) {
+		char cmd[32];
+		const char *r;
+		int i;
+
+		i = sprintf(cmd, "m%x,1000", IMAGE_BASE + offset);
+		r = transact(cmd, i);
+		if (!r)
+			return -1;
+
+		for (i = 0; i < 4096; i++) {
+			unsigned int v;
+
+			if (sscanf(r + i * 2, "%2x", &v) != 1 ||
+			    v != image[offset + i]) {
+				fprintf(stderr, "gdbload: mismatch at "
+					"0x%04x\n", IMAGE_BASE + offset + i);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int run(int binary, int chunk)
+{
+	unsigned long long start;
+	unsigned long long elapsed;
+	int rep;
+
+	start = now_us();
+	for (rep = 0; rep < REPS; rep++) {
+		int offset;
+
+		for (offset = 0; offset < IMAGE_SIZE; offset += chunk) {
+			const int len = build_write(binary, offset, chunk);
+			const char *r = transact(pkt_buf, len);
+
+			if (!r)
+				return -1;
+
+			if (strcmp(r, "OK")) {
+				fprintf(stderr, "gdbload: write failed: "
+					"%s\n", r);
+				return -1;
+			}
+		}
+	}
+	elapsed = now_us() - start;
+
+	if (check_image() < 0)
+		return -1;
+
+	printf("%c packets, %5d bytes: %8.0f KiB/s\n",
+	       binary ? 'X' : 'M', chunk,
+	       (double)REPS * IMAGE_SIZE / 1024.0 /
+	       (elapsed ? elapsed : 1) * 1000000.0);
+	return 0;
+}
+
+static int connect_stub(int port)
+{
+	struct sockaddr_in addr;
+	int tries;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (tries = 0; tries < 50; tries++) {
+		int one = 1;
+
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock < 0) {
+			perror("gdbload: socket");
+			return -1;
+		}
+
+		if (!connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+				   &one, sizeof(one));
+			return 0;
+		}
+
+		close(sock);
+		usleep(100000);
+	}
+
+	fprintf(stderr, "gdbload: can't connect to port %d\n", port);
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	static const int chunks[] = {1024, 4096, 8192, 16384};
+	const char *path = argc > 1 ? argv[1] : "./mspdebug";
+	const int port = argc > 2 ? atoi(argv[2]) : 2999;
+	char gdb_cmd[32];
+	uint32_t seed = 1;
+	int ret = 0;
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < IMAGE_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		image[i] = seed >> 16;
+	}
+
+	snprintf(gdb_cmd, sizeof(gdb_cmd), "gdb %d", port);
+	pid = fork();
+	if (pid < 0) {
+		perror("gdbload: fork");
+		return -1;
+	}
+
+	if (!pid) {
+		if (!freopen("/dev/null", "w", stdout))
+			_exit(-1);
+		execl(path, path, "-q", "-n", "sim", gdb_cmd, NULL);
+		perror("gdbload: exec");
+		_exit(-1);
+	}
+
+	if (connect_stub(port) < 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	/* M packets are hex, so the largest write is half a transfer */
+	for (i = 0; i < 4 && !ret; i++)
+		if (chunks[i] <= 8192)
+			ret = run(0, chunks[i]);
+
+	for (i = 0; i < 4 && !ret; i++)
+		ret = run(1, chunks[i]);
+
+	/* Kill the target. There's no reply, and the stub exits. */
+	if (send(sock, "$k#6b", 5, 0) < 0)
+		perror("gdbload: send");
+	close(sock);
+	waitpid(pid, NULL, 0);
+	return ret;
+}
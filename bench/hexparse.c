@@ -0,0 +1,317 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Hex decoder and text image parser benchmark.
+ *
+ * First, the vector hex decoder built for this host (SSE2, NEON, or
+ * none) is checked against the scalar decoder on random input of
+ * every length up to 256 bytes and every alignment, with and without
+ * invalid characters. Then the throughput of both decoders is
+ * measured, followed by the throughput of binfile_extract() on a 1 MiB
+ * image in IHEX, SREC and TI-TXT format. The parsed image is checked
+ * against the original.
+ *
+ * Usage: bench/hexparse
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "hexdec.h"
+#include "binfile.h"
+
+/* The scalar decoder, built from the same source with the vector
+ * paths disabled (see hexdec_scalar.c).
+ */
+int hexdec_scalar(uint8_t *out, const char *text, size_t len);
+
+#define NUM_REGIONS	16
+#define REGION_SIZE	0x10000
+#define REGION_STRIDE	0x12000
+#define REGION_BASE	0x4000
+#define REPS		20
+
+#if defined(__SSE2__)
+#define VECTOR_NAME	"SSE2"
+#elif defined(__ARM_NEON)
+#define VECTOR_NAME	"NEON"
+#else
+#define VECTOR_NAME	"none"
+#endif
+
+static uint8_t image[NUM_REGIONS * REGION_SIZE];
+static uint32_t seed = 1;
+
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/************************************************************************
+ * Decoder agreement
+ */
+
+static int check_decoders(void)
+{
+	static const char digits[] = "0123456789abcdefABCDEF";
+	static const char junk[] = "gG/:@`\x7f\x80 \n";
+	char text[256 * 2 + 16];
+	uint8_t a[256];
+	uint8_t b[256];
+	int cases = 0;
+	int len;
+
+	for (len = 0; len <= 256; len++) {
+		int align;
+
+		for (align = 0; align < 16; align++) {
+			const int step = (len > 8) ? 7 : 1;
+			char *t = text + align;
+			int bad;
+
+			for (bad = -1; bad < len * 2; bad += step) {
+				int ra;
+				int rb;
+				int i;
+
+				for (i = 0; i < len * 2; i++)
+					t[i] = digits[rnd() % 22];
+
+				if (bad >= 0)
+					t[bad] = junk[rnd() % 10];
+
+				ra = hexdec(a, t, len);
+				rb = hexdec_scalar(b, t, len);
+
+				if (ra != rb || (bad < 0 && ra) ||
+				    (!ra && memcmp(a, b, len))) {
+					printf("Decoders disagree: len %d, "
+					       "align %d, bad char at %d\n",
+					       len, align, bad);
+					return -1;
+				}
+
+				cases++;
+			}
+		}
+	}
+
+	printf("Vector (%s) and scalar decoders agree (%d cases)\n",
+	       VECTOR_NAME, cases);
+	return 0;
+}
+
+static void bench_decoder(const char *name,
+			  int (*dec)(uint8_t *, const char *, size_t))
+{
+	const size_t len = sizeof(image);
+	char *text = malloc(len * 2 + 1);
+	uint8_t *out = malloc(len);
+	double start;
+	size_t i;
+	int rep;
+
+	for (i = 0; i < len; i++)
+		sprintf(text + i * 2, "%02X", image[i]);
+
+	start = now();
+	for (rep = 0; rep < REPS; rep++)
+		dec(out, text, len);
+
+	printf("  %-8s %8.1f MB/s of text\n", name,
+	       len * 2.0 * REPS / (now() - start) / 1e6);
+
+	if (memcmp(out, image, len))
+		printf("  %s: wrong output\n", name);
+
+	free(text);
+	free(out);
+}
+
+/************************************************************************
+ * Image parsers
+ */
+
+static address_t region_addr(int r)
+{
+	return REGION_BASE + r * REGION_STRIDE;
+}
+
+static void write_ihex(FILE *out)
+{
+	int seg = -1;
+	int r;
+
+	for (r = 0; r < NUM_REGIONS; r++) {
+		int o;
+
+		for (o = 0; o < REGION_SIZE; o += 32) {
+			const address_t addr = region_addr(r) + o;
+			const uint8_t *d = image + r * REGION_SIZE + o;
+			uint8_t sum;
+			int i;
+
+			if ((int)(addr >> 16) != seg) {
+				seg = addr >> 16;
+				fprintf(out, ":02000004%04X%02X\n", seg,
+					(uint8_t)-(6 + (seg >> 8) + seg));
+			}
+
+			sum = 32 + (addr >> 8) + addr;
+			fprintf(out, ":20%04X00", addr & 0xffff);
+			for (i = 0; i < 32; i++) {
+				fprintf(out, "%02X", d[i]);
+				sum += d[i];
+			}
+
+			fprintf(out, "%02X\n", (uint8_t)-sum);
+		}
+	}
+
+	fprintf(out, ":00000001FF\n");
+}
+
+static void write_srec(FILE *out)
+{
+	int r;
+
+	for (r = 0; r < NUM_REGIONS; r++) {
+		int o;
+
+		for (o = 0; o < REGION_SIZE; o += 32) {
+			const address_t addr = region_addr(r) + o;
+			const uint8_t *d = image + r * REGION_SIZE + o;
+			uint8_t sum = 36 + (addr >> 16) + (addr >> 8) + addr;
+			int i;
+
+			fprintf(out, "S224%06X", addr);
+			for (i = 0; i < 32; i++) {
+				fprintf(out, "%02X", d[i]);
+				sum += d[i];
+			}
+
+			fprintf(out, "%02X\r\n", (uint8_t)~sum);
+		}
+	}
+}
+
+static void write_titext(FILE *out)
+{
+	int r;
+
+	for (r = 0; r < NUM_REGIONS; r++) {
+		int o;
+
+		fprintf(out, "@%X\n", region_addr(r));
+		for (o = 0; o < REGION_SIZE; o++)
+			fprintf(out, "%02X%c", image[r * REGION_SIZE + o],
+				((o & 15) == 15) ? '\n' : ' ');
+	}
+
+	fprintf(out, "q\n");
+}
+
+struct parse_check {
+	address_t	bytes;
+	int		errors;
+};
+
+static int check_chunk(void *user_data, const struct binfile_chunk *ch)
+{
+	struct parse_check *pc = (struct parse_check *)user_data;
+	address_t rel = ch->addr - REGION_BASE;
+	const int r = rel / REGION_STRIDE;
+	const address_t o = rel % REGION_STRIDE;
+
+	if (ch->addr < REGION_BASE || r >= NUM_REGIONS ||
+	    o + ch->len > REGION_SIZE ||
+	    memcmp(ch->data, image + r * REGION_SIZE + o, ch->len))
+		pc->errors++;
+
+	pc->bytes += ch->len;
+	return 0;
+}
+
+static int bench_parser(const char *name, void (*gen)(FILE *out))
+{
+	FILE *f = tmpfile();
+	struct parse_check pc = {0};
+	double start;
+	long size;
+	int rep;
+
+	if (!f) {
+		perror("hexparse: tmpfile");
+		return -1;
+	}
+
+	gen(f);
+	fflush(f);
+	size = ftell(f);
+
+	if (binfile_extract(f, check_chunk, &pc) < 0 || pc.errors ||
+	    pc.bytes != sizeof(image)) {
+		printf("  %-8s parsed incorrectly\n", name);
+		fclose(f);
+		return -1;
+	}
+
+	start = now();
+	for (rep = 0; rep < REPS; rep++)
+		binfile_extract(f, check_chunk, &pc);
+
+	printf("  %-8s %8.1f MB/s of text\n", name,
+	       (double)size * REPS / (now() - start) / 1e6);
+
+	fclose(f);
+	return 0;
+}
+
+int main(void)
+{
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < sizeof(image); i++)
+		image[i] = rnd();
+
+	if (check_decoders() < 0)
+		return -1;
+
+	printf("Hex decoder, %d KiB:\n", (int)(sizeof(image) >> 10));
+	bench_decoder("vector", hexdec);
+	bench_decoder("scalar", hexdec_scalar);
+
+	printf("binfile_extract(), %d KiB image:\n",
+	       (int)(sizeof(image) >> 10));
+	ret |= bench_parser("IHEX", write_ihex);
+	ret |= bench_parser("SREC", write_srec);
+	ret |= bench_parser("TI-TXT", write_titext);
+
+	return ret;
+}
@@ -0,0 +1,367 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Power export benchmark.
+ *
+ * A full power buffer of synthetic samples (slowly varying current, and
+ * a MAB which mostly steps forward with occasional jumps) is exported
+ * with "power export-csv" for each session and with "power export-bin",
+ * and the binary file is imported into a fresh buffer with "power
+ * import-bin". File sizes and times are reported, and the imported
+ * sessions and the number of CSV records are checked against the
+ * original. This is done once with the samples in memory, and once in
+ * spill mode, where exports stream from the spill file.
+ *
+ * Temporary files are created in the given directory, which defaults
+ * to the current one, and removed afterwards.
+ *
+ * Usage: bench/powerexport [directory]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "device.h"
+#include "powerbuf.h"
+#include "power.h"
+
+#define NUM_SESSIONS	4
+#define INTERVAL_US	1000
+#define REPS		5
+#define READ_CHUNK	1024
+
+static const char *dir = ".";
+static struct device dev;
+static uint32_t seed = 1;
+
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void tmp_path(char *buf, const char *name)
+{
+	snprintf(buf, PATH_MAX, "%s/powerexport-%s.tmp", dir, name);
+}
+
+static long long file_size(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return -1;
+
+	return st.st_size;
+}
+
+/* Run a power command on the given buffer, with its messages
+ * discarded.
+ */
+static int run_power(powerbuf_t pb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int run_power(powerbuf_t pb, const char *fmt, ...)
+{
+	char cmd[PATH_MAX + 64];
+	char *arg = cmd;
+	va_list ap;
+	int saved;
+	int null_fd;
+	int ret;
+
+	va_start(ap, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	null_fd = open("/dev/null", O_WRONLY);
+	if (saved >= 0 && null_fd >= 0)
+		dup2(null_fd, STDOUT_FILENO);
+
+	dev.power_buf = pb;
+	ret = cmd_power(&arg);
+
+	fflush(stdout);
+	if (saved >= 0) {
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+	}
+
+	if (null_fd >= 0)
+		close(null_fd);
+
+	if (ret < 0)
+		fprintf(stderr, "powerexport: power %s failed\n", cmd);
+
+	return ret;
+}
+
+static void fill(powerbuf_t pb)
+{
+	const unsigned int per_session =
+		POWERBUF_DEFAULT_SAMPLES / NUM_SESSIONS;
+	unsigned int current_ua[READ_CHUNK];
+	address_t mab[READ_CHUNK];
+	unsigned int cur = 1500;
+	address_t pc = 0xc000;
+	int s;
+
+	seed = 1;
+	for (s = 0; s < NUM_SESSIONS; s++) {
+		unsigned int done;
+
+		powerbuf_begin_session(pb, 1500000000 + s * 100);
+		for (done = 0; done < per_session; done += READ_CHUNK) {
+			int i;
+
+			for (i = 0; i < READ_CHUNK; i++) {
+				if (!(rnd() & 7))
+					pc = 0xc000 + (rnd() % 0x800) * 2;
+				else
+					pc += 2 * (rnd() % 3);
+
+				cur += rnd() % 21;
+				cur -= 10;
+				if (cur > 5000)
+					cur = 1500;
+
+				current_ua[i] = cur;
+				mab[i] = pc;
+			}
+
+			powerbuf_add_samples(pb, READ_CHUNK, current_ua, mab);
+		}
+		powerbuf_end_session(pb);
+	}
+}
+
+/* Compare every session of two buffers. Returns the number of sessions
+ * which differ.
+ */
+static int compare(powerbuf_t a, powerbuf_t b)
+{
+	const unsigned int n = powerbuf_stream_sessions(a);
+	unsigned int ua_a[READ_CHUNK];
+	unsigned int ua_b[READ_CHUNK];
+	address_t mab_a[READ_CHUNK];
+	address_t mab_b[READ_CHUNK];
+	int bad = 0;
+	unsigned int i;
+
+	if (n != powerbuf_stream_sessions(b))
+		return n + 1;
+
+	for (i = 0; i < n; i++) {
+		struct powerbuf_stream_info ia;
+		struct powerbuf_stream_info ib;
+		struct powerbuf_stream *sa;
+		struct powerbuf_stream *sb;
+		int ra;
+		int rb;
+
+		powerbuf_stream_info(a, i, &ia);
+		powerbuf_stream_info(b, i, &ib);
+		if (ia.wall_clock != ib.wall_clock ||
+		    ia.length != ib.length || ia.total_ua != ib.total_ua) {
+			bad++;
+			continue;
+		}
+
+		sa = powerbuf_stream_open(a, i);
+		sb = powerbuf_stream_open(b, i);
+		if (!sa || !sb) {
+			if (sa)
+				powerbuf_stream_close(sa);
+			if (sb)
+				powerbuf_stream_close(sb);
+			bad++;
+			continue;
+		}
+
+		do {
+			ra = powerbuf_stream_read(sa, ua_a, mab_a, READ_CHUNK);
+			rb = powerbuf_stream_read(sb, ua_b, mab_b, READ_CHUNK);
+
+			if (ra != rb || (ra > 0 &&
+			    (memcmp(ua_a, ua_b, ra * sizeof(ua_a[0])) ||
+			     memcmp(mab_a, mab_b, ra * sizeof(mab_a[0]))))) {
+				bad++;
+				break;
+			}
+		} while (ra > 0);
+
+		powerbuf_stream_close(sa);
+		powerbuf_stream_close(sb);
+	}
+
+	return bad;
+}
+
+static unsigned long long count_lines(const char *path)
+{
+	FILE *in = fopen(path, "r");
+	unsigned long long n = 0;
+	int c;
+
+	if (!in)
+		return 0;
+
+	while ((c = getc(in)) != EOF)
+		if (c == '\n')
+			n++;
+
+	fclose(in);
+	return n;
+}
+
+static int run(int spill)
+{
+	powerbuf_t pb = powerbuf_new(POWERBUF_DEFAULT_SAMPLES, INTERVAL_US);
+	powerbuf_t pb2 = powerbuf_new(POWERBUF_DEFAULT_SAMPLES, INTERVAL_US);
+	char spill_path[PATH_MAX];
+	char spill2_path[PATH_MAX];
+	char csv_path[PATH_MAX];
+	char bin_path[PATH_MAX];
+	unsigned long long samples = 0;
+	unsigned long long csv_lines = 0;
+	long long csv_bytes = 0;
+	long long bin_bytes;
+	double csv_time;
+	double bin_time;
+	double imp_time;
+	double start;
+	unsigned int s;
+	int ret = -1;
+	int rep;
+
+	tmp_path(spill_path, "spill");
+	tmp_path(spill2_path, "spill2");
+	tmp_path(csv_path, "csv");
+	tmp_path(bin_path, "bin");
+
+	if (!pb || !pb2)
+		goto out;
+
+	if (spill && (powerbuf_spill_start(pb, spill_path) < 0 ||
+		      powerbuf_spill_start(pb2, spill2_path) < 0))
+		goto out;
+
+	fill(pb);
+
+	csv_time = 0;
+	for (rep = 0; rep < REPS; rep++) {
+		csv_bytes = 0;
+		for (s = 0; s < powerbuf_stream_sessions(pb); s++) {
+			start = now();
+			if (run_power(pb, "export-csv %d %s",
+				      s, csv_path) < 0)
+				goto out;
+			csv_time += now() - start;
+
+			csv_bytes += file_size(csv_path);
+			if (!rep)
+				csv_lines += count_lines(csv_path);
+		}
+	}
+	csv_time /= REPS;
+
+	start = now();
+	for (rep = 0; rep < REPS; rep++)
+		if (run_power(pb, "export-bin %s", bin_path) < 0)
+			goto out;
+	bin_time = (now() - start) / REPS;
+	bin_bytes = file_size(bin_path);
+
+	start = now();
+	for (rep = 0; rep < REPS; rep++)
+		if (run_power(pb2, "import-bin %s", bin_path) < 0)
+			goto out;
+	imp_time = (now() - start) / REPS;
+
+	for (s = 0; s < powerbuf_stream_sessions(pb); s++) {
+		struct powerbuf_stream_info info;
+
+		powerbuf_stream_info(pb, s, &info);
+		samples += info.length;
+	}
+
+	printf("%llu samples in %d sessions (%s):\n", samples,
+	       powerbuf_stream_sessions(pb), spill ? "spill mode" : "memory");
+	printf("  CSV     %9lld bytes %6.2f bytes/sample  "
+	       "export %7.1f ms\n", csv_bytes,
+	       (double)csv_bytes / samples, csv_time * 1000.0);
+	printf("  binary  %9lld bytes %6.2f bytes/sample  "
+	       "export %7.1f ms  import %7.1f ms\n", bin_bytes,
+	       (double)bin_bytes / samples, bin_time * 1000.0,
+	       imp_time * 1000.0);
+
+	ret = 0;
+	if (csv_lines != samples) {
+		printf("  CSV has %llu records\n", csv_lines);
+		ret = -1;
+	}
+
+	if (compare(pb, pb2)) {
+		printf("  imported sessions differ\n");
+		ret = -1;
+	}
+
+out:
+	if (pb)
+		powerbuf_free(pb);
+	if (pb2)
+		powerbuf_free(pb2);
+
+	remove(spill_path);
+	remove(spill2_path);
+	remove(csv_path);
+	remove(bin_path);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret;
+
+	if (argc > 1)
+		dir = argv[1];
+
+	device_default = &dev;
+
+	ret = run(0);
+	if (!ret)
+		ret = run(1);
+
+	return ret;
+}
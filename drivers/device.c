@@ -19,6 +19,8 @@
 #include <string.h>
 #include "output.h"
 #include "device.h"
+#include "memcache.h"
+#include "opdb.h"
 
 device_t device_default;
 
@@ -243,46 +245,185 @@ int device_is_fram(device_t dev)
 	return dev->chip && (dev->chip->features & CHIPINFO_FEATURE_FRAM);
 }
 
-int device_erase(device_erase_type_t et, address_t addr)
+static struct memcache *get_cache(device_t dev)
+{
+	if (!dev->cache && dev->chip)
+		dev->cache = memcache_new();
+
+	return dev->cache;
+}
+
+int device_readmem_dev(device_t dev, address_t addr,
+		       uint8_t *mem, address_t len)
+{
+	struct memcache *c = get_cache(dev);
+
+	if (!c || dev->cache_running || !opdb_get_boolean("mem_cache"))
+		return dev->type->readmem(dev, addr, mem, len);
+
+	return memcache_read(c, dev, addr, mem, len);
+}
+
+int device_writemem_dev(device_t dev, address_t addr,
+			const uint8_t *mem, address_t len)
 {
-	if (device_is_fram(device_default)) {
+	struct memcache *c = get_cache(dev);
+	int r = dev->type->writemem(dev, addr, mem, len);
+
+	if (c) {
+		if (r < 0)
+			memcache_invalidate(c, 0);
+		else
+			memcache_write(c, addr, mem, len);
+	}
+
+	return r;
+}
+
+int device_ctl_dev(device_t dev, device_ctl_t op)
+{
+	struct memcache *c = get_cache(dev);
+
+	if (c) {
+		switch (op) {
+		case DEVICE_CTL_RUN:
+		case DEVICE_CTL_SECURE:
+			memcache_invalidate(c, 0);
+			dev->cache_running = 1;
+			break;
+
+		case DEVICE_CTL_STEP:
+		case DEVICE_CTL_RESET:
+			memcache_invalidate(c, 1);
+			dev->cache_running = 0;
+			break;
+
+		case DEVICE_CTL_HALT:
+			dev->cache_running = 0;
+			break;
+		}
+	}
+
+	return dev->type->ctl(dev, op);
+}
+
+void device_cache_flush(device_t dev)
+{
+	if (dev->cache)
+		memcache_invalidate(dev->cache, 0);
+}
+
+void device_destroy_dev(device_t dev)
+{
+	memcache_destroy(dev->cache);
+	dev->cache = NULL;
+	dev->type->destroy(dev);
+}
+
+int device_erase_dev(device_t dev, device_erase_type_t et, address_t addr)
+{
+	if (device_is_fram(dev)) {
 		printc_err("warning: not attempting erase of FRAM device\n");
 		return 0;
 	}
 
-	return device_default->type->erase(device_default, et, addr);
+	device_cache_flush(dev);
+	return dev->type->erase(dev, et, addr);
+}
+
+int device_erase(device_erase_type_t et, address_t addr)
+{
+	return device_erase_dev(device_default, et, addr);
+}
+
+int device_verify_readback(device_t dev, address_t addr,
+			   const uint8_t *mem, address_t len)
+{
+	while (len) {
+		uint8_t buf[1024];
+		int count = len > sizeof(buf) ? sizeof(buf) : len;
+
+		if (device_readmem_dev(dev, addr, buf, count) < 0)
+			return -1;
+
+		if (memcmp(buf, mem, count))
+			return 0;
+
+		addr += count;
+		mem += count;
+		len -= count;
+	}
+
+	return 1;
 }
 
+int device_verify_dev(device_t dev, address_t addr,
+		      const uint8_t *mem, address_t len)
+{
+	if (!len)
+		return 1;
+
+	if (dev->type->verifymem)
+		return dev->type->verifymem(dev, addr, mem, len);
+
+	return device_verify_readback(dev, addr, mem, len);
+}
+
+static const struct chipinfo_memory default_memory[] = {
+	{
+		.name		= "DefaultFlash",
+		.type		= CHIPINFO_MEMTYPE_FLASH,
+		.bits		= 20,
+		.mapped		= 1,
+		.size		= 0xff000,
+		.offset		= 0x01000,
+		.seg_size	= 0,
+		.bank_size	= 0,
+		.banks		= 1,
+	},
+	{
+		.name		= "DefaultRam",
+		.type		= CHIPINFO_MEMTYPE_RAM,
+		.bits		= 20,
+		.mapped		= 1,
+		.size		= 0x01000,
+		.offset		= 0x00000,
+		.seg_size	= 0,
+		.bank_size	= 0,
+		.banks		= 1,
+	},
+	{0}
+};
+
 static const struct chipinfo default_chip = {
 		.name		= "DefaultChip",
 		.bits		= 20,
-		.memory		= {
-			{
-				.name		= "DefaultFlash",
-				.type		= CHIPINFO_MEMTYPE_FLASH,
-				.bits		= 20,
-				.mapped		= 1,
-				.size		= 0xff000,
-				.offset		= 0x01000,
-				.seg_size	= 0,
-				.bank_size	= 0,
-				.banks		= 1,
-			},
-			{
-				.name		= "DefaultRam",
-				.type		= CHIPINFO_MEMTYPE_RAM,
-				.bits		= 20,
-				.mapped		= 1,
-				.size		= 0x01000,
-				.offset		= 0x00000,
-				.seg_size	= 0,
-				.bank_size	= 0,
-				.banks		= 1,
-			},
-			{0}
-		},
+		.memory		= default_memory,
 	};
 
+/* Trim a range given the region found for its start address */
+static address_t trim_range(const struct chipinfo_memory *m,
+			    address_t addr, address_t size,
+			    const struct chipinfo_memory **m_ret)
+{
+	if (m) {
+		if (m->offset > addr) {
+			address_t n = m->offset - addr;
+
+			if (size > n)
+				size = n;
+
+			m = NULL;
+		} else if (addr + size > m->offset + m->size) {
+			size = m->offset + m->size - addr;
+		}
+	}
+
+	*m_ret = m;
+
+	return size;
+}
+
 /* Given an address range, specified by a start and a size (in bytes),
  * return a size which is trimmed so as to not overrun a region boundary
  * in the chip's memory map.
@@ -299,25 +440,28 @@ address_t check_range(const struct chipinfo *chip,
 		chip = &default_chip;
 	}
 
-	const struct chipinfo_memory *m =
-		chipinfo_find_mem_by_addr(chip, addr);
-
-	if (m) {
-		if (m->offset > addr) {
-			address_t n = m->offset - addr;
-
-			if (size > n)
-				size = n;
+	return trim_range(chipinfo_find_mem_by_addr(chip, addr),
+			  addr, size, m_ret);
+}
 
-			m = NULL;
-		} else if (addr + size > m->offset + m->size) {
-			size = m->offset + m->size - addr;
-		}
+address_t device_check_range(device_t dev, address_t addr, address_t size,
+			     const struct chipinfo_memory **m_ret)
+{
+	const struct chipinfo *chip = dev->chip ? dev->chip : &default_chip;
+
+	if (dev->range_chip != chip) {
+		dev->num_intervals = chipinfo_flatten(chip, dev->intervals);
+		dev->range_chip = chip;
+	} else if (addr - dev->range_start <=
+		   dev->range_last - dev->range_start) {
+		return trim_range(dev->range_mem, addr, size, m_ret);
 	}
 
-	*m_ret = m;
+	dev->range_mem = chipinfo_find_interval(dev->intervals,
+		dev->num_intervals, addr,
+		&dev->range_start, &dev->range_last);
 
-	return size;
+	return trim_range(dev->range_mem, addr, size, m_ret);
 }
 
 /* Read bytes from device taking care of memory types.
@@ -342,7 +486,7 @@ int readmem(device_t dev, address_t addr,
 	/* Handle unaligned start */
 	if (addr & 1) {
 		uint8_t data[2];
-		check_range(dev->chip, addr - 1, 2, &m);
+		device_check_range(dev, addr - 1, 2, &m);
 		if (!m)
 			data[1] = 0x55;
 		else if (read_words(dev, m, addr - 1, 2, data) < 0)
@@ -356,7 +500,7 @@ int readmem(device_t dev, address_t addr,
 
 	/* Read aligned blocks */
 	while (len >= 2) {
-		int rlen = check_range(dev->chip, addr, len & ~1, &m);
+		int rlen = device_check_range(dev, addr, len & ~1, &m);
 		if (!m)
 			memset(mem, 0x55, rlen);
 		else {
@@ -373,7 +517,7 @@ int readmem(device_t dev, address_t addr,
 	/* Handle unaligned end */
 	if (len) {
 		uint8_t data[2];
-		check_range(dev->chip, addr, 2, &m);
+		device_check_range(dev, addr, 2, &m);
 		if (!m)
 			data[0] = 0x55;
 		else if (read_words(dev, m, addr, 2, data) < 0)
@@ -411,7 +555,7 @@ int writemem(device_t dev, address_t addr,
 	/* Handle unaligned start */
 	if (addr & 1) {
 		uint8_t data[2];
-		check_range(dev->chip, addr - 1, 2, &m);
+		device_check_range(dev, addr - 1, 2, &m);
 		if (!m)
 			goto fail; // fail on unmapped regions
 
@@ -429,7 +573,7 @@ int writemem(device_t dev, address_t addr,
 	}
 
 	while (len >= 2) {
-		int wlen = check_range(dev->chip, addr, len & ~1, &m);
+		int wlen = device_check_range(dev, addr, len & ~1, &m);
 		if (!m)
 			goto fail; // fail on unmapped regions
 
@@ -445,7 +589,7 @@ int writemem(device_t dev, address_t addr,
 	/* Handle unaligned end */
 	if (len) {
 		uint8_t data[2];
-		check_range(dev->chip, addr, 2, &m);
+		device_check_range(dev, addr, 2, &m);
 		if (!m)
 			goto fail; // fail on unmapped regions
 
@@ -28,6 +28,8 @@
 struct device;
 typedef struct device *device_t;
 
+struct memcache;
+
 typedef enum {
 	DEVICE_CTL_RESET,
 	DEVICE_CTL_RUN,
@@ -88,6 +90,7 @@ struct device_args {
 	int			bsl_gpio_used;
 	int			bsl_gpio_rts;
 	int			bsl_gpio_dtr;
+	int			bsl_baud_rate;
 	uint8_t                 bsl_entry_password[32];
 	uint16_t vid, pid;
 };
@@ -108,6 +111,15 @@ struct device_class {
 	int (*writemem)(device_t dev, address_t addr,
 			const uint8_t *mem, address_t len);
 
+	/* Compare device memory against the given data using a checksum
+	 * computed on the target, so that the data needn't be read
+	 * back. This is optional, and may disturb the CPU state, so
+	 * callers reset the CPU afterwards. Returns 1 if the contents
+	 * match, 0 if they differ, or -1 if an error occurs.
+	 */
+	int (*verifymem)(device_t dev, address_t addr,
+			 const uint8_t *mem, address_t len);
+
 	/* Erase memory */
 	int (*erase)(device_t dev, device_erase_type_t type,
 		     address_t address);
@@ -148,6 +160,25 @@ struct device {
 	 */
 	const struct chipinfo *chip;
 	int need_probe;
+
+	/* Host-side memory cache, created on first use. This should be
+	 * accessed only via the device_*_dev() helpers below, which
+	 * keep it coherent.
+	 */
+	struct memcache *cache;
+	int cache_running;
+
+	/* The memory map of range_chip, flattened by the first
+	 * device_check_range() call after the chip is set. The result of
+	 * the last lookup is kept, with the range of addresses for which
+	 * it holds.
+	 */
+	const struct chipinfo *range_chip;
+	struct chipinfo_interval intervals[CHIPINFO_MAX_INTERVALS];
+	unsigned int num_intervals;
+	address_t range_start;
+	address_t range_last;
+	const struct chipinfo_memory *range_mem;
 };
 
 /* Probe the device memory and extract ID bytes. This should be called
@@ -173,27 +204,74 @@ int device_setbrk(device_t dev, int which, int enabled, address_t address,
 
 extern device_t device_default;
 
+/* Access memory, control the CPU, or destroy a device, keeping the
+ * host-side memory cache coherent. Reads are served from the cache
+ * where possible (unless the mem_cache option is disabled). Writes go
+ * straight through to the device. Flash and ROM stay cached until
+ * they're erased or written, or the CPU runs. RAM is also discarded
+ * when the CPU is stepped or reset.
+ */
+int device_readmem_dev(device_t dev, address_t addr,
+		       uint8_t *mem, address_t len);
+int device_writemem_dev(device_t dev, address_t addr,
+			const uint8_t *mem, address_t len);
+int device_ctl_dev(device_t dev, device_ctl_t op);
+void device_destroy_dev(device_t dev);
+
+/* Discard everything in a device's memory cache. */
+void device_cache_flush(device_t dev);
+
 /* Helper macros for operating on the default device */
-#define device_destroy() device_default->type->destroy(device_default)
+#define device_destroy() device_destroy_dev(device_default)
 #define device_readmem(addr, mem, len) \
-	device_default->type->readmem(device_default, addr, mem, len)
+	device_readmem_dev(device_default, addr, mem, len)
 #define device_writemem(addr, mem, len) \
-	device_default->type->writemem(device_default, addr, mem, len)
+	device_writemem_dev(device_default, addr, mem, len)
 #define device_getregs(regs) \
 	device_default->type->getregs(device_default, regs)
 #define device_setregs(regs) \
 	device_default->type->setregs(device_default, regs)
 #define device_ctl(op) \
-	device_default->type->ctl(device_default, op)
+	device_ctl_dev(device_default, op)
 #define device_poll() \
 	device_default->type->poll(device_default)
 
 int device_erase(device_erase_type_t et, address_t addr);
 
+/* Erase memory on a specific device, rather than the default. As with
+ * device_erase(), erase requests for FRAM devices are ignored.
+ */
+int device_erase_dev(device_t dev, device_erase_type_t et, address_t addr);
+
+/* Compare device memory against the given data. The driver's
+ * verifymem() method is used if it has one, otherwise the memory is
+ * read back and compared on the host. Returns 1 if the contents match,
+ * 0 if they differ, or -1 if an error occurs.
+ *
+ * A target-side checksum may reset the CPU, so the caller should reset
+ * it afterwards, as prog and verify do.
+ */
+int device_verify_dev(device_t dev, address_t addr,
+		      const uint8_t *mem, address_t len);
+
+/* Compare by reading back device memory. This is the fallback used by
+ * device_verify_dev(), and may be used by drivers for ranges which
+ * they can't checksum.
+ */
+int device_verify_readback(device_t dev, address_t addr,
+			   const uint8_t *mem, address_t len);
+
 address_t check_range(const struct chipinfo *chip,
 			     address_t addr, address_t size,
 			     const struct chipinfo_memory **m_ret);
 
+/* As for check_range(), for the device's chip. The region found is
+ * remembered, so that runs of accesses within it are resolved without
+ * a search.
+ */
+address_t device_check_range(device_t dev, address_t addr, address_t size,
+			     const struct chipinfo_memory **m_ret);
+
 int readmem(device_t dev, address_t addr,
 		uint8_t *mem, address_t len,
 		int (*read_words)(device_t dev,
@@ -32,10 +32,15 @@ struct fet3 {
 	struct v3hil		hil;
 };
 
+/* Reads at least this large report their throughput */
+#define REPORT_READ_SIZE	4096
+
 static int fet3_readmem(device_t dev_base, address_t addr,
 			uint8_t *mem, address_t len)
 {
 	struct fet3 *fet = (struct fet3 *)dev_base;
+	const unsigned long long start = time_ms();
+	const address_t total = len;
 
 	if (addr & 1) {
 		uint8_t word[2];
@@ -49,7 +54,7 @@ static int fet3_readmem(device_t dev_base, address_t addr,
 	}
 
 	while (len >= 2) {
-		int r = 128;
+		int r = V3HIL_MAX_READ;
 
 		if (r > len)
 			r = len;
@@ -74,6 +79,14 @@ static int fet3_readmem(device_t dev_base, address_t addr,
 		len--;
 	}
 
+	if (total >= REPORT_READ_SIZE) {
+		unsigned long long elapsed = time_ms() - start;
+
+		printc_dbg("fet3: read %d bytes in %llu ms (%llu bytes/s)\n",
+			   total, elapsed,
+			   elapsed ? total * 1000ULL / elapsed : 0ULL);
+	}
+
 	return 0;
 }
 
@@ -97,7 +110,7 @@ static int fet3_writemem(device_t dev_base, address_t addr,
 	}
 
 	while (len >= 2) {
-		int r = 128;
+		int r = V3HIL_MAX_FLASH_WRITE;
 
 		if (r > len)
 			r = len;
@@ -128,6 +141,29 @@ static int fet3_writemem(device_t dev_base, address_t addr,
 	return 0;
 }
 
+static int fet3_verifymem(device_t dev_base, address_t addr,
+			  const uint8_t *mem, address_t len)
+{
+	struct fet3 *fet = (struct fet3 *)dev_base;
+	int match = 1;
+
+	if ((addr & 1) || (len & 1) || !fet->hil.chip)
+		return device_verify_readback(dev_base, addr, mem, len);
+
+	while (len && match) {
+		int r = v3hil_verify(&fet->hil, addr, mem, len, &match);
+
+		if (r < 0)
+			return -1;
+
+		addr += r;
+		mem += r;
+		len -= r;
+	}
+
+	return match;
+}
+
 static int fet3_setregs(device_t dev_base, const address_t *regs)
 {
 	struct fet3 *fet = (struct fet3 *)dev_base;
@@ -305,6 +341,7 @@ const struct device_class device_ezfet = {
 	.destroy	= fet3_destroy,
 	.readmem	= fet3_readmem,
 	.writemem	= fet3_writemem,
+	.verifymem	= fet3_verifymem,
 	.getregs	= fet3_getregs,
 	.setregs	= fet3_setregs,
 	.ctl		= fet3_ctl,
@@ -31,6 +31,7 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
 #include "fet_db.h"
 #include "util.h"
@@ -38524,68 +38525,169 @@ static const struct fet_db_record fet_db[] = {{        .name= "Prototype_MSP430F
 },
 };
 
- const struct fet_db_record *fet_db_find_by_msg28(uint8_t *data, int len )
-{	int i;
+/* Records are indexed by the two mandatory ID bytes of their msg28
+ * data. by_id holds record indices sorted by hash bucket, then by ID,
+ * then by specificity (the number of optional fields which must
+ * match), most specific first, and otherwise in database order. The
+ * first record in a bucket which matches is the best match.
+ *
+ * by_name holds record indices sorted by name, for lookups by name and
+ * for listing.
+ *
+ * Both are built on first use.
+ */
+#define ID_BUCKETS		64
+
+static const int optional_fields[] = {
+	2,	/* REV */
+	3,	/* FAB */
+	9,	/* SELF */
+	13,	/* CONF */
+	16	/* FUSES */
+};
 
-	for (i = 0; i < ARRAY_LEN(fet_db); i++) {
-		const struct fet_db_record *r = &fet_db[i];
+static uint16_t by_id[ARRAY_LEN(fet_db)];
+static uint16_t bucket_start[ID_BUCKETS + 1];
+static uint16_t by_name[ARRAY_LEN(fet_db)];
+static int index_ready;
 
-		if ( r->msg28_data[ 0 ] != data[  0 ]  ) { continue; }  /* ID    (off:  0), mandatory */
-	if ( r->msg28_data[ 1 ] != data[  1 ]  ) { continue; }  /* ID    (off:  1), mandatory */
+static int id_bucket(const uint8_t *msg28)
+{
+	return (msg28[0] * 31 + msg28[1]) & (ID_BUCKETS - 1);
+}
 
-		if (( r->msg28_data[  2 ] != 0xFF )
-	&&  ( r->msg28_data[  2 ] != data[  2 ] )) { continue; } /* REV   (off:  2), optional */
+static int specificity(const struct fet_db_record *r)
+{
+	int count = 0;
+	int i;
 
-		if (( r->msg28_data[  3 ] != 0xFF )
-		&&  ( r->msg28_data[  3 ] != data[  3 ] )) { continue; } /* FAB   (off:  3), optional  */
+	for (i = 0; i < ARRAY_LEN(optional_fields); i++)
+		if (r->msg28_data[optional_fields[i]] != 0xFF)
+			count++;
 
-		if (( r->msg28_data[  9 ] != 0xFF )
-		&&  ( r->msg28_data[  9 ] != data[  9 ] )) { continue; } /* SELF 1 (off:  9), optional  */
+	return count;
+}
 
-		if (( r->msg28_data[ 13 ] != 0xFF )
-	&&  ( r->msg28_data[ 13 ] != data[ 13 ] )) { continue; } /* CONF  (off: 25), optional  */
+static int id_cmp(const void *a, const void *b)
+{
+	const int ia = *(const uint16_t *)a;
+	const int ib = *(const uint16_t *)b;
+	const uint8_t *ma = fet_db[ia].msg28_data;
+	const uint8_t *mb = fet_db[ib].msg28_data;
+
+	if (id_bucket(ma) != id_bucket(mb))
+		return id_bucket(ma) - id_bucket(mb);
+	if (ma[0] != mb[0])
+		return ma[0] - mb[0];
+	if (ma[1] != mb[1])
+		return ma[1] - mb[1];
+	if (specificity(&fet_db[ia]) != specificity(&fet_db[ib]))
+		return specificity(&fet_db[ib]) - specificity(&fet_db[ia]);
+
+	return ia - ib;
+}
 
-		if (( r->msg28_data[ 16 ] != 0xFF )
-	&&  ( r->msg28_data[ 16 ] != data[ 16 ] )) { continue; } /* FUSES (off: 28), optional  */
+static int name_cmp(const void *a, const void *b)
+{
+	const int ia = *(const uint16_t *)a;
+	const int ib = *(const uint16_t *)b;
+	const int r = strcasecmp(fet_db[ia].name, fet_db[ib].name);
 
-#ifdef MSP430_STORED_INFO
+	return r ? r : ia - ib;
+}
 
-      r->jtagId     = r->msg28_data[ 18 ];    /* The JTAG ID - value returned on an instruction shift.*/
-      r->coreIpId   = (uint16_t)data[ 19 ]
-		    | (uint16_t)data[ 20 ] << 8;
-      r->deviceIdPtr= (uint16_t)data[ 21 ]
-		    | (uint16_t)data[ 22 ] << 8;
-      r->eemVersion = (uint16_t)data[ 24 ]
-		    | (uint16_t)data[ 25 ] << 8;
-#endif
+static void build_index(void)
+{
+	int i;
 
-      return( r );
-   }
+	if (index_ready)
+		return;
 
-	return NULL;
+	for (i = 0; i < ARRAY_LEN(fet_db); i++) {
+		by_id[i] = i;
+		by_name[i] = i;
+	}
+
+	qsort(by_id, ARRAY_LEN(by_id), sizeof(by_id[0]), id_cmp);
+	qsort(by_name, ARRAY_LEN(by_name), sizeof(by_name[0]), name_cmp);
+
+	memset(bucket_start, 0, sizeof(bucket_start));
+	for (i = 0; i < ARRAY_LEN(fet_db); i++)
+		bucket_start[id_bucket(fet_db[i].msg28_data) + 1]++;
+	for (i = 0; i < ID_BUCKETS; i++)
+		bucket_start[i + 1] += bucket_start[i];
+
+	index_ready = 1;
 }
 
+static int is_match(const struct fet_db_record *r, const uint8_t *data)
+{
+	int i;
 
-const struct fet_db_record *fet_db_find_by_name(const char *name)
+	/* ID (offsets 0 and 1) is mandatory */
+	if (r->msg28_data[0] != data[0] || r->msg28_data[1] != data[1])
+		return 0;
+
+	for (i = 0; i < ARRAY_LEN(optional_fields); i++) {
+		const int f = optional_fields[i];
+
+		if (r->msg28_data[f] != 0xFF && r->msg28_data[f] != data[f])
+			return 0;
+	}
+
+	return 1;
+}
+
+const struct fet_db_record *fet_db_find_by_msg28(uint8_t *data, int len)
 {
+	const int b = id_bucket(data);
 	int i;
 
-	for (i = 0; i < ARRAY_LEN(fet_db); i++) {
-		const struct fet_db_record *r = &fet_db[i];
+	(void)len;
+	build_index();
+
+	for (i = bucket_start[b]; i < bucket_start[b + 1]; i++) {
+		const struct fet_db_record *r = &fet_db[by_id[i]];
 
-		if (!strcasecmp(r->name, name))
+		if (is_match(r, data))
 			return r;
 	}
 
 	return NULL;
 }
 
+const struct fet_db_record *fet_db_find_by_name(const char *name)
+{
+	int lo = 0;
+	int hi = ARRAY_LEN(by_name);
+
+	build_index();
+
+	/* Find the first record whose name is not less than the key */
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (strcasecmp(fet_db[by_name[mid]].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < ARRAY_LEN(by_name) &&
+	    !strcasecmp(fet_db[by_name[lo]].name, name))
+		return &fet_db[by_name[lo]];
+
+	return NULL;
+}
+
 int fet_db_enum(fet_db_enum_func_t func, void *user_data)
 {
 	int i;
 
-	for (i = 0; i < ARRAY_LEN(fet_db); i++)
-		if (func(user_data, &fet_db[i]) < 0)
+	build_index();
+
+	for (i = 0; i < ARRAY_LEN(by_name); i++)
+		if (func(user_data, &fet_db[by_name[i]]) < 0)
 			return -1;
 
 	return 0;
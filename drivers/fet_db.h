@@ -38,7 +38,8 @@ struct fet_db_record {
 
 /* Find a record in the database by its response to message 0x28. The
  * first two bytes _must_ match, and the remaining bytes should match
- * as much as possible.
+ * as much as possible: of the records which match, the one which
+ * constrains the most fields is returned.
  */
 const struct fet_db_record *fet_db_find_by_msg28(uint8_t *data, int len);
 
@@ -46,7 +47,8 @@ const struct fet_db_record *fet_db_find_by_msg28(uint8_t *data, int len);
  */
 const struct fet_db_record *fet_db_find_by_name(const char *name);
 
-/* Call the given enumeration function for all records in the database.
+/* Call the given enumeration function for all records in the database,
+ * in order of name.
  */
 typedef int (*fet_db_enum_func_t)(void *user_data,
 				  const struct fet_db_record *rec);
@@ -39,12 +39,24 @@ struct flash_bsl_device {
 	const struct device_args *args;
 
 	const char	*seq;
+
+	/* Data bytes per read or write packet */
+	int		block_size;
+
+	/* Whether RX_DATA_BLOCK_FAST works: 1 if so, 0 if not, or -1 if
+	 * we haven't tried it yet.
+	 */
+	int		fast_write;
 };
 
-#define MAX_BLOCK	256
+/* Block size used if the BSL doesn't report its buffer size */
+#define DEFAULT_BLOCK	256
+
+/* Largest block size we'll use, whatever the BSL reports */
+#define MAX_BLOCK	1024
 
 /* This should be at least MAX_BLOCK + 4 */
-#define MAX_PACKET	512
+#define MAX_PACKET	(MAX_BLOCK + 16)
 
 /* adapted from TI's published BSL source code */
 #define CRC_INIT 0xffff
@@ -101,6 +113,7 @@ static void crc_selftest(void) {
 #define TX_DATA_BLOCK 0x18
 #define TX_BSL_VERSION 0x19
 #define TX_BUFFER_SIZE 0x1a
+#define CHANGE_BAUD_RATE 0x52
 
 static int flash_bsl_send(struct flash_bsl_device *dev,
 			  const uint8_t *data, int len)
@@ -274,7 +287,7 @@ static int flash_bsl_readmem(device_t dev_base,
 			     address_t addr, uint8_t *mem, address_t len)
 {
 	struct flash_bsl_device *dev = (struct flash_bsl_device *)dev_base;
-	uint8_t recv_buf[MAX_BLOCK*2];
+	uint8_t recv_buf[MAX_BLOCK + 1];
 	uint8_t send_buf[64];
 	uint16_t read_size;
 	int ret;
@@ -285,8 +298,8 @@ static int flash_bsl_readmem(device_t dev_base,
 	}
 
 	while (len > 0) {
-		if (len > MAX_BLOCK) {
-			read_size = MAX_BLOCK;
+		if (len > dev->block_size) {
+			read_size = dev->block_size;
 		} else {
 			read_size = len;
 		}
@@ -483,71 +496,317 @@ static int flash_bsl_setregs(device_t dev_base, const address_t *regs)
 	return -1;
 }
 
-static int flash_bsl_writemem(device_t dev_base,
-			address_t addr, const uint8_t *mem, address_t len)
+/* Request the CRC of a block of memory. The reply is collected by
+ * crc_check_recv().
+ */
+static int crc_check_send(struct flash_bsl_device *dev,
+			  address_t addr, uint16_t size)
+{
+	uint8_t send_buf[6];
+
+	send_buf[0] = CRC_CHECK;
+	send_buf[1] = addr & 0xff;
+	send_buf[2] = (addr >> 8) & 0xff;
+	send_buf[3] = (addr >> 16) & 0xff;
+	send_buf[4] = size & 0xff;
+	send_buf[5] = (size >> 8) & 0xff;
+
+	if (flash_bsl_send(dev, send_buf, sizeof(send_buf)) < 0) {
+		printc_err("flash_bsl verify: send failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int crc_check_recv(struct flash_bsl_device *dev, uint16_t *crc)
+{
+	uint8_t recv_buf[16];
+	int ret;
+
+	ret = flash_bsl_recv(dev, recv_buf, sizeof(recv_buf));
+	if (ret < 0) {
+		printc_err("flash_bsl verify: receive failed\n");
+		return -1;
+	}
+
+	if (ret >= 2 && recv_buf[0] == 0x3b) {
+		flash_bsl_perror(recv_buf[1]);
+		return -1;
+	}
+
+	if (ret < 3 || recv_buf[0] != 0x3a) {
+		printc_err("flash_bsl verify: invalid response\n");
+		return -1;
+	}
+
+	*crc = recv_buf[1] | (recv_buf[2] << 8);
+	return 0;
+}
+
+/* Compare memory using the BSL's CRC_CHECK command, which returns the
+ * CRC of a block of memory.
+ */
+static int flash_bsl_verifymem(device_t dev_base,
+			       address_t addr, const uint8_t *mem,
+			       address_t len)
 {
 	struct flash_bsl_device *dev = (struct flash_bsl_device *)dev_base;
-	uint8_t send_buf[2*MAX_BLOCK];
+
+	if (addr > 0xfffff || addr + len > 0x100000) {
+		printc_err("flash_bsl: verify exceeds possible range\n");
+		return -1;
+	}
+
+	while (len > 0) {
+		uint16_t check_size = len > 0x8000 ? 0x8000 : len;
+		uint16_t crc;
+
+		if (crc_check_send(dev, addr, check_size) < 0 ||
+		    crc_check_recv(dev, &crc) < 0)
+			return -1;
+
+		if (crc != crc_ccitt(mem, check_size))
+			return 0;
+
+		addr += check_size;
+		mem += check_size;
+		len -= check_size;
+	}
+
+	return 1;
+}
+
+/* Send a single block of data. With RX_DATA_BLOCK_FAST, the BSL sends
+ * no reply after writing, so errors go unnoticed until the data is
+ * checked.
+ */
+static int write_block(struct flash_bsl_device *dev, uint8_t cmd,
+		       address_t addr, const uint8_t *mem, uint16_t size)
+{
+	uint8_t send_buf[MAX_BLOCK + 4];
 	uint8_t recv_buf[16];
-	uint16_t write_size;
 	int n_recv;
 
+	send_buf[0] = cmd;
+	send_buf[1] = addr & 0xff;
+	send_buf[2] = (addr >> 8) & 0xff;
+	send_buf[3] = (addr >> 16) & 0xff;
+	memcpy(&send_buf[4], mem, size);
+
+	if (flash_bsl_send(dev, send_buf, size + 4) < 0) {
+		printc_err("flash_bsl: send failed\n");
+		return -1;
+	}
+
+	if (cmd == RX_DATA_BLOCK_FAST)
+		return 0;
+
+	n_recv = flash_bsl_recv(dev, recv_buf, sizeof(recv_buf));
+
+	if (n_recv < 0) {
+		printc_err("flash_bsl write: error occurred receiving response\n");
+		return -1;
+	} else if (n_recv < 2) {
+		printc_err("flash_bsl write: response too short\n");
+		return -1;
+	} else if (recv_buf[0] != 0x3b) {
+		printc_err("flash_bsl write: invalid response received\n");
+		return -1;
+	} else if (recv_buf[1] != 0x00) {
+		printc_err("flash_bsl write: BSL reported write error: ");
+		flash_bsl_perror(recv_buf[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Time to wait for a BSL to reject RX_DATA_BLOCK_FAST */
+#define FAST_PROBE_MS	100
+
+/* Write the first block with RX_DATA_BLOCK_FAST, and find out whether
+ * it worked. A BSL which doesn't support the command replies to it with
+ * an error message, so we wait a little for one before asking for the
+ * block's CRC. We mustn't send anything while the BSL might still be
+ * replying.
+ */
+static int probe_fast_write(struct flash_bsl_device *dev,
+			    address_t addr, const uint8_t *mem,
+			    uint16_t size)
+{
+	uint16_t crc;
+	int r;
+
+	if (write_block(dev, RX_DATA_BLOCK_FAST, addr, mem, size) < 0)
+		return -1;
+
+	r = sport_wait_input(dev->serial_fd, FAST_PROBE_MS);
+	if (r < 0) {
+		printc_err("flash_bsl: serial read failed: %s\n",
+			   last_error());
+		return -1;
+	}
+
+	if (r) {
+		uint8_t recv_buf[16];
+
+		r = flash_bsl_recv(dev, recv_buf, sizeof(recv_buf));
+		if (r < 2 || recv_buf[0] != 0x3b) {
+			printc_err("flash_bsl write: invalid response "
+				   "received\n");
+			return -1;
+		}
+
+		printc_dbg("flash_bsl: fast writes are not supported\n");
+		dev->fast_write = 0;
+		return write_block(dev, RX_DATA_BLOCK, addr, mem, size);
+	}
+
+	if (crc_check_send(dev, addr, size) < 0 ||
+	    crc_check_recv(dev, &crc) < 0)
+		return -1;
+
+	if (crc != crc_ccitt(mem, size)) {
+		printc_err("flash_bsl write: verify failed at 0x%05x\n", addr);
+		return -1;
+	}
+
+	dev->fast_write = 1;
+	return 0;
+}
+
+static int flash_bsl_writemem(device_t dev_base,
+			address_t addr, const uint8_t *mem, address_t len)
+{
+	struct flash_bsl_device *dev = (struct flash_bsl_device *)dev_base;
+	const address_t start_addr = addr;
+	const uint8_t *start_mem = mem;
+	const address_t start_len = len;
+	int r;
+
 	if (addr > 0xfffff || addr + len > 0x100000) {
 		printc_err("flash_bsl: write exceeds possible range\n");
 		return -1;
 	}
 
 	while (len > 0) {
-		/* compute size of this write operation */
-		if (len > MAX_BLOCK) {
-			write_size = MAX_BLOCK;
-		} else {
-			write_size = len;
-		}
+		uint16_t write_size = len > dev->block_size ?
+			dev->block_size : len;
 
-		/* build write command */
-		/* command */
-		send_buf[0] = RX_DATA_BLOCK;
-		/* address */
-		send_buf[1] = addr & 0xff;
-		send_buf[2] = (addr >> 8) & 0xff;
-		send_buf[3] = (addr >> 16) & 0xff;
-		/* data */
-		memcpy(&send_buf[4], mem, write_size);
+		if (dev->fast_write < 0)
+			r = probe_fast_write(dev, addr, mem, write_size);
+		else
+			r = write_block(dev, dev->fast_write ?
+					RX_DATA_BLOCK_FAST : RX_DATA_BLOCK,
+					addr, mem, write_size);
+
+		if (r < 0)
+			return -1;
 
 		addr += write_size;
 		mem += write_size;
 		len -= write_size;
+	}
 
-		/* send command */
-		if (flash_bsl_send(dev, send_buf, write_size + 4) < 0) {
-			printc_err("flash_bsl: send failed\n");
+	/* Fast writes are unacknowledged, so check them all at once */
+	if (dev->fast_write > 0) {
+		r = flash_bsl_verifymem(dev_base, start_addr, start_mem,
+					start_len);
+		if (r < 0)
 			return -1;
-		}
 
-		/* receive and check response */
-		n_recv = flash_bsl_recv(dev, recv_buf, sizeof(recv_buf));
-
-		if (n_recv < 0) {
-			printc_err("flash_bsl write: error occurred receiving response\n");
-			return -1;
-		} else if (n_recv < 2) {
-			printc_err("flash_bsl write: response too short\n");
-			return -1;
-		} else if (recv_buf[0] != 0x3b) {
-			printc_err("flash_bsl write: invalid response received\n");
-			return -1;
-		} else if (recv_buf[1] != 0x00) {
-			printc_err("flash_bsl write: BSL reported write error: ");
-			flash_bsl_perror(recv_buf[1]);
+		if (!r) {
+			printc_err("flash_bsl write: verify failed in "
+				   "0x%05x-0x%05x\n", start_addr,
+				   start_addr + start_len - 1);
 			return -1;
 		}
-		/* else success! */
 	}
 
 	return 0;
 }
 
+/* Use the largest packets the BSL can take. */
+static int query_buffer_size(struct flash_bsl_device *dev)
+{
+	uint8_t cmd = TX_BUFFER_SIZE;
+	uint8_t recv_buf[16];
+	int ret;
+
+	dev->block_size = DEFAULT_BLOCK;
+
+	if (flash_bsl_send(dev, &cmd, 1) < 0) {
+		printc_err("flash_bsl: failed to query buffer size\n");
+		return -1;
+	}
+
+	ret = flash_bsl_recv(dev, recv_buf, sizeof(recv_buf));
+	if (ret < 0) {
+		printc_err("flash_bsl: failed to query buffer size\n");
+		return -1;
+	}
+
+	if (ret >= 3 && recv_buf[0] == 0x3a) {
+		int size = (recv_buf[1] | (recv_buf[2] << 8)) - 4;
+
+		/* Keep word alignment for writes to flash */
+		size &= ~1;
+
+		if (size > MAX_BLOCK)
+			size = MAX_BLOCK;
+		if (size >= 16)
+			dev->block_size = size;
+	}
+
+	printc_dbg("flash_bsl: using %d-byte blocks\n", dev->block_size);
+	return 0;
+}
+
+static int change_baud_rate(struct flash_bsl_device *dev, int rate)
+{
+	static const struct {
+		int		rate;
+		uint8_t		code;
+	} codes[] = {
+		{9600,		0x02},
+		{19200,		0x03},
+		{38400,		0x04},
+		{57600,		0x05},
+		{115200,	0x06}
+	};
+	uint8_t cmd[2];
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(codes); i++)
+		if (codes[i].rate == rate)
+			break;
+
+	if (i >= ARRAY_LEN(codes)) {
+		printc_err("flash_bsl: unsupported baud rate: %d\n", rate);
+		return -1;
+	}
+
+	cmd[0] = CHANGE_BAUD_RATE;
+	cmd[1] = codes[i].code;
+
+	/* The BSL acknowledges, then switches rate */
+	if (flash_bsl_send(dev, cmd, sizeof(cmd)) < 0) {
+		printc_err("flash_bsl: failed to change baud rate\n");
+		return -1;
+	}
+
+	if (sport_set_rate(dev->serial_fd, rate) < 0) {
+		printc_err("flash_bsl: can't set baud rate %d: %s\n",
+			   rate, last_error());
+		return -1;
+	}
+
+	delay_ms(10);
+	printc_dbg("flash_bsl: switched to %d baud\n", rate);
+	return 0;
+}
+
 static void flash_bsl_destroy(device_t dev_base)
 {
 	struct flash_bsl_device *dev = (struct flash_bsl_device *)dev_base;
@@ -588,6 +847,8 @@ static device_t flash_bsl_open(const struct device_args *args)
 	memset(dev, 0, sizeof(*dev));
 	dev->base.type = &device_flash_bsl;
 	dev->args = args;
+	dev->block_size = DEFAULT_BLOCK;
+	dev->fast_write = -1;
 
 	dev->serial_fd = sport_open(args->path, 9600, SPORT_EVEN_PARITY);
 	if (SPORT_ISERR(dev->serial_fd)) {
@@ -653,6 +914,13 @@ static device_t flash_bsl_open(const struct device_args *args)
 	debug_hexdump("BSL version", tx_bsl_version_response,
             sizeof(tx_bsl_version_response));
 
+	if (args->bsl_baud_rate && args->bsl_baud_rate != 9600 &&
+	    change_baud_rate(dev, args->bsl_baud_rate) < 0)
+		goto fail;
+
+	if (query_buffer_size(dev) < 0)
+		goto fail;
+
 	return (device_t)dev;
 
  fail:
@@ -668,6 +936,7 @@ const struct device_class device_flash_bsl = {
 	.destroy	= flash_bsl_destroy,
 	.readmem	= flash_bsl_readmem,
 	.writemem	= flash_bsl_writemem,
+	.verifymem	= flash_bsl_verifymem,
 	.getregs	= flash_bsl_getregs,
 	.setregs	= flash_bsl_setregs,
 	.ctl		= flash_bsl_ctl,
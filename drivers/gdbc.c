@@ -123,12 +123,10 @@ static int gdbc_writemem(device_t dev_base, address_t addr,
 
 	while (len) {
 		int plen = len > xfer_size ? xfer_size : len;
-		int i;
 
 		gdb_packet_start(&dev->gdb);
 		gdb_printf(&dev->gdb, "M%04x,%x:", addr, plen);
-		for (i = 0; i < plen; i++)
-			gdb_printf(&dev->gdb, "%02x", mem[i]);
+		gdb_hex(&dev->gdb, mem, plen);
 		gdb_packet_end(&dev->gdb);
 		if (gdb_flush_ack(&dev->gdb) < 0)
 			return -1;
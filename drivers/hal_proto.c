@@ -60,8 +60,8 @@ static int hal_proto_send_common(struct hal_proto *p, hal_proto_type_t type,
 }
 
 
-int hal_proto_send(struct hal_proto *p, hal_proto_type_t type,
-		   const uint8_t *data, int length)
+static int hal_proto_send_ref(struct hal_proto *p, hal_proto_type_t type,
+			      uint8_t ref, const uint8_t *data, int length)
 {
 	uint8_t buf[512];
 	size_t len = 0;
@@ -73,17 +73,24 @@ int hal_proto_send(struct hal_proto *p, hal_proto_type_t type,
 
 	buf[len++] = length + 3;
 	buf[len++] = type;
-	buf[len++] = p->ref_id;
+	buf[len++] = ref;
 	buf[len++] = 0;
 
-	p->ref_id = (p->ref_id + 1) & 0x7f;
-
 	memcpy(buf + len, data, length);
 	len += length;
 
 	return hal_proto_send_common(p, type, buf, len);
 }
 
+int hal_proto_send(struct hal_proto *p, hal_proto_type_t type,
+		   const uint8_t *data, int length)
+{
+	const uint8_t ref = p->ref_id;
+
+	p->ref_id = (p->ref_id + 1) & 0x7f;
+	return hal_proto_send_ref(p, type, ref, data, length);
+}
+
 
 static int hal_proto_send_ack(struct hal_proto *p, hal_proto_type_t type,
 		const uint8_t *data, int length)
@@ -174,36 +181,101 @@ int hal_proto_receive(struct hal_proto *p, uint8_t *buf, int max_len)
 	return len;
 }
 
-int hal_proto_execute(struct hal_proto *p, uint8_t fid,
-		      const uint8_t *data, int len)
+/* Wait for the acknowledgement of one packet of a multi-packet
+ * request.
+ */
+static int hal_proto_wait_ack(struct hal_proto *p, uint8_t fid)
+{
+	uint8_t buf[HAL_MAX_PAYLOAD];
+	int r = hal_proto_receive(p, buf, sizeof(buf));
+
+	if (r < 0)
+		return -1;
+
+	if (p->type == HAL_PROTO_TYPE_EXCEPTION && r >= 2) {
+		printc_err("hal_proto_execute: fid 0x%02x: HAL exception: "
+			   "0x%04x\n", fid, LE_WORD(buf, 0));
+		return -1;
+	}
+
+	if (p->type != HAL_PROTO_TYPE_ACKNOWLEDGE) {
+		printc_err("hal_proto_execute: fid 0x%02x: no acknowledge "
+			   "(got type 0x%02x)\n", fid, p->type);
+		return -1;
+	}
+
+	return 0;
+}
+
+int hal_proto_execute_into(struct hal_proto *p, uint8_t fid,
+			   const uint8_t *data, int len,
+			   uint8_t *reply, int max_reply)
 {
 	uint8_t fdata[HAL_MAX_PAYLOAD];
+	const uint8_t ref = p->ref_id;
+	int n = 2;
 
-	if (len + 2 > HAL_MAX_PAYLOAD) {
+	if (len + 2 > HAL_MAX_EXECUTE) {
 		printc_err("hal_proto_execute: fid 0x%02x: payload too big: %d\n",
 				fid, len);
 		return -1;
 	}
 
+	p->ref_id = (p->ref_id + 1) & 0x7f;
 	fdata[0] = fid;
 	fdata[1] = 0;
-	memcpy(fdata + 2, data, len);
 
-	if (hal_proto_send(p, HAL_PROTO_TYPE_CMD_EXECUTE, fdata, len + 2) < 0)
-		goto fail;
+	/* Requests which don't fit in a single packet are streamed.
+	 * Every packet but the last has the top bit of the reference
+	 * set, and is acknowledged before the next is sent.
+	 */
+	for (;;) {
+		int count = HAL_MAX_CHUNK - n;
+
+		if (count > len)
+			count = len;
+
+		memcpy(fdata + n, data, count);
+		data += count;
+		len -= count;
+
+		if (hal_proto_send_ref(p, HAL_PROTO_TYPE_CMD_EXECUTE,
+				       len ? (ref | 0x80) : ref,
+				       fdata, n + count) < 0)
+			goto fail;
+
+		if (!len)
+			break;
+
+		if (hal_proto_wait_ack(p, fid) < 0)
+			goto fail;
+
+		n = 0;
+	}
 
 	p->length = 0;
 
 	do {
-		int r = hal_proto_receive(p, p->payload + p->length,
-					  sizeof(p->payload) - p->length);
-
+		const int room = max_reply - p->length;
+		uint8_t tail[256];
+		uint8_t *dst = reply + p->length;
+		int r;
+
+		/* Near the end of the buffer, receive into scratch space
+		 * so that any padding the firmware adds to the reply can
+		 * be discarded rather than overflowing.
+		 */
+		if (room < (int)sizeof(tail))
+			dst = tail;
+
+		r = hal_proto_receive(p, dst,
+				      (dst == tail) ? (int)sizeof(tail) : room);
 		if (r < 0)
 			goto fail;
 
 		if ((p->type == HAL_PROTO_TYPE_EXCEPTION) && (r >= 2)) {
 			printc_err("hal_proto_execute: fid 0x%02x: HAL exception: 0x%04x\n",
-				   fid, LE_WORD(p->payload, p->length));
+				   fid, LE_WORD(dst, 0));
 			goto fail;
 		}
 
@@ -219,6 +291,12 @@ int hal_proto_execute(struct hal_proto *p, uint8_t fid,
 		if (hal_proto_send_ack(p, HAL_PROTO_TYPE_ACKNOWLEDGE, NULL, 0) < 0)
 			goto fail;
 
+		if (dst == tail) {
+			if (r > room)
+				r = room;
+			memcpy(reply + p->length, tail, r);
+		}
+
 		p->length += r;
 	} while (p->ref & 0x80);
 
@@ -228,3 +306,10 @@ fail:
 	printc_err("hal_proto_execute: fid: 0x%02x: failed\n", fid);
 	return -1;
 }
+
+int hal_proto_execute(struct hal_proto *p, uint8_t fid,
+		      const uint8_t *data, int len)
+{
+	return hal_proto_execute_into(p, fid, data, len,
+				      p->payload, sizeof(p->payload));
+}
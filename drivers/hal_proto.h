@@ -188,6 +188,18 @@ typedef enum {
 
 #define HAL_MAX_PAYLOAD		253
 
+/* Largest even payload which doesn't exceed HAL_MAX_PAYLOAD.
+ * Multi-packet requests are split into chunks of this size. It's even
+ * so that word data stays aligned in every packet after the first,
+ * which carries the two-byte function ID header.
+ */
+#define HAL_MAX_CHUNK		252
+
+/* Largest request, including the function ID, accepted by
+ * hal_proto_execute().
+ */
+#define HAL_MAX_EXECUTE		4096
+
 struct hal_proto {
 	transport_t		trans;
 	hal_proto_flags_t	flags;
@@ -215,9 +227,19 @@ int hal_proto_send(struct hal_proto *p, hal_proto_type_t type,
 int hal_proto_receive(struct hal_proto *p, uint8_t *buf, int max_len);
 
 /* Execute a high-level function. The reply data is kept in the payload
- * buffer.
+ * buffer. Request data which doesn't fit in a single packet is sent as
+ * a sequence of continuation packets.
  */
 int hal_proto_execute(struct hal_proto *p, uint8_t fid,
 		      const uint8_t *data, int len);
 
+/* Execute a high-level function, receiving the reply data directly into
+ * the given buffer rather than the payload buffer. The length of the
+ * reply is still recorded in the length field. Reply data beyond
+ * max_reply bytes, such as padding, is discarded.
+ */
+int hal_proto_execute_into(struct hal_proto *p, uint8_t fid,
+			   const uint8_t *data, int len,
+			   uint8_t *reply, int max_reply);
+
 #endif
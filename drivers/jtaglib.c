@@ -432,7 +432,7 @@ static int jtag_verify_psa(struct jtdev *p,
 	psa_value = jtag_dr_shift_16(p, 0x0000);
 	jtag_tclk_set(p);
 
-	return (psa_value == psa_crc) ? 1 : 0;
+	return (psa_value == (psa_crc & 0xffff)) ? 1 : 0;
 }
 
 /* Take target device under JTAG control.
@@ -0,0 +1,205 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memcache.h"
+
+/* Maximum number of missing pages fetched by a single read */
+#define FILL_PAGES		64
+
+struct memcache_page {
+	address_t		addr;
+	int			valid;
+	int			is_ram;
+	uint8_t			data[MEMCACHE_PAGE_SIZE];
+};
+
+struct memcache {
+	struct memcache_page	pages[MEMCACHE_NUM_PAGES];
+
+	unsigned long long	hits;
+	unsigned long long	misses;
+};
+
+struct memcache *memcache_new(void)
+{
+	return calloc(1, sizeof(struct memcache));
+}
+
+void memcache_destroy(struct memcache *c)
+{
+	free(c);
+}
+
+static struct memcache_page *slot(struct memcache *c, address_t page)
+{
+	return &c->pages[(page / MEMCACHE_PAGE_SIZE) % MEMCACHE_NUM_PAGES];
+}
+
+static int is_cacheable(const struct chipinfo_memory *m)
+{
+	return m && (m->type == CHIPINFO_MEMTYPE_FLASH ||
+		     m->type == CHIPINFO_MEMTYPE_ROM ||
+		     m->type == CHIPINFO_MEMTYPE_RAM);
+}
+
+/* Fetch a run of consecutive pages, starting with one which is known
+ * to be missing, and continuing while pages are missing and cacheable.
+ */
+static int fill(struct memcache *c, device_t dev, address_t page,
+		const struct chipinfo_memory *m)
+{
+	uint8_t buf[FILL_PAGES * MEMCACHE_PAGE_SIZE];
+	address_t end = m->offset + m->size;
+	int count = 1;
+	int i;
+
+	while (count < FILL_PAGES) {
+		address_t next = page + count * MEMCACHE_PAGE_SIZE;
+		const struct memcache_page *p = slot(c, next);
+
+		if (next + MEMCACHE_PAGE_SIZE > end ||
+		    (p->valid && p->addr == next))
+			break;
+
+		count++;
+	}
+
+	if (dev->type->readmem(dev, page, buf,
+			       count * MEMCACHE_PAGE_SIZE) < 0)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		struct memcache_page *p =
+			slot(c, page + i * MEMCACHE_PAGE_SIZE);
+
+		p->addr = page + i * MEMCACHE_PAGE_SIZE;
+		p->valid = 1;
+		p->is_ram = (m->type == CHIPINFO_MEMTYPE_RAM);
+		memcpy(p->data, buf + i * MEMCACHE_PAGE_SIZE,
+		       MEMCACHE_PAGE_SIZE);
+	}
+
+	c->misses++;
+	return 0;
+}
+
+int memcache_read(struct memcache *c, device_t dev, address_t addr,
+		  uint8_t *mem, address_t len)
+{
+	while (len) {
+		const address_t page = addr & ~(MEMCACHE_PAGE_SIZE - 1);
+		const address_t offset = addr - page;
+		const struct chipinfo_memory *m;
+		struct memcache_page *p;
+		address_t count = MEMCACHE_PAGE_SIZE - offset;
+
+		if (count > len)
+			count = len;
+
+		/* Pages which aren't entirely within a single cacheable
+		 * region are read directly. If the region isn't
+		 * cacheable at all, read as much of it as possible.
+		 */
+		if (device_check_range(dev, page, MEMCACHE_PAGE_SIZE, &m) !=
+		    MEMCACHE_PAGE_SIZE || !is_cacheable(m)) {
+			if (!is_cacheable(m))
+				count = device_check_range(dev, addr, len, &m);
+
+			if (dev->type->readmem(dev, addr, mem, count) < 0)
+				return -1;
+
+			addr += count;
+			mem += count;
+			len -= count;
+			continue;
+		}
+
+		p = slot(c, page);
+		if (p->valid && p->addr == page)
+			c->hits++;
+		else if (fill(c, dev, page, m) < 0)
+			return -1;
+
+		memcpy(mem, p->data + offset, count);
+		addr += count;
+		mem += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+void memcache_write(struct memcache *c, address_t addr,
+		    const uint8_t *mem, address_t len)
+{
+	while (len) {
+		const address_t page = addr & ~(MEMCACHE_PAGE_SIZE - 1);
+		const address_t offset = addr - page;
+		struct memcache_page *p = slot(c, page);
+		address_t count = MEMCACHE_PAGE_SIZE - offset;
+
+		if (count > len)
+			count = len;
+
+		if (p->valid && p->addr == page) {
+			if (p->is_ram)
+				memcpy(p->data + offset, mem, count);
+			else
+				p->valid = 0;
+		}
+
+		addr += count;
+		mem += count;
+		len -= count;
+	}
+}
+
+void memcache_invalidate(struct memcache *c, int volatile_only)
+{
+	int i;
+
+	for (i = 0; i < MEMCACHE_NUM_PAGES; i++) {
+		struct memcache_page *p = &c->pages[i];
+
+		if (!volatile_only || p->is_ram)
+			p->valid = 0;
+	}
+}
+
+void memcache_get_stats(const struct memcache *c,
+			struct memcache_stats *st)
+{
+	int i;
+
+	st->hits = c->hits;
+	st->misses = c->misses;
+	st->pages = 0;
+
+	for (i = 0; i < MEMCACHE_NUM_PAGES; i++)
+		if (c->pages[i].valid)
+			st->pages++;
+}
+
+void memcache_reset_stats(struct memcache *c)
+{
+	c->hits = 0;
+	c->misses = 0;
+}
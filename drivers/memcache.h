@@ -0,0 +1,72 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MEMCACHE_H_
+#define MEMCACHE_H_
+
+#include "device.h"
+
+/* Host-side cache of target memory. Memory is cached in aligned pages,
+ * and only pages lying entirely within a flash, ROM or RAM region of
+ * the chip's memory map are cached. Peripheral registers are never
+ * cached.
+ *
+ * The cache doesn't know when target memory changes. It's up to the
+ * owner to invalidate it (see device.c).
+ */
+#define MEMCACHE_PAGE_SIZE	64
+#define MEMCACHE_NUM_PAGES	256
+
+struct memcache;
+
+struct memcache_stats {
+	unsigned long long	hits;
+	unsigned long long	misses;
+
+	/* Number of pages currently held */
+	int			pages;
+};
+
+/* Create and destroy a cache. */
+struct memcache *memcache_new(void);
+void memcache_destroy(struct memcache *c);
+
+/* Read memory, filling the cache from the device as necessary. Reads
+ * from uncached regions are passed straight to the driver.
+ */
+int memcache_read(struct memcache *c, device_t dev, address_t addr,
+		  uint8_t *mem, address_t len);
+
+/* Record data written to the device. Cached RAM pages are updated.
+ * Other pages (such as flash, where the result of a write isn't the
+ * data written) are discarded.
+ */
+void memcache_write(struct memcache *c, address_t addr,
+		    const uint8_t *mem, address_t len);
+
+/* Discard cached pages. If volatile_only is set, only RAM is
+ * discarded, otherwise the whole cache is emptied.
+ */
+void memcache_invalidate(struct memcache *c, int volatile_only);
+
+/* Retrieve and reset hit/miss counters. */
+void memcache_get_stats(const struct memcache *c,
+			struct memcache_stats *st);
+void memcache_reset_stats(struct memcache *c);
+
+#endif
@@ -166,6 +166,41 @@ static int pif_writemem( device_t       dev_base,
   return writemem(dev_base, addr, mem, len, write_words, read_words);
 }
 
+/*----------------------------------------------------------------------------*/
+/* Compare memory using the target's PSA checksum. This only works for
+ * word-aligned blocks below 64k, and resets the CPU.
+ */
+static int pif_verifymem( device_t       dev_base,
+			  address_t      addr,
+			  const uint8_t* mem,
+			  address_t      len )
+{
+  struct pif_device *dev = (struct pif_device *)dev_base;
+  const struct chipinfo_memory *m;
+  uint16_t *word;
+  unsigned int i;
+  int r;
+
+  if ((addr & 1) || (len & 1) || addr + len > 0x10000 ||
+      check_range(dev_base->chip, addr, len, &m) != len || !m)
+    return device_verify_readback(dev_base, addr, mem, len);
+
+  word = malloc( len / 2 * sizeof(*word) );
+  if (!word) {
+	pr_error("pif: failed to allocate memory");
+	return -1;
+  }
+
+  for (i = 0; i < len / 2; i++)
+    word[i] = r16le(mem + i * 2);
+
+  dev->jtag.failed = 0;
+  r = jtag_verify_mem( &dev->jtag, addr, len / 2, word );
+  free(word);
+
+  return dev->jtag.failed ? -1 : r;
+}
+
 /*----------------------------------------------------------------------------*/
 static int pif_getregs(device_t dev_base, address_t *regs)
 {
@@ -434,6 +469,7 @@ const struct device_class device_pif = {
   .destroy  = pif_destroy,
   .readmem  = pif_readmem,
   .writemem = pif_writemem,
+  .verifymem = pif_verifymem,
   .getregs  = pif_getregs,
   .setregs  = pif_setregs,
   .ctl      = pif_ctl,
@@ -449,6 +485,7 @@ const struct device_class device_gpio = {
   .destroy  = pif_destroy,
   .readmem  = pif_readmem,
   .writemem = pif_writemem,
+  .verifymem = pif_verifymem,
   .getregs  = pif_getregs,
   .setregs  = pif_setregs,
   .ctl      = pif_ctl,
@@ -464,6 +501,7 @@ const struct device_class device_bp = {
   .destroy  = pif_destroy,
   .readmem  = pif_readmem,
   .writemem = pif_writemem,
+  .verifymem = pif_verifymem,
   .getregs  = pif_getregs,
   .setregs  = pif_setregs,
   .ctl      = pif_ctl,
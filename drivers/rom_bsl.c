@@ -43,6 +43,11 @@ struct rom_bsl_device {
 #define DATA_ACK	0x90
 #define DATA_NAK	0xA0
 
+/* Data bytes per read or write frame. Frames may hold up to 250 bytes
+ * of data, but an odd start address costs an extra byte.
+ */
+#define MAX_DATA	240
+
 static int rom_bsl_ack(struct rom_bsl_device *dev)
 {
 	uint8_t reply;
@@ -303,7 +308,7 @@ static int rom_bsl_writemem(device_t dev_base,
 	}
 
 	while (len) {
-		int wlen = len > 100 ? 100 : len;
+		int wlen = len > MAX_DATA ? MAX_DATA : len;
 		int r;
 		uint8_t memtmp[256];
 		const uint8_t *memptr;
@@ -360,8 +365,8 @@ static int rom_bsl_readmem(device_t dev_base,
 		    align = 1;
 		}
 
-		if (count > 220)
-			count = 220;
+		if (count > MAX_DATA)
+			count = MAX_DATA;
 
 		if (rom_bsl_xfer(dev, CMD_TX_DATA, addr, NULL, count) < 0) {
 			printc_err("rom_bsl: failed to read memory\n");
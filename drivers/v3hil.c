@@ -329,6 +329,7 @@ int v3hil_sync(struct v3hil *h)
 	uint8_t data[32], datalen = 21;
 
 	h->cal.is_cal = 0;
+	h->funclet = NULL;
 
 	memset(data, 0, sizeof(data));
 	data[0] = (h->jtag_id == 0x89) ? 0x20 : 0x5c; /* WDTCTL */
@@ -420,15 +421,19 @@ int v3hil_read(struct v3hil *h, address_t addr,
 		}
 	}
 
+	if (size > V3HIL_MAX_READ)
+		size = V3HIL_MAX_READ;
+
 	w32le(req, addr);
 	w32le(req + 4, (m->bits == 8) ? size : (size >> 1));
 	w32le(req + 8, h->regs[MSP430_REG_PC]);
 
+	/* The reply is received directly into the caller's buffer */
 	dbg_printc("do read\n");
-	if (hal_proto_execute(&h->hal,
+	if (hal_proto_execute_into(&h->hal,
 		map_fid(h, (m->bits == 8) ? HAL_PROTO_FID_READ_MEM_BYTES :
 					    HAL_PROTO_FID_READ_MEM_WORDS),
-		req, 8) < 0)
+		req, 8, mem, size) < 0)
 		goto fail;
 
 	if (h->hal.length < size) {
@@ -436,7 +441,6 @@ int v3hil_read(struct v3hil *h, address_t addr,
 		goto fail;
 	}
 
-	memcpy(mem, h->hal.payload, size);
 	return size;
 fail:
 	printc_err("v3hil: failed reading %d bytes from 0x%05x\n",
@@ -444,6 +448,66 @@ fail:
 	return -1;
 }
 
+/* Calculate, on the host, the PSA checksum that the target should
+ * produce for the given block of words.
+ */
+static uint16_t calc_psa(address_t addr, const uint8_t *mem, address_t size)
+{
+	uint16_t crc = addr - 2;
+	address_t i;
+
+	for (i = 0; i + 1 < size; i += 2) {
+		if (crc & 0x8000)
+			crc = ((crc ^ 0x0805) << 1) | 1;
+		else
+			crc <<= 1;
+
+		crc ^= r16le(mem + i);
+	}
+
+	return crc;
+}
+
+int v3hil_verify(struct v3hil *h, address_t addr,
+		 const uint8_t *mem, address_t size, int *match)
+{
+	const struct chipinfo_memory *m = NULL;
+	uint8_t req[9];
+	address_t i;
+
+	size = check_range(h->chip, addr, size, &m);
+	if (!m) {
+		for (i = 0; i < size; i++)
+			if (mem[i] != 0x55)
+				*match = 0;
+
+		return size;
+	}
+
+	w32le(req, addr);
+	w32le(req + 4, size >> 1);
+	req[8] = (h->chip->psa == CHIPINFO_PSA_ENHANCED) ? 1 : 0;
+
+	dbg_printc("do psa\n");
+	if (hal_proto_execute(&h->hal,
+		map_fid(h, HAL_PROTO_FID_PSA), req, sizeof(req)) < 0)
+		goto fail;
+
+	if (h->hal.length < 2) {
+		printc_err("v3hil: short reply: %d\n", h->hal.length);
+		goto fail;
+	}
+
+	if (r16le(h->hal.payload) != calc_psa(addr, mem, size))
+		*match = 0;
+
+	return size;
+fail:
+	printc_err("v3hil: failed to checksum %d bytes at 0x%05x\n",
+		   size, addr);
+	return -1;
+}
+
 const struct chipinfo_memory *find_ram(const struct chipinfo *c)
 {
 	const struct chipinfo_memory *m;
@@ -575,6 +639,9 @@ static int calibrate(struct v3hil *h)
 	if (h->cal.is_cal)
 		return 0;
 
+	/* Calibration runs code from the start of RAM */
+	h->funclet = NULL;
+
 	switch (h->chip->clock_sys) {
 	case CHIPINFO_CLOCK_SYS_BC_1XX:
 		r = calibrate_dco(h, 0x7);
@@ -602,6 +669,7 @@ static int calibrate(struct v3hil *h)
 	return 0;
 }
 
+/* Load a funclet into the start of RAM, unless it's already there */
 static int upload_funclet(struct v3hil *h,
 			  const struct chipinfo_memory *ram,
 			  const struct chipinfo_funclet *f)
@@ -610,11 +678,16 @@ static int upload_funclet(struct v3hil *h,
 	const uint16_t *code = f->code;
 	uint16_t num_words = f->code_size;
 
+	if (h->funclet == f)
+		return 0;
+
 	if (num_words * 2 > ram->size) {
 		printc_err("v3hil: funclet too big for RAM\n");
 		return -1;
 	}
 
+	h->funclet = NULL;
+
 	while (num_words) {
 		uint8_t data[512];
 		uint16_t n = num_words > 112 ? 112 : num_words;
@@ -640,6 +713,7 @@ static int upload_funclet(struct v3hil *h,
 		num_words -= n;
 	}
 
+	h->funclet = f;
 	return 0;
 }
 
@@ -648,7 +722,7 @@ static int write_flash(struct v3hil *h, address_t addr,
 {
 	const struct chipinfo_memory *ram = find_ram(h->chip);
 	const struct chipinfo_funclet *f = h->chip->v3_write;
-	uint8_t data[256];
+	uint8_t data[V3HIL_MAX_FLASH_WRITE + 22];
 	uint16_t avail;
 
 	if (!ram)
@@ -666,8 +740,8 @@ static int write_flash(struct v3hil *h, address_t addr,
 	if (upload_funclet(h, ram, f) < 0)
 		return -1;
 
-	if (size > 128)
-		size = 128;
+	if (size > V3HIL_MAX_FLASH_WRITE)
+		size = V3HIL_MAX_FLASH_WRITE;
 
 	avail = ram->size - f->code_size * 2;
 	if (avail > f->max_payload)
@@ -711,6 +785,15 @@ static int write_ram(struct v3hil *h, const struct chipinfo_memory *m,
 		}
 	}
 
+	/* Invalidate the resident funclet if this overwrites it */
+	if (h->funclet) {
+		const struct chipinfo_memory *ram = find_ram(h->chip);
+
+		if (ram && addr < ram->offset + h->funclet->code_size * 2 &&
+		    addr + size > ram->offset)
+			h->funclet = NULL;
+	}
+
 	w32le(data, addr);
 	w32le(data + 4, (m->bits == 8 || fram) ? size : (size >> 1));
 
@@ -740,14 +823,14 @@ int v3hil_write(struct v3hil *h, address_t addr,
 			return size;
 	}
 
-	if (size > 128)
-		size = 128;
-
 	if (m->type == CHIPINFO_MEMTYPE_FLASH) {
 		dbg_printc("write: call write flash\n");
 		return write_flash(h, addr, mem, size);
 	}
 
+	if (size > 128)
+		size = 128;
+
 	dbg_printc("write: call write ram\n");
 	return write_ram(h, m, addr, mem, size);
 }
@@ -944,6 +1027,7 @@ int v3hil_context_save(struct v3hil *h)
 	uint8_t data[32];
 
 	h->cal.is_cal = 0;
+	h->funclet = NULL;
 
 	memset(data, 0, sizeof(data));
 	data[0] = (h->jtag_id == 0x89) ? 0x20 : 0x5c; /* WDTCTL */
@@ -972,6 +1056,7 @@ int v3hil_single_step(struct v3hil *h)
 	uint8_t data[32];
 
 	h->cal.is_cal = 0;
+	h->funclet = NULL;
 
 	memset(data, 0, sizeof(data));
 	data[0] = (h->jtag_id == 0x89) ? 0x20 : 0x5c; /* WDTCTL */
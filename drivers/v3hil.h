@@ -53,6 +53,11 @@ struct v3hil {
 	address_t		regs[DEVICE_NUM_REGS];
 
 	struct v3hil_calibrate	cal;
+
+	/* Funclet currently loaded into target RAM, if any. This is
+	 * cleared whenever the RAM contents may have been disturbed.
+	 */
+	const struct chipinfo_funclet *funclet;
 };
 
 /* Initialize data, associate transport */
@@ -87,6 +92,16 @@ int v3hil_identify(struct v3hil *h);
 /* Configure for the current chip */
 int v3hil_configure(struct v3hil *h);
 
+/* Largest block of flash written by a single funclet invocation. The
+ * data is streamed to the FET in several packets.
+ */
+#define V3HIL_MAX_FLASH_WRITE	1024
+
+/* Largest block of memory requested by a single read. The reply is
+ * returned by the FET in several packets.
+ */
+#define V3HIL_MAX_READ		1024
+
 /* Read/write memory. LSB of address and size are ignored. Number of
  * bytes read is returned, which may be less than requested if a memory
  * map boundary is crossed.
@@ -96,6 +111,15 @@ int v3hil_read(struct v3hil *h, address_t addr,
 int v3hil_write(struct v3hil *h, address_t addr,
 		const uint8_t *mem, address_t size);
 
+/* Compare memory against the given data using the target's PSA
+ * checksum. LSB of address and size are ignored. *match is cleared if
+ * the contents differ. Number of bytes compared is returned, which may
+ * be less than requested if a memory map boundary is crossed. The chip
+ * must be known.
+ */
+int v3hil_verify(struct v3hil *h, address_t addr,
+		 const uint8_t *mem, address_t size, int *match);
+
 /* Erase flash. If address is specified, a segment erase is performed.
  * Otherwise, ADDRESS_NONE indicates that a main memory erase should be
  * performed.
@@ -16,6 +16,8 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <string.h>
+
 #include "util.h"
 #include "binfile.h"
 #include "ihex.h"
@@ -25,22 +27,25 @@
 #include "srec.h"
 #include "coff.h"
 #include "output.h"
+#include "stab.h"
 
 struct file_format {
 	int (*check)(FILE *in);
 	int (*extract)(FILE *in, binfile_imgcb_t cb, void *user_data);
+	int (*extract_map)(FILE *in, const struct mapfile *map,
+			   binfile_imgcb_t cb, void *user_data);
 	int (*syms)(FILE *in);
 };
 
 static const struct file_format formats[] = {
 	{
 		.check = elf32_check,
-		.extract = elf32_extract,
+		.extract_map = elf32_extract_map,
 		.syms = elf32_syms
 	},
 	{
 		.check = ihex_check,
-		.extract = ihex_extract
+		.extract_map = ihex_extract_map
 	},
 	{
 		.check = symmap_check,
@@ -48,15 +53,15 @@ static const struct file_format formats[] = {
 	},
 	{
 		.check = titext_check,
-		.extract = titext_extract
+		.extract_map = titext_extract_map
 	},
 	{
 		.check = srec_check,
-		.extract = srec_extract
+		.extract_map = srec_extract_map
 	},
 	{
 		.check = coff_check,
-		.extract = coff_extract,
+		.extract_map = coff_extract_map,
 		.syms = coff_syms
 	}
 };
@@ -81,7 +86,7 @@ int binfile_info(FILE *in)
 	int flags = 0;
 
 	if (fmt) {
-		if (fmt->extract)
+		if (fmt->extract || fmt->extract_map)
 			flags |= BINFILE_HAS_TEXT;
 		if (fmt->syms)
 			flags |= BINFILE_HAS_SYMS;
@@ -90,21 +95,56 @@ int binfile_info(FILE *in)
 	return flags;
 }
 
-int binfile_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+static const struct file_format *identify_text(FILE *in)
 {
 	const struct file_format *fmt = identify(in);
 
 	if (!fmt) {
 		printc_err("binfile: unknown file format\n");
-		return -1;
+		return NULL;
 	}
 
-	if (!fmt->extract) {
+	if (!(fmt->extract || fmt->extract_map)) {
 		printc_err("binfile: this format contains no code\n");
-		return -1;
+		return NULL;
 	}
 
-	return fmt->extract(in, cb, user_data);
+	return fmt;
+}
+
+int binfile_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+{
+	const struct file_format *fmt = identify_text(in);
+	struct mapfile *map;
+	int ret;
+
+	if (!fmt)
+		return -1;
+
+	if (fmt->extract)
+		return fmt->extract(in, cb, user_data);
+
+	map = mapfile_new(in);
+	if (!map)
+		return -1;
+
+	ret = fmt->extract_map(in, map, cb, user_data);
+	mapfile_free(map);
+	return ret;
+}
+
+int binfile_extract_map(FILE *in, const struct mapfile *map,
+			binfile_imgcb_t cb, void *user_data)
+{
+	const struct file_format *fmt = identify_text(in);
+
+	if (!fmt)
+		return -1;
+
+	if (fmt->extract)
+		return fmt->extract(in, cb, user_data);
+
+	return fmt->extract_map(in, map, cb, user_data);
 }
 
 int binfile_syms(FILE *in)
@@ -121,5 +161,59 @@ int binfile_syms(FILE *in)
 		return -1;
 	}
 
-	return fmt->syms(in);
+	if (fmt->syms(in) < 0)
+		return -1;
+
+	/* Symbols are looked up far more often than they're changed */
+	return stab_freeze();
+}
+
+void binfile_coalesce_init(struct binfile_coalesce *c,
+			   binfile_imgcb_t cb, void *user_data)
+{
+	c->cb = cb;
+	c->user_data = user_data;
+	c->addr = 0;
+	c->len = 0;
+}
+
+int binfile_coalesce_flush(struct binfile_coalesce *c)
+{
+	struct binfile_chunk ch = {0};
+
+	if (!c->len)
+		return 0;
+
+	ch.addr = c->addr;
+	ch.data = c->buf;
+	ch.len = c->len;
+	c->len = 0;
+
+	return c->cb(c->user_data, &ch);
+}
+
+int binfile_coalesce_feed(struct binfile_coalesce *c, address_t addr,
+			  const uint8_t *data, int len)
+{
+	if (c->len && (addr != c->addr + c->len ||
+		       c->len + len > sizeof(c->buf)) &&
+	    binfile_coalesce_flush(c) < 0)
+		return -1;
+
+	/* Records too large to buffer are passed straight through */
+	if (len > sizeof(c->buf)) {
+		struct binfile_chunk ch = {0};
+
+		ch.addr = addr;
+		ch.data = data;
+		ch.len = len;
+		return c->cb(c->user_data, &ch);
+	}
+
+	if (!c->len)
+		c->addr = addr;
+
+	memcpy(c->buf + c->len, data, len);
+	c->len += len;
+	return 0;
 }
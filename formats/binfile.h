@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "stab.h"
+#include "mapfile.h"
 
 struct binfile_chunk {
 	const char		*name;
@@ -51,6 +52,45 @@ int binfile_info(FILE *in);
  */
 int binfile_extract(FILE *in, binfile_imgcb_t cb, void *user_data);
 
+/* As for binfile_extract(), but with the file already mapped. For
+ * formats which store the image as raw bytes (ELF and COFF), chunks
+ * point directly into the mapping, and remain valid for as long as it
+ * does. Chunks from text formats are only valid during the callback.
+ */
+int binfile_extract_map(FILE *in, const struct mapfile *map,
+			binfile_imgcb_t cb, void *user_data);
+
+/* Text formats describe the image in many small records. This helper
+ * gathers records which follow on from one another into larger chunks
+ * before passing them to the callback. Chunks given to the callback
+ * are only valid for the duration of the call.
+ */
+#define BINFILE_COALESCE_SIZE	16384
+
+struct binfile_coalesce {
+	binfile_imgcb_t		cb;
+	void			*user_data;
+
+	address_t		addr;
+	int			len;
+	uint8_t			buf[BINFILE_COALESCE_SIZE];
+};
+
+void binfile_coalesce_init(struct binfile_coalesce *c,
+			   binfile_imgcb_t cb, void *user_data);
+
+/* Add data at the given address. If it doesn't continue on from the
+ * pending chunk, or there isn't room for it, the pending chunk is
+ * flushed first. Returns 0 on success or -1 if the callback fails.
+ */
+int binfile_coalesce_feed(struct binfile_coalesce *c, address_t addr,
+			  const uint8_t *data, int len);
+
+/* Pass on whatever is pending. This must be called at the end of the
+ * file.
+ */
+int binfile_coalesce_flush(struct binfile_coalesce *c);
+
 /* Attempt to load symbols from the file and store them in the given
  * symbol table. Returns 0 on success or -1 if an error occurs.
  */
@@ -194,44 +194,31 @@ static int read_sechdrs(FILE *in, const struct coff_header *hdr,
 	return hdr->sec_count;
 }
 
-static int load_section(FILE *in, uint32_t addr, uint32_t offset,
-			uint32_t size,
+/* Sections are passed as single chunks pointing into the map */
+static int load_section(const struct mapfile *map, uint32_t addr,
+			uint32_t offset, uint32_t size,
 			binfile_imgcb_t cb, void *user_data)
 {
 	struct binfile_chunk ch = {0};
-	uint8_t *section;
 
 	if (!size)
 		return 0;
 
-	section = malloc(size);
-	if (!section) {
-		printc_err("coff: couldn't allocate memory for "
-			"section at 0x%x: %s\n", offset, last_error());
-		return -1;
-	}
-
-	if (read_block(in, offset, size, section) < 0) {
-		printc_err("coff: couldn't read section at 0x%x\n",
-			offset);
-		free(section);
+	if (offset > map->size || size > map->size - offset) {
+		printc_err("coff: section at 0x%x extends beyond end of "
+			   "file\n", offset);
 		return -1;
 	}
 
 	ch.addr = addr;
 	ch.len = size;
-	ch.data = section;
+	ch.data = map->data + offset;
 
-	if (cb(user_data, &ch) < 0) {
-		free(section);
-		return -1;
-	}
-
-	free(section);
-	return 0;
+	return cb(user_data, &ch);
 }
 
-int coff_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+int coff_extract_map(FILE *in, const struct mapfile *map,
+		     binfile_imgcb_t cb, void *user_data)
 {
 	struct coff_header hdr;
 	uint8_t *shdrs;
@@ -254,7 +241,7 @@ int coff_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
 			uint32_t offset = LE_LONG(header, 20);
 			uint32_t size = LE_LONG(header, 16);
 
-			if (load_section(in, addr, offset, size,
+			if (load_section(map, addr, offset, size,
 					 cb, user_data) < 0) {
 				printc_err("coff: error while loading "
 					"section %d\n", i);
@@ -22,7 +22,8 @@
 #include "binfile.h"
 
 int coff_check(FILE *in);
-int coff_extract(FILE *in, binfile_imgcb_t cb, void *user_data);
+int coff_extract_map(FILE *in, const struct mapfile *map,
+		     binfile_imgcb_t cb, void *user_data);
 int coff_syms(FILE *in);
 
 #endif
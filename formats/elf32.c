@@ -23,6 +23,7 @@
 #include "elf_format.h"
 #include "output.h"
 #include "util.h"
+#include "mapfile.h"
 
 #ifndef EM_MSP430
 #define EM_MSP430	0x69
@@ -40,8 +41,8 @@ struct elf32_info {
 	Elf32_Phdr              file_phdrs[MAX_PHDRS];
 	Elf32_Shdr              file_shdrs[MAX_SHDRS];
 
-	char                    *string_tab;
-	int                     string_len;
+	const char              *string_tab;
+	uint32_t                string_len;
 };
 
 static int parse_ehdr(Elf32_Ehdr *e, FILE *in)
@@ -109,23 +110,6 @@ static int parse_shdr(Elf32_Shdr *s, FILE *in)
 	return 0;
 }
 
-static int parse_sym(Elf32_Sym *s, FILE *in)
-{
-	uint8_t data[16];
-
-	if (fread(data, sizeof(data), 1, in) != 1)
-		return -1;
-
-	s->st_name = LE_LONG(data, 0);
-	s->st_value = LE_LONG(data, 4);
-	s->st_size = LE_LONG(data, 8);
-	s->st_info = data[12];
-	s->st_other = data[13];
-	s->st_shndx = LE_WORD(data, 14);
-
-	return 0;
-}
-
 static int read_ehdr(struct elf32_info *info, FILE *in)
 {
 	/* Read and check the ELF header */
@@ -213,48 +197,35 @@ static uint32_t file_to_phys(struct elf32_info *info, uint32_t v)
 	return v;
 }
 
+static int in_file(const struct mapfile *map, const Elf32_Shdr *s)
+{
+	return s->sh_offset <= map->size &&
+		s->sh_size <= map->size - s->sh_offset;
+}
+
+/* Each section is passed as a single chunk pointing into the map */
 static int feed_section(struct elf32_info *info,
-			FILE *in, const Elf32_Shdr *sh,
+			const struct mapfile *map, const Elf32_Shdr *sh,
 			binfile_imgcb_t cb, void *user_data)
 {
-	uint32_t offset = sh->sh_offset;
-	uint32_t size = sh->sh_size;
-	uint8_t buf[1024];
-	uint32_t addr = file_to_phys(info, offset);
-	const char *name = NULL;
-
-	if (fseek(in, offset, SEEK_SET) < 0) {
-		pr_error("elf32: can't seek to section");
+	struct binfile_chunk ch = {0};
+
+	if (!in_file(map, sh)) {
+		printc_err("elf32: section at 0x%x extends beyond end of "
+			   "file\n", sh->sh_offset);
 		return -1;
 	}
 
-	if (info->string_tab &&
-	    sh->sh_name < info->string_len)
-		name = info->string_tab + sh->sh_name;
+	if (info->string_tab && sh->sh_name < info->string_len)
+		ch.name = info->string_tab + sh->sh_name;
 
-	while (size) {
-		int ask = size > sizeof(buf) ? sizeof(buf) : size;
-		int len = fread(buf, 1, ask, in);
-		struct binfile_chunk ch = {0};
+	ch.addr = file_to_phys(info, sh->sh_offset);
+	ch.data = map->data + sh->sh_offset;
+	ch.len = sh->sh_size;
 
-		if (len < 0) {
-			pr_error("elf32: can't read section");
-			return -1;
-		}
-
-		ch.name = name;
-		ch.addr = addr;
-		ch.data = buf;
-		ch.len = len;
-
-		if (cb(user_data, &ch) < 0) {
-			pr_error("elf32: misc error");
-			return -1;
-		}
-
-		size -= len;
-		offset += len;
-		addr += len;
+	if (cb(user_data, &ch) < 0) {
+		pr_error("elf32: misc error");
+		return -1;
 	}
 
 	return 0;
@@ -279,50 +250,35 @@ static int read_all(struct elf32_info *info, FILE *in)
 	return 0;
 }
 
-static int load_strings(struct elf32_info *info, FILE *in, Elf32_Shdr *s)
+static int load_strings(struct elf32_info *info, const struct mapfile *map,
+			const Elf32_Shdr *s)
 {
-	int len = s->sh_size;
+	const char *tab = (const char *)map->data + s->sh_offset;
 
-	if (!len)
+	if (!s->sh_size)
 		return 0;
 
-	if (fseek(in, s->sh_offset, SEEK_SET) < 0) {
-		pr_error("elf32: can't seek to strings");
+	if (!in_file(map, s) || tab[s->sh_size - 1]) {
+		printc_err("elf32: bad string table\n");
 		return -1;
 	}
 
-	info->string_len = len;
-	info->string_tab = malloc(len + 1);
-
-	if (!info->string_tab) {
-		pr_error("elf32: can't allocate string table memory");
-		return -1;
-	}
-
-	if (!fread(info->string_tab, info->string_len, 1, in)) {
-		if (ferror(in)) {
-			pr_error("elf32: error reading strings");
-			return -1;
-		}
-
-		printc_err("elf32: eof reading strings\n");
-		return -1;
-	}
-
-	info->string_tab[info->string_len] = 0;
+	info->string_tab = tab;
+	info->string_len = s->sh_size;
 	return 0;
 }
 
-int elf32_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+int elf32_extract_map(FILE *in, const struct mapfile *map,
+		      binfile_imgcb_t cb, void *user_data)
 {
 	struct elf32_info info;
 	int i;
-	int ret = 0;
 
 	if (read_all(&info, in) < 0)
 		return -1;
 
-	if (load_strings(&info, in,
+	if (info.file_ehdr.e_shstrndx >= info.file_ehdr.e_shnum ||
+	    load_strings(&info, map,
 			 &info.file_shdrs[info.file_ehdr.e_shstrndx]) < 0) {
 		printc_err("elf32: warning: can't load section string "
 			   "table\n");
@@ -334,16 +290,11 @@ int elf32_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
 
 		if ((s->sh_type == SHT_PROGBITS || s->sh_type == SHT_INIT_ARRAY) &&
 		    (s->sh_flags & SHF_ALLOC) && s->sh_size > 0 &&
-		    feed_section(&info, in, s, cb, user_data) < 0) {
-			ret = -1;
-			break;
-		}
+		    feed_section(&info, map, s, cb, user_data) < 0)
+			return -1;
 	}
 
-	if (info.string_tab)
-		free(info.string_tab);
-
-	return ret;
+	return 0;
 }
 
 int elf32_check(FILE *in)
@@ -372,58 +323,67 @@ static Elf32_Shdr *find_shdr(struct elf32_info *info, Elf32_Word type)
 	return NULL;
 }
 
-#define N_SYMS	128
-
 #ifndef STT_COMMON
 #define STT_COMMON 5
 #endif
 
-static int syms_load_syms(struct elf32_info *info, FILE *in,
-			  Elf32_Shdr *s)
+/* Symbols are read in place from the mapped file, and handed to the
+ * symbol table as a single array referring to the mapped string table.
+ * The symbol table copies the names it keeps, so the map may be
+ * released as soon as this returns.
+ */
+static int syms_load_syms(const struct mapfile *map, const Elf32_Shdr *s,
+			  const Elf32_Shdr *strs)
 {
+	const char *string_tab = (const char *)map->data + strs->sh_offset;
+	const uint8_t *data = map->data + s->sh_offset;
 	int len = s->sh_size / 16;
+	struct stab_entry *ents;
+	int count = 0;
 	int i;
 
-	if (fseek(in, s->sh_offset, SEEK_SET) < 0) {
-		pr_error("elf32: can't seek to symbols");
+	if (!strs->sh_size || string_tab[strs->sh_size - 1]) {
+		printc_err("elf32: string table is not terminated\n");
 		return -1;
 	}
 
-	for (i = 0; i < len; i++) {
-		Elf32_Sym y;
-		int st;
-		const char *name;
-
-		if (parse_sym(&y, in) < 0) {
-			pr_error("elf32: error reading symbols");
-			return -1;
-		}
+	ents = malloc(sizeof(ents[0]) * (len + 1));
+	if (!ents) {
+		pr_error("elf32: can't allocate symbol table memory");
+		return -1;
+	}
 
-		st = ELF32_ST_TYPE(y.st_info);
-		name = info->string_tab + y.st_name;
+	for (i = 0; i < len; i++) {
+		const uint8_t *y = data + i * 16;
+		uint32_t st_name = LE_LONG(y, 0);
+		int st = ELF32_ST_TYPE(y[12]);
 
-		if (y.st_name > info->string_len) {
+		if (st_name >= strs->sh_size) {
 			printc_err("elf32: symbol out of bounds\n");
+			free(ents);
 			return -1;
 		}
 
-		if (name[0] &&
+		if (string_tab[st_name] &&
 		    (st == STT_OBJECT || st == STT_FUNC ||
 		     st == STT_SECTION || st == STT_COMMON ||
-		     st == STT_TLS) &&
-		    stab_set(info->string_tab + y.st_name,
-			     y.st_value) < 0)
-			return -1;
+		     st == STT_TLS)) {
+			ents[count].addr = LE_LONG(y, 4);
+			ents[count].name = st_name;
+			count++;
+		}
 	}
 
-	return 0;
+	return stab_load(ents, count, string_tab);
 }
 
 int elf32_syms(FILE *in)
 {
 	struct elf32_info info;
+	struct mapfile *map;
 	Elf32_Shdr *s;
-	int ret = 0;
+	Elf32_Shdr *strs;
+	int ret;
 
 	if (read_all(&info, in) < 0)
 		return -1;
@@ -439,12 +399,19 @@ int elf32_syms(FILE *in)
 		return -1;
 	}
 
-	if (load_strings(&info, in, &info.file_shdrs[s->sh_link]) < 0 ||
-	    syms_load_syms(&info, in, s) < 0)
-		ret = -1;
+	strs = &info.file_shdrs[s->sh_link];
+
+	map = mapfile_new(in);
+	if (!map)
+		return -1;
 
-	if (info.string_tab)
-		free(info.string_tab);
+	if (!in_file(map, s) || !in_file(map, strs)) {
+		printc_err("elf32: symbol table is truncated\n");
+		ret = -1;
+	} else {
+		ret = syms_load_syms(map, s, strs);
+	}
 
+	mapfile_free(map);
 	return ret;
 }
@@ -22,7 +22,8 @@
 #include "binfile.h"
 
 int elf32_check(FILE *in);
-int elf32_extract(FILE *in, binfile_imgcb_t cb, void *user_data);
+int elf32_extract_map(FILE *in, const struct mapfile *map,
+		      binfile_imgcb_t cb, void *user_data);
 int elf32_syms(FILE *in);
 
 #endif
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <ctype.h>
 #include "ihex.h"
+#include "hexdec.h"
 #include "output.h"
 
 int ihex_check(FILE *in)
@@ -28,28 +29,29 @@ int ihex_check(FILE *in)
 	return fgetc(in) == ':';
 }
 
-static int feed_line(uint8_t *data, int nbytes, binfile_imgcb_t cb,
-		     void *user_data, address_t *segment_offset)
+static int feed_line(const uint8_t *data, int nbytes,
+		     struct binfile_coalesce *out, address_t *segment_offset)
 {
 	uint8_t cksum = 0;
 	address_t address;
 	uint8_t type;
-	uint8_t *payload;
+	const uint8_t *payload;
 	int data_len;
 	int i;
-	struct binfile_chunk ch = {0};
 
 	if (nbytes < 5)
 		return 0;
 
-	/* Verify checksum */
-	for (i = 0; i + 1 < nbytes; i++)
+	/* Verify checksum: all bytes, including the checksum itself,
+	 * sum to zero.
+	 */
+	for (i = 0; i < nbytes; i++)
 		cksum += data[i];
-	cksum = ~(cksum - 1) & 0xff;
 
-	if (data[nbytes - 1] != cksum) {
+	if (cksum) {
 		printc_err("ihex: invalid checksum: %02x "
-			"(calculated %02x)\n", data[nbytes - 1], cksum);
+			"(calculated %02x)\n", data[nbytes - 1],
+			(uint8_t)(data[nbytes - 1] - cksum));
 		return -1;
 	}
 
@@ -61,10 +63,8 @@ static int feed_line(uint8_t *data, int nbytes, binfile_imgcb_t cb,
 
 	switch (type) {
 	case 0:
-		ch.addr = address + *segment_offset;
-		ch.data = payload;
-		ch.len = data_len;
-		return cb(user_data, &ch);
+		return binfile_coalesce_feed(out, address + *segment_offset,
+					     payload, data_len);
 
 	case 1:
 	case 3:
@@ -100,46 +100,72 @@ static int feed_line(uint8_t *data, int nbytes, binfile_imgcb_t cb,
 	return 0;
 }
 
-int ihex_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+int ihex_extract_map(FILE *in, const struct mapfile *map,
+		     binfile_imgcb_t cb, void *user_data)
 {
-	char buf[128];
-	int lno = 0;
+	const char *text = (const char *)map->data;
+	const char *end = text + map->size;
+	struct binfile_coalesce *out;
 	address_t segment_offset = 0;
+	int lno = 0;
+	int ret = -1;
 
-	rewind(in);
-	while (fgets(buf, sizeof(buf), in)) {
-		int len = strlen(buf);
-		int i;
-		uint8_t data[64];
-		int nbytes;
+	(void)in;
 
+	out = malloc(sizeof(*out));
+	if (!out) {
+		printc_err("ihex: can't allocate memory\n");
+		return -1;
+	}
+
+	binfile_coalesce_init(out, cb, user_data);
+
+	while (text < end) {
+		const char *nl = memchr(text, '\n', end - text);
+		const char *eol = nl ? nl : end;
+		const char *line = text;
+		/* Record length is one byte, plus 5 bytes of overhead */
+		uint8_t data[260];
+		int len;
+
+		text = nl ? nl + 1 : end;
 		lno++;
-		if (buf[0] != ':') {
+
+		/* Trim trailing whitespace */
+		while (eol > line && isspace((uint8_t)eol[-1]))
+			eol--;
+
+		len = eol - line;
+		if (!len)
+			continue;
+
+		if (line[0] != ':') {
 			printc_err("ihex: line %d: invalid start "
 				"marker\n", lno);
 			continue;
 		}
 
-		/* Trim trailing whitespace */
-		while (len && isspace(buf[len - 1]))
-			len--;
-		buf[len] = 0;
-
-		/* Decode hex digits */
-		nbytes = (len - 1) / 2;
-		for (i = 0; i < nbytes; i++) {
-			char d[] = {buf[i * 2 + 1], buf[i * 2 + 2], 0};
+		len = (len - 1) / 2;
+		if (len > sizeof(data)) {
+			printc_err("ihex: line %d: record too long\n", lno);
+			goto out;
+		}
 
-			data[i] = strtoul(d, NULL, 16);
+		if (hexdec(data, line + 1, len) < 0) {
+			printc_err("ihex: line %d: invalid hex digit\n",
+				   lno);
+			goto out;
 		}
 
 		/* Handle the line */
-		if (feed_line(data, nbytes, cb, user_data,
-			      &segment_offset) < 0) {
+		if (feed_line(data, len, out, &segment_offset) < 0) {
 			printc_err("ihex: error on line %d\n", lno);
-			return -1;
+			goto out;
 		}
 	}
 
-	return 0;
+	ret = binfile_coalesce_flush(out);
+ out:
+	free(out);
+	return ret;
 }
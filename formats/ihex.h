@@ -22,6 +22,7 @@
 #include "binfile.h"
 
 int ihex_check(FILE *in);
-int ihex_extract(FILE *in, binfile_imgcb_t cb, void *user_data);
+int ihex_extract_map(FILE *in, const struct mapfile *map,
+		     binfile_imgcb_t cb, void *user_data);
 
 #endif
@@ -0,0 +1,541 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "stab.h"
+#include "vector.h"
+#include "output.h"
+#include "util.h"
+
+#define IMAGE_CACHE_SIZE	4
+
+/* The image must be the first member, so that a pointer to it may be
+ * converted back to the containing entry.
+ */
+struct image_entry {
+	struct image		img;
+
+	/* Identity of the source file: canonical path, and the file
+	 * and modification time it had when loaded.
+	 */
+	char			*path;
+	dev_t			dev;
+	ino_t			ino;
+	time_t			mtime;
+	long			mtime_ns;
+	off_t			size;
+
+	/* Symbols, saved the first time they're loaded */
+	int			have_syms;
+	struct stab_entry	*syms;
+	int			num_syms;
+	char			*sym_names;
+
+	/* Segment data, in a single owned buffer */
+	uint8_t			*data;
+
+	int			refs;
+	int			cached;
+	unsigned int		last_used;
+};
+
+static struct image_entry *cache[IMAGE_CACHE_SIZE];
+static unsigned int use_counter;
+
+static long mtime_nsec(const struct stat *st)
+{
+#if defined(__APPLE__)
+	return st->st_mtimespec.tv_nsec;
+#elif defined(__Windows__)
+	(void)st;
+	return 0;
+#else
+	return st->st_mtim.tv_nsec;
+#endif
+}
+
+static char *canonical_path(const char *path)
+{
+#ifdef __Windows__
+	char *p = _fullpath(NULL, path, 0);
+#else
+	char *p = realpath(path, NULL);
+#endif
+
+	return p ? p : strdup(path);
+}
+
+/* Is this the file from which the entry was loaded, unchanged? The
+ * modification time is compared to the nanosecond, because a rebuild
+ * within the same second often leaves the size unchanged.
+ */
+static int same_file(const struct image_entry *e, const struct stat *st)
+{
+	return e->dev == st->st_dev && e->ino == st->st_ino &&
+		e->mtime == st->st_mtime && e->mtime_ns == mtime_nsec(st) &&
+		e->size == st->st_size;
+}
+
+/************************************************************************
+ * Image construction
+ */
+
+struct raw_chunk {
+	char			section[64];
+	address_t		addr;
+	address_t		len;
+	int			seq;
+
+	/* Data either points into the mapped file, or is stored in the
+	 * collector's buffer at the given offset.
+	 */
+	const uint8_t		*mapped;
+	int			offset;
+};
+
+struct collector {
+	const struct mapfile	*map;
+	struct vector		chunks;
+	struct vector		data;
+};
+
+static int is_mapped(const struct mapfile *map, const uint8_t *data,
+		     address_t len)
+{
+	return map && data >= map->data && len <= map->size &&
+		data - map->data <= map->size - len;
+}
+
+static int collect_chunk(void *user_data, const struct binfile_chunk *ch)
+{
+	struct collector *c = (struct collector *)user_data;
+	struct raw_chunk r;
+
+	if (ch->len <= 0)
+		return 0;
+
+	strncpy(r.section, ch->name ? ch->name : "", sizeof(r.section));
+	r.section[sizeof(r.section) - 1] = 0;
+	r.addr = ch->addr;
+	r.len = ch->len;
+	r.seq = c->chunks.size;
+	r.mapped = NULL;
+	r.offset = c->data.size;
+
+	if (is_mapped(c->map, ch->data, ch->len)) {
+		r.mapped = ch->data;
+	} else if (vector_push(&c->data, ch->data, ch->len) < 0) {
+		printc_err("image: can't allocate memory\n");
+		return -1;
+	}
+
+	if (vector_push(&c->chunks, &r, 1) < 0) {
+		printc_err("image: can't allocate memory\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int chunk_cmp(const void *a, const void *b)
+{
+	const struct raw_chunk *x = (const struct raw_chunk *)a;
+	const struct raw_chunk *y = (const struct raw_chunk *)b;
+
+	if (x->addr < y->addr)
+		return -1;
+	if (x->addr > y->addr)
+		return 1;
+
+	return x->seq - y->seq;
+}
+
+static const uint8_t *chunk_data(const struct collector *c,
+				 const struct raw_chunk *r)
+{
+	if (r->mapped)
+		return r->mapped;
+
+	return VECTOR_PTR(c->data, r->offset, uint8_t);
+}
+
+/* A segment under construction: a run of chunks to be merged */
+struct seg_plan {
+	int			first;
+	int			count;
+	address_t		addr;
+	address_t		len;
+};
+
+/* Sort the collected chunks by address, and group contiguous chunks
+ * from the same section into segments.
+ */
+static int plan_segments(struct collector *c, struct vector *plan)
+{
+	int i;
+
+	qsort(c->chunks.ptr, c->chunks.size, sizeof(struct raw_chunk),
+	      chunk_cmp);
+
+	for (i = 0; i < c->chunks.size; i++) {
+		const struct raw_chunk *r =
+			VECTOR_PTR(c->chunks, i, struct raw_chunk);
+		struct seg_plan *last = NULL;
+
+		if (plan->size)
+			last = VECTOR_PTR(*plan, plan->size - 1,
+					  struct seg_plan);
+
+		if (last &&
+		    !strcmp(VECTOR_PTR(c->chunks, last->first,
+				       struct raw_chunk)->section,
+			    r->section) &&
+		    r->addr <= last->addr + last->len) {
+			address_t end = r->addr + r->len;
+
+			if (r->addr < last->addr + last->len)
+				printc_err("warning: image: overlapping data "
+					   "at 0x%04x\n", r->addr);
+
+			if (end > last->addr + last->len)
+				last->len = end - last->addr;
+
+			last->count++;
+		} else {
+			struct seg_plan p;
+
+			p.first = i;
+			p.count = 1;
+			p.addr = r->addr;
+			p.len = r->len;
+
+			if (vector_push(plan, &p, 1) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Build the segment list. Segment data is copied into a single buffer
+ * owned by the image, so that nothing refers to the mapped file once
+ * loading is finished. The file may be rewritten while the image is
+ * cached.
+ */
+static int build_image(struct image_entry *e, struct collector *c)
+{
+	struct vector plan;
+	struct vector segs;
+	size_t owned = 0;
+	int i;
+
+	vector_init(&plan, sizeof(struct seg_plan));
+	vector_init(&segs, sizeof(struct image_segment));
+
+	if (plan_segments(c, &plan) < 0)
+		goto fail_mem;
+
+	for (i = 0; i < plan.size; i++)
+		owned += VECTOR_PTR(plan, i, struct seg_plan)->len;
+
+	e->data = malloc(owned ? owned : 1);
+	if (!e->data)
+		goto fail_mem;
+
+	e->img.total = 0;
+	owned = 0;
+
+	for (i = 0; i < plan.size; i++) {
+		const struct seg_plan *p =
+			VECTOR_PTR(plan, i, struct seg_plan);
+		const struct raw_chunk *first =
+			VECTOR_PTR(c->chunks, p->first, struct raw_chunk);
+		struct image_segment s;
+		int j;
+
+		memcpy(s.section, first->section, sizeof(s.section));
+		s.addr = p->addr;
+		s.len = p->len;
+
+		/* Later chunks override earlier ones */
+		for (j = 0; j < p->count; j++) {
+			const struct raw_chunk *r =
+				VECTOR_PTR(c->chunks, p->first + j,
+					   struct raw_chunk);
+
+			memcpy(e->data + owned + (r->addr - p->addr),
+			       chunk_data(c, r), r->len);
+		}
+
+		s.data = e->data + owned;
+		owned += p->len;
+
+		e->img.total += s.len;
+		if (vector_push(&segs, &s, 1) < 0)
+			goto fail_mem;
+	}
+
+	vector_destroy(&plan);
+	e->img.segs = (struct image_segment *)segs.ptr;
+	e->img.num_segs = segs.size;
+	return 0;
+
+fail_mem:
+	printc_err("image: can't allocate memory\n");
+	vector_destroy(&plan);
+	vector_destroy(&segs);
+	free(e->data);
+	e->data = NULL;
+	return -1;
+}
+
+static void entry_free(struct image_entry *e)
+{
+	free(e->img.segs);
+	free(e->data);
+	free(e->path);
+	free(e->syms);
+	free(e->sym_names);
+	free(e);
+}
+
+static struct image_entry *entry_load(const char *path,
+				      const struct stat *st)
+{
+	struct image_entry *e;
+	struct collector c;
+	struct mapfile *map;
+	FILE *in;
+
+	in = fopen(path, "rb");
+	if (!in) {
+		printc_err("%s: %s\n", path, last_error());
+		return NULL;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e) {
+		printc_err("image: can't allocate memory\n");
+		fclose(in);
+		return NULL;
+	}
+
+	map = mapfile_new(in);
+	if (!map)
+		goto fail_file;
+
+	c.map = map;
+	vector_init(&c.chunks, sizeof(struct raw_chunk));
+	vector_init(&c.data, 1);
+
+	if (binfile_extract_map(in, map, collect_chunk, &c) < 0 ||
+	    build_image(e, &c) < 0)
+		goto fail;
+
+	mapfile_free(map);
+	map = NULL;
+
+	e->img.info = binfile_info(in);
+	e->path = strdup(path);
+	if (!e->path) {
+		printc_err("image: can't allocate memory\n");
+		goto fail;
+	}
+
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->mtime = st->st_mtime;
+	e->mtime_ns = mtime_nsec(st);
+	e->size = st->st_size;
+
+	vector_destroy(&c.chunks);
+	vector_destroy(&c.data);
+	fclose(in);
+	return e;
+
+fail:
+	vector_destroy(&c.chunks);
+	vector_destroy(&c.data);
+	mapfile_free(map);
+fail_file:
+	fclose(in);
+	entry_free(e);
+	return NULL;
+}
+
+/************************************************************************
+ * Cache
+ */
+
+static void cache_insert(struct image_entry *e)
+{
+	int victim = -1;
+	int i;
+
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		const struct image_entry *c = cache[i];
+
+		if (!c) {
+			victim = i;
+			break;
+		}
+
+		if (!c->refs &&
+		    (victim < 0 || c->last_used < cache[victim]->last_used))
+			victim = i;
+	}
+
+	/* Every slot is in use. The image is freed when released. */
+	if (victim < 0)
+		return;
+
+	if (cache[victim])
+		entry_free(cache[victim]);
+
+	cache[victim] = e;
+	e->cached = 1;
+}
+
+const struct image *image_load(const char *path)
+{
+	struct image_entry *e = NULL;
+	struct stat st;
+	char *canon;
+	int i;
+
+	if (stat(path, &st) < 0) {
+		printc_err("%s: %s\n", path, last_error());
+		return NULL;
+	}
+
+	canon = canonical_path(path);
+	if (!canon) {
+		printc_err("image: can't allocate memory\n");
+		return NULL;
+	}
+
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		struct image_entry *c = cache[i];
+
+		if (!c || strcmp(c->path, canon))
+			continue;
+
+		if (same_file(c, &st)) {
+			printc_dbg("Using cached image of %s\n", path);
+			e = c;
+			break;
+		}
+
+		/* The file has changed since it was cached */
+		if (!c->refs) {
+			entry_free(c);
+			cache[i] = NULL;
+		}
+	}
+
+	if (!e) {
+		e = entry_load(canon, &st);
+		if (!e) {
+			free(canon);
+			return NULL;
+		}
+
+		cache_insert(e);
+	}
+
+	free(canon);
+	e->refs++;
+	e->last_used = ++use_counter;
+	return &e->img;
+}
+
+int image_load_syms(const struct image *img)
+{
+	struct image_entry *e = (struct image_entry *)img;
+	struct stab_entry *ents;
+	struct stat st;
+	FILE *in;
+	int ret;
+
+	if (e->have_syms) {
+		printc_dbg("Using cached symbols of %s\n", e->path);
+		stab_clear();
+
+		if (!e->num_syms)
+			return 0;
+
+		ents = malloc(sizeof(ents[0]) * e->num_syms);
+		if (!ents) {
+			printc_err("image: can't allocate memory\n");
+			return -1;
+		}
+
+		memcpy(ents, e->syms, sizeof(ents[0]) * e->num_syms);
+		return stab_load(ents, e->num_syms, e->sym_names);
+	}
+
+	in = fopen(e->path, "rb");
+	if (!in) {
+		printc_err("%s: %s\n", e->path, last_error());
+		return -1;
+	}
+
+	stab_clear();
+	ret = binfile_syms(in);
+
+	/* Keep the symbols only if they came from the file the image
+	 * was loaded from.
+	 */
+	if (!ret && !fstat(fileno(in), &st) && same_file(e, &st) &&
+	    !stab_save(&e->syms, &e->num_syms, &e->sym_names))
+		e->have_syms = 1;
+
+	fclose(in);
+	return ret;
+}
+
+void image_release(const struct image *img)
+{
+	struct image_entry *e = (struct image_entry *)img;
+
+	if (!e)
+		return;
+
+	e->refs--;
+	if (!e->refs && !e->cached)
+		entry_free(e);
+}
+
+void image_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		struct image_entry *e = cache[i];
+
+		if (e && !e->refs) {
+			entry_free(e);
+			cache[i] = NULL;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include "binfile.h"
+
+/* An image is the decoded program text of a binary file: a list of
+ * segments, sorted by address, with contiguous chunks from the same
+ * section coalesced. Once loaded, an image is never modified, so it
+ * may be shared between threads.
+ *
+ * Segment data is owned by the image. Nothing refers to the source
+ * file once it has been loaded, so the file may be rewritten while the
+ * image is cached.
+ */
+struct image_segment {
+	/* Section name, or an empty string if the format has none */
+	char			section[64];
+
+	address_t		addr;
+	address_t		len;
+	const uint8_t		*data;
+};
+
+struct image {
+	struct image_segment	*segs;
+	int			num_segs;
+
+	/* Sum of all segment lengths */
+	address_t		total;
+
+	/* Return value of binfile_info() for the source file */
+	int			info;
+};
+
+/* Load an image from the named file. Images are cached, keyed by
+ * canonical path, device and inode, modification time (to the
+ * nanosecond, where the platform has it) and size, so that loading the
+ * same unchanged file again doesn't require it to be parsed again.
+ *
+ * Returns a reference to the image, which must be released with
+ * image_release(), or NULL if an error occurs.
+ */
+const struct image *image_load(const char *path);
+
+/* Replace the symbol table with the symbols from the image's file.
+ * They're parsed the first time, and kept with the cached image after
+ * that. Returns 0 on success or -1 on error.
+ */
+int image_load_syms(const struct image *img);
+
+/* Release a reference obtained from image_load(). */
+void image_release(const struct image *img);
+
+/* Discard all cached images which are not currently referenced. */
+void image_cache_flush(void);
+
+#endif
@@ -18,8 +18,10 @@
 
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 #include "srec.h"
 #include "util.h"
+#include "hexdec.h"
 #include "output.h"
 
 int srec_check(FILE *in)
@@ -45,56 +47,78 @@ int srec_check(FILE *in)
 	return 1;
 }
 
-int srec_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+int srec_extract_map(FILE *in, const struct mapfile *map,
+		     binfile_imgcb_t cb, void *user_data)
 {
-	char buf[128];
+	const char *text = (const char *)map->data;
+	const char *end = text + map->size;
+	struct binfile_coalesce *out;
 	int lno = 0;
+	int ret = -1;
 
-	rewind(in);
-	while (fgets(buf, sizeof(buf), in)) {
-		uint8_t bytes[128];
+	(void)in;
+
+	out = malloc(sizeof(*out));
+	if (!out) {
+		printc_err("srec: can't allocate memory\n");
+		return -1;
+	}
+
+	binfile_coalesce_init(out, cb, user_data);
+
+	while (text < end) {
+		const char *nl = memchr(text, '\n', end - text);
+		const char *eol = nl ? nl : end;
+		const char *line = text;
+		/* Count byte, plus up to 255 bytes which it counts */
+		uint8_t bytes[256];
 		uint8_t cksum = 0;
-		int count = 0;
+		int count;
 		int i;
 
+		text = nl ? nl + 1 : end;
 		lno++;
 
-		if (buf[0] != 'S') {
+		while (eol > line && isspace((uint8_t)eol[-1]))
+			eol--;
+
+		if (eol == line)
+			continue;
+
+		if (line[0] != 'S' || eol - line < 2) {
 			printc_err("srec: garbage on line %d\n", lno);
-			return -1;
+			goto out;
 		}
 
-		for (i = 2; ishex(buf[i]) && ishex(buf[i + 1]); i += 2) {
-			if (count >= sizeof(bytes)) {
-				printc_err("srec: too many bytes on "
-					"line %d\n", lno);
-				return -1;
-			}
-
-			bytes[count++] = (hexval(buf[i]) << 4) |
-				hexval(buf[i + 1]);
+		if ((eol - line) & 1) {
+			printc_err("srec: trailing garbage on "
+				"line %d\n", lno);
+			goto out;
 		}
 
-		while (buf[i]) {
-			if (!isspace(buf[i])) {
-				printc_err("srec: trailing garbage on "
-					"line %d\n", lno);
-				return -1;
-			}
+		count = (eol - line - 2) / 2;
+		if (count > sizeof(bytes)) {
+			printc_err("srec: too many bytes on "
+				"line %d\n", lno);
+			goto out;
+		}
 
-			i++;
+		if (hexdec(bytes, line + 2, count) < 0) {
+			printc_err("srec: invalid hex digit on "
+				"line %d\n", lno);
+			goto out;
 		}
 
 		if (count < 2) {
 			printc_err("srec: too few bytes on line %d\n",
 				lno);
-			return -1;
+			goto out;
 		}
 
 		if (bytes[0] + 1 != count) {
 			printc_err("srec: byte count mismatch on "
 				"line %d\n", lno);
-			return -1;
+			goto out;
 		}
 
 		for (i = 0; i + 1 < count; i++)
@@ -104,33 +128,33 @@ int srec_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
 			printc_err("srec: checksum error on line %d "
 				"(calc = 0x%02x, read = 0x%02x)\n",
 				lno, cksum, bytes[count - 1]);
-			return -1;
+			goto out;
 		}
 
-		if (buf[1] >= '1' && buf[1] <= '3') {
-			int addrbytes = buf[1] - '1' + 2;
+		if (line[1] >= '1' && line[1] <= '3') {
+			int addrbytes = line[1] - '1' + 2;
 			address_t addr = 0;
-			struct binfile_chunk ch = {0};
-
-			for (i = 0; i < addrbytes; i++)
-				addr = (addr << 8) | bytes[i + 1];
 
 			if (count < addrbytes + 2) {
 				printc_err("srec: too few address bytes "
 					"on line %d\n", lno);
-				return -1;
+				goto out;
 			}
 
-			ch.addr = addr;
-			ch.data = bytes + addrbytes + 1;
-			ch.len = count - 2 - addrbytes;
+			for (i = 0; i < addrbytes; i++)
+				addr = (addr << 8) | bytes[i + 1];
 
-			if (cb(user_data, &ch) < 0) {
+			if (binfile_coalesce_feed(out, addr,
+						  bytes + addrbytes + 1,
+						  count - 2 - addrbytes) < 0) {
 				printc_err("srec: error on line %d\n", lno);
-				return -1;
+				goto out;
 			}
 		}
 	}
 
-	return 0;
+	ret = binfile_coalesce_flush(out);
+ out:
+	free(out);
+	return ret;
 }
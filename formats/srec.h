@@ -22,6 +22,7 @@
 #include "binfile.h"
 
 int srec_check(FILE *in);
-int srec_extract(FILE *in, binfile_imgcb_t cb, void *user_data);
+int srec_extract_map(FILE *in, const struct mapfile *map,
+		     binfile_imgcb_t cb, void *user_data);
 
 #endif
@@ -18,38 +18,29 @@
 
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 #include "titext.h"
 #include "util.h"
+#include "hexdec.h"
 #include "output.h"
 
-static int is_address_line(const char *text)
+static int is_address_line(const char *text, const char *end)
 {
-	if (*text != '@')
+	if (text >= end || *text != '@')
 		return 0;
 
 	text++;
-	if (!*text || isspace(*text))
+	if (text >= end || isspace((uint8_t)*text))
 		return 0;
 
-	while (*text && !isspace(*text)) {
+	while (text < end && !isspace((uint8_t)*text)) {
 		if (!ishex(*text))
 			return 0;
 		text++;
 	}
 
-	while (*text) {
-		if (!isspace(*text))
-			return 0;
-		text++;
-	}
-
-	return 1;
-}
-
-static int is_data_line(const char *text)
-{
-	while (*text) {
-		if (!(ishex(*text) || isspace(*text)))
+	while (text < end) {
+		if (!isspace((uint8_t)*text))
 			return 0;
 		text++;
 	}
@@ -65,97 +56,121 @@ int titext_check(FILE *in)
 	if (!fgets(buf, sizeof(buf), in))
 		return 0;
 
-	return is_address_line(buf);
+	return is_address_line(buf, buf + strlen(buf));
 }
 
-static int process_data_line(address_t address, const char *buf,
-			     binfile_imgcb_t cb, void *user_data)
+/* Decode a line of whitespace-separated hex values in a single pass.
+ * Returns the number of bytes, 0 if this isn't a data line (it contains
+ * something other than hex digits and whitespace), or -1 on error.
+ */
+static int parse_data_line(const char *text, const char *end,
+			   uint8_t *data, int max)
 {
-	uint8_t data[64];
 	int data_len = 0;
 	int value = 0;
 	int vc = 0;
-	struct binfile_chunk ch = {0};
+	int too_long = 0;
+	int too_wide = 0;
 
-	while (*buf) {
-		int c = *(buf++);
-		int x;
+	while (text < end) {
+		const int c = (uint8_t)*(text++);
+		const int x = hexdec_nibble(c);
 
-		if (isspace(c)) {
-			if (vc) {
-				if (data_len >= sizeof(data))
-					goto too_long;
-				data[data_len++] = value;
-			}
-
-			vc = 0;
-		} else {
-			if (isdigit(c)) {
-				x = c - '0';
-			} else if (c >= 'A' && c <= 'F') {
-				x = c - 'A' + 10;
-			} else if (c >= 'a' && c <= 'f') {
-				x = c - 'a' + 10;
-			} else  {
-				printc_err("titext: unexpected "
-					"character: %c\n", c);
-				return -1;
-			}
+		if (x >= 0) {
+			value = (value << 4) | x;
+			if (++vc > 2)
+				too_wide = 1;
+			continue;
+		}
 
-			if (vc >= 2) {
-				printc_err("titext: too many digits "
-					"in hex value\n");
-				return -1;
-			}
+		if (!isspace(c))
+			return 0;
 
-			value = (value << 4) | x;
-			vc++;
+		if (vc) {
+			if (data_len < max)
+				data[data_len++] = value;
+			else
+				too_long = 1;
 		}
+
+		value = 0;
+		vc = 0;
 	}
 
 	if (vc) {
-		if (data_len >= sizeof(data))
-			goto too_long;
-		data[data_len++] = value;
+		if (data_len < max)
+			data[data_len++] = value;
+		else
+			too_long = 1;
 	}
 
-	ch.addr = address;
-	ch.data = data;
-	ch.len = data_len;
-	if (cb(user_data, &ch) < 0)
+	if (too_wide) {
+		printc_err("titext: too many digits in hex value\n");
 		return -1;
+	}
 
-	return data_len;
+	if (too_long) {
+		printc_err("titext: too many data bytes\n");
+		return -1;
+	}
 
- too_long:
-	printc_err("titext: too many data bytes\n");
-	return -1;
+	return data_len;
 }
 
-int titext_extract(FILE *in, binfile_imgcb_t cb, void *user_data)
+int titext_extract_map(FILE *in, const struct mapfile *map,
+		       binfile_imgcb_t cb, void *user_data)
 {
+	const char *text = (const char *)map->data;
+	const char *end = text + map->size;
+	struct binfile_coalesce *out;
 	address_t address = 0;
 	int lno = 0;
-	char buf[128];
+	int ret = -1;
 
-	rewind(in);
-	while (fgets(buf, sizeof(buf), in)) {
+	(void)in;
+
+	out = malloc(sizeof(*out));
+	if (!out) {
+		printc_err("titext: can't allocate memory\n");
+		return -1;
+	}
+
+	binfile_coalesce_init(out, cb, user_data);
+
+	while (text < end) {
+		const char *nl = memchr(text, '\n', end - text);
+		const char *eol = nl ? nl : end;
+		const char *line = text;
+
+		text = nl ? nl + 1 : end;
 		lno++;
 
-		if (is_address_line(buf)) {
-			address = strtoul(buf + 1, NULL, 16);
-		} else if (is_data_line(buf)) {
-			int count = process_data_line(address, buf,
-						      cb, user_data);
-			if (count < 0) {
+		if (*line == '@') {
+			if (!is_address_line(line, eol))
+				continue;
+
+			address = 0;
+			for (line++; line < eol && ishex(*line); line++)
+				address = (address << 4) | hexdec_nibble(*line);
+		} else {
+			uint8_t data[256];
+			int count = parse_data_line(line, eol,
+						    data, sizeof(data));
+
+			if (count < 0 ||
+			    (count > 0 && binfile_coalesce_feed(out, address,
+							data, count) < 0)) {
 				printc_err("titext: data error on line "
 					"%d\n", lno);
-				return -1;
+				goto out;
 			}
 
 			address += count;
 		}
 	}
 
-	return 0;
+	ret = binfile_coalesce_flush(out);
+ out:
+	free(out);
+	return ret;
 }
@@ -22,6 +22,7 @@
 #include "binfile.h"
 
 int titext_check(FILE *in);
-int titext_extract(FILE *in, binfile_imgcb_t cb, void *user_data);
+int titext_extract_map(FILE *in, const struct mapfile *map,
+		       binfile_imgcb_t cb, void *user_data);
 
 #endif
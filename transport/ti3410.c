@@ -433,6 +433,8 @@ static int do_extract(void *user_data, const struct binfile_chunk *ch)
 static int load_firmware(struct firmware *f)
 {
 	FILE *in = find_firmware();
+	struct mapfile *map;
+	int ret;
 
 	if (!in)
 		return -1;
@@ -443,14 +445,22 @@ static int load_firmware(struct firmware *f)
 		return -1;
 	}
 
-	memset(f, 0, sizeof(*f));
-	if (ihex_extract(in, do_extract, f) < 0) {
-		printc_err("ti3410: failed to load firmware\n");
+	map = mapfile_new(in);
+	if (!map) {
 		fclose(in);
 		return -1;
 	}
 
+	memset(f, 0, sizeof(*f));
+	ret = ihex_extract_map(in, map, do_extract, f);
+	mapfile_free(map);
 	fclose(in);
+
+	if (ret < 0) {
+		printc_err("ti3410: failed to load firmware\n");
+		return -1;
+	}
+
 	return 0;
 }
 
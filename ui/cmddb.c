@@ -30,6 +30,7 @@
 #include "simio.h"
 #include "aliasdb.h"
 #include "power.h"
+#include "gang.h"
 
 const struct cmddb_record commands[] = {
 	{
@@ -184,6 +185,14 @@ const struct cmddb_record commands[] = {
 "    Blow the device's JTAG fuse.\n"
 "\n"
 "    \x1b[1mWARNING: this is an irreversible operation!\x1b[0m\n"
+	},
+	{
+		.name = "cache",
+		.func = cmd_cache,
+		.help =
+"cache [flush|reset]\n"
+"    Show memory cache statistics. With an argument, discard the\n"
+"    contents of the cache, or reset the hit/miss counters.\n"
 	},
 	{
 		.name = "erase",
@@ -231,6 +240,28 @@ const struct cmddb_record commands[] = {
 		.help =
 "hexout <address> <length> <filename.hex>\n"
 "    Save a region of memory into a HEX file.\n"
+	},
+	{
+		.name = "export",
+		.func = cmd_export,
+		.help =
+"export <format> <address> <length> <filename>\n"
+"    Save a region of memory to a file in the given format: ihex, srec,\n"
+"    titext or raw.\n"
+	},
+	{
+		.name = "gang",
+		.func = cmd_gang,
+		.help =
+"gang [list]\n"
+"    List the devices opened for gang programming.\n"
+"gang prog <filename>\n"
+"    Erase and program all gang devices in parallel with the same\n"
+"    image. A per-target report is shown when all devices finish.\n"
+"gang load <filename>\n"
+"    As for gang prog, but without erasing first.\n"
+"gang verify <filename>\n"
+"    Compare the contents of all gang devices against the image.\n"
 	},
 	{
 		.name = "gdb",
@@ -352,8 +383,15 @@ const struct cmddb_record commands[] = {
 "    Show data only for the specified session.\n"
 "power export-csv <N> <filename>\n"
 "    Write session data for the given session to a CSV file.\n"
+"power export-bin <filename>\n"
+"    Write all sessions to a compact binary file.\n"
+"power import-bin <filename>\n"
+"    Replace all power data with the contents of a binary file.\n"
 "power profile\n"
 "    List power profile data by symbol.\n"
+"power spill [<filename>|off]\n"
+"    Also write all samples to a file, so that they can be exported or\n"
+"    profiled after they've dropped out of memory.\n"
 	},
 #ifndef NO_SHELLCMD
 	{
@@ -24,6 +24,7 @@
 
 #include "device.h"
 #include "binfile.h"
+#include "image.h"
 #include "stab.h"
 #include "expr.h"
 #include "reader.h"
@@ -32,6 +33,9 @@
 #include "prog.h"
 #include "dis.h"
 #include "opdb.h"
+#include "memcache.h"
+#include "export.h"
+#include "power.h"
 
 int cmd_regs(char **arg)
 {
@@ -324,11 +328,15 @@ int cmd_run(char **arg)
 	}
 
 	printc("Running. Press Ctrl+C to interrupt...\n");
+	power_live_begin();
 
 	do {
 		status = device_poll();
+		power_live_poll();
 	} while (status == DEVICE_STATUS_RUNNING);
 
+	power_live_end();
+
 	if (status == DEVICE_STATUS_INTR)
 		printc("\n");
 
@@ -423,152 +431,16 @@ int cmd_dis(char **arg)
 }
 
 
-#define IHEX_REC_DATA 0x00
-#define IHEX_REC_EOF  0x01
-#define IHEX_REC_ESAR 0x02
-#define IHEX_REC_SSAR 0x03
-#define IHEX_REC_ELAR 0x04
-#define IHEX_REC_SLAR 0x05
-#define IHEX_SEG(addr) (((addr) >> 16) & 0xFFFF)
-
-struct hexout_data {
-	FILE            *file;
-	address_t       addr;
-	uint8_t         buf[16];
-	int             len;
-
-	uint16_t        segoff;
-};
-
-static int hexout_start(struct hexout_data *hexout, const char *filename)
-{
-	char * path = NULL;
-
-	path = expand_tilde(filename);
-	if (!path)
-		return -1;
-
-	hexout->file = fopen(path, "w");
-	free(path);
-
-	if (!hexout->file) {
-		pr_error("hexout: couldn't open output file");
-		return -1;
-	}
-
-	hexout->addr = 0;
-	hexout->len = 0;
-	hexout->segoff = 0;
-
-	return 0;
-}
-
-static int hexout_write(FILE *out, uint8_t type, int len, uint16_t addr,
-			const uint8_t *payload)
-{
-	int i;
-	int cksum = 0;
-
-	if (fprintf(out, ":%02X%04X%02X", len, addr, type) < 0)
-		goto fail;
-	cksum += len;
-	cksum += addr & 0xff;
-	cksum += addr >> 8;
-	cksum += type;
-
-	for (i = 0; i < len; i++) {
-		if (fprintf(out, "%02X", payload[i]) < 0)
-			goto fail;
-		cksum += payload[i];
-	}
-
-	if (fprintf(out, "%02X\n", ~(cksum - 1) & 0xff) < 0)
-		goto fail;
-
-	return 0;
-
-fail:
-	pr_error("hexout: can't write HEX data");
-	return -1;
-}
-
-static int hexout_flush(struct hexout_data *hexout)
-{
-	while (hexout->len) {
-		address_t addr_low = hexout->addr & 0xffff;
-		address_t segoff = IHEX_SEG(hexout->addr);
-
-		if (segoff != hexout->segoff) {
-			uint8_t offset_data[] = {segoff >> 8, segoff & 0xff};
-
-			if (hexout_write(hexout->file, IHEX_REC_ELAR,
-				2, 0, offset_data) < 0)
-				return -1;
-			hexout->segoff = segoff;
-		}
-
-		uint32_t writesize = hexout->len;
-
-		/* If the hexout buffer will wrap past the end of segment;
-		 * only write until the end of the segment to allow
-		 * emitting an ELAR record */
-		if (IHEX_SEG(hexout->addr + writesize) != segoff)
-			writesize = 0x10000 - addr_low;
-
-		if (hexout_write(hexout->file, IHEX_REC_DATA, writesize, addr_low,
-				hexout->buf) < 0)
-			return -1;
-
-		hexout->len -= writesize;
-		hexout->addr += writesize;
-
-		memmove(hexout->buf, hexout->buf + writesize,
-			sizeof(hexout->buf) - writesize);
-	}
-
-	return 0;
-}
-
-static int hexout_feed(struct hexout_data *hexout,
-		       uint32_t addr, const uint8_t *buf, int len)
-{
-	while (len) {
-		int count;
-
-		if ((hexout->addr + hexout->len != addr ||
-		     hexout->len >= sizeof(hexout->buf)) &&
-		    hexout_flush(hexout) < 0)
-			return -1;
-
-		if (!hexout->len)
-			hexout->addr = addr;
-
-		count = sizeof(hexout->buf) - hexout->len;
-		if (count > len)
-			count = len;
-
-		memcpy(hexout->buf + hexout->len, buf, count);
-		hexout->len += count;
-
-		addr += count;
-		buf += count;
-		len -= count;
-	}
-
-	return 0;
-}
-
-int cmd_hexout(char **arg)
+static int do_export(const char *cmd, char **arg, export_format_t fmt)
 {
 	char *off_text = get_arg(arg);
 	char *len_text = get_arg(arg);
 	char *filename = *arg;
 	address_t off;
 	address_t length;
-	struct hexout_data hexout;
 
 	if (!(off_text && len_text && *filename)) {
-		printc_err("hexout: need offset, length and filename\n");
+		printc_err("%s: need offset, length and filename\n", cmd);
 		return -1;
 	}
 
@@ -576,61 +448,43 @@ int cmd_hexout(char **arg)
 	    expr_eval(len_text, &length) < 0)
 		return -1;
 
-	if (hexout_start(&hexout, filename) < 0)
+	if (export_memory(filename, off, length, fmt) < 0)
 		return -1;
 
-	while (length) {
-		uint8_t buf[4096];
-		int count = length;
-
-		if (count > sizeof(buf))
-			count = sizeof(buf);
-
-		printc("Reading %4d bytes from 0x%04x...\n", count, off);
-		if (device_readmem(off, buf, count) < 0) {
-			pr_error("hexout: can't read memory");
-			goto fail;
-		}
-
-		if (hexout_feed(&hexout, off, buf, count) < 0)
-			goto fail;
+	printc("Done, %d bytes total\n", length);
+	return 0;
+}
 
-		length -= count;
-		off += count;
-	}
+int cmd_hexout(char **arg)
+{
+	return do_export("hexout", arg, EXPORT_IHEX);
+}
 
-	if (hexout_flush(&hexout) < 0)
-		goto fail;
+int cmd_export(char **arg)
+{
+	const char *fmt_text = get_arg(arg);
+	export_format_t fmt;
 
-	if (hexout_write(hexout.file, IHEX_REC_EOF, 0, 0, NULL) < 0) {
-		pr_error("hexout: failed to write terminator\n");
-		goto fail;
+	if (!fmt_text) {
+		printc_err("export: need format, offset, length and "
+			   "filename\n");
+		return -1;
 	}
 
-	if (fclose(hexout.file) < 0) {
-		pr_error("hexout: error on close");
+	if (export_format_parse(fmt_text, &fmt) < 0) {
+		printc_err("export: unknown format: %s\n", fmt_text);
 		return -1;
 	}
 
-	return 0;
-
-fail:
-	fclose(hexout.file);
-	unlink(filename);
-	return -1;
-}
-
-static int cmd_prog_feed(void *user_data, const struct binfile_chunk *ch)
-{
-	return prog_feed((struct prog_data *)user_data, ch);
+	return do_export("export", arg, fmt);
 }
 
 static int do_cmd_prog(char **arg, int prog_flags)
 {
-	FILE *in;
+	const struct image *img;
 	struct prog_data prog;
 	const char *path_arg;
-	char * path;
+	char *path;
 
 	path_arg = get_arg(arg);
 	if (!path_arg) {
@@ -645,36 +499,26 @@ static int do_cmd_prog(char **arg, int prog_flags)
 	if (!path)
 		return -1;
 
-	in = fopen(path, "rb");
-	if (!in) {
-		printc_err("prog: %s: %s\n", path, last_error());
-                free(path);
+	img = image_load(path);
+	if (!img) {
+		free(path);
 		return -1;
 	}
-	free(path);
 
-	if (device_ctl(DEVICE_CTL_HALT) < 0) {
-		fclose(in);
-		return -1;
-	}
+	if (device_ctl(DEVICE_CTL_HALT) < 0)
+		goto fail;
 
 	prog_init(&prog, prog_flags);
 
-	if (binfile_extract(in, cmd_prog_feed, &prog) < 0) {
-		fclose(in);
-		return -1;
-	}
+	if (prog_image(&prog, img) < 0)
+		goto fail;
 
 	if ((prog_flags & PROG_WANT_ERASE) &&
-	    (binfile_info(in) & BINFILE_HAS_SYMS)) {
-		stab_clear();
-		binfile_syms(in);
-	}
-
-	fclose(in);
+	    (img->info & BINFILE_HAS_SYMS))
+		image_load_syms(img);
 
-	if (prog_flush(&prog) < 0)
-		return -1;
+	image_release(img);
+	free(path);
 
 	printc("Done, %d bytes total\n", prog.total_written);
 
@@ -684,11 +528,16 @@ static int do_cmd_prog(char **arg, int prog_flags)
 
 	unmark_modified(MODIFY_SYMS);
 	return 0;
+
+fail:
+	image_release(img);
+	free(path);
+	return -1;
 }
 
 int cmd_prog(char **arg)
 {
-	return do_cmd_prog(arg, PROG_WANT_ERASE);
+	return do_cmd_prog(arg, prog_erase_flags());
 }
 
 int cmd_load(char **arg)
@@ -909,3 +758,42 @@ int cmd_blow_jtag_fuse(char **arg)
 
 	return device_ctl(DEVICE_CTL_SECURE);
 }
+
+int cmd_cache(char **arg)
+{
+	const char *op = get_arg(arg);
+	struct memcache_stats st;
+	unsigned long long total;
+
+	if (!device_default->cache) {
+		printc("No memory cache (the chip is unknown, or no memory "
+		       "has been read).\n");
+		return 0;
+	}
+
+	if (op) {
+		if (!strcasecmp(op, "flush")) {
+			device_cache_flush(device_default);
+		} else if (!strcasecmp(op, "reset")) {
+			memcache_reset_stats(device_default->cache);
+		} else {
+			printc_err("cache: unknown operation: %s\n", op);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	memcache_get_stats(device_default->cache, &st);
+	total = st.hits + st.misses;
+
+	printc("Memory cache: %s, %d of %d pages (%d bytes each) held\n",
+	       opdb_get_boolean("mem_cache") ? "enabled" : "disabled",
+	       st.pages, MEMCACHE_NUM_PAGES, MEMCACHE_PAGE_SIZE);
+	printc("    Hits:   %llu\n", st.hits);
+	printc("    Misses: %llu\n", st.misses);
+	if (total)
+		printc("    Hit rate: %llu%%\n", st.hits * 100 / total);
+
+	return 0;
+}
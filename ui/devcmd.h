@@ -29,6 +29,7 @@ int cmd_run(char **arg);
 int cmd_set(char **arg);
 int cmd_dis(char **arg);
 int cmd_hexout(char **arg);
+int cmd_export(char **arg);
 int cmd_prog(char **arg);
 int cmd_load(char **arg);
 int cmd_verify(char **arg);
@@ -40,5 +41,6 @@ int cmd_delbreak(char **arg);
 int cmd_break(char **arg);
 int cmd_fill(char **arg);
 int cmd_blow_jtag_fuse(char **arg);
+int cmd_cache(char **arg);
 
 #endif
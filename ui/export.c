@@ -0,0 +1,557 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "device.h"
+#include "output.h"
+#include "ctrlc.h"
+#include "thread.h"
+
+/* Size of each of the two blocks passed between the reader and the
+ * formatter.
+ */
+#define BLOCK_SIZE		32768
+
+/* Data bytes per record (or per line, for TI-TXT) */
+#define LINE_BYTES		16
+
+/* Formatted text is collected in a buffer of this size before being
+ * written out.
+ */
+#define OUT_SIZE		65536
+
+#define IHEX_REC_DATA		0x00
+#define IHEX_REC_EOF		0x01
+#define IHEX_REC_ELAR		0x04
+#define IHEX_SEG(addr)		(((addr) >> 16) & 0xffff)
+
+/************************************************************************
+ * Formatting
+ */
+
+struct writer {
+	FILE			*file;
+	export_format_t		fmt;
+
+	/* Pending data, not yet formatted as a record */
+	address_t		addr;
+	uint8_t			line[LINE_BYTES];
+	int			len;
+
+	/* IHEX: current extended linear address */
+	uint16_t		segoff;
+
+	/* SREC: number of address bytes per record */
+	int			addr_bytes;
+
+	/* TI-TXT: address following the last line written */
+	address_t		next;
+	int			started;
+
+	char			out[OUT_SIZE];
+	int			out_len;
+};
+
+static const char hexdigits[] = "0123456789ABCDEF";
+
+static int out_flush(struct writer *w)
+{
+	if (w->out_len && fwrite(w->out, w->out_len, 1, w->file) != 1) {
+		pr_error("export: can't write output");
+		return -1;
+	}
+
+	w->out_len = 0;
+	return 0;
+}
+
+/* Make sure there's room for a record of the given length. */
+static int out_reserve(struct writer *w, int len)
+{
+	if (w->out_len + len > sizeof(w->out))
+		return out_flush(w);
+
+	return 0;
+}
+
+static inline char *put_hex(char *p, uint8_t x)
+{
+	p[0] = hexdigits[x >> 4];
+	p[1] = hexdigits[x & 15];
+	return p + 2;
+}
+
+static int ihex_record(struct writer *w, uint8_t type, uint16_t addr,
+		       const uint8_t *data, int len)
+{
+	uint8_t cksum = len + (addr >> 8) + (addr & 0xff) + type;
+	char *p;
+	int i;
+
+	if (out_reserve(w, len * 2 + 12) < 0)
+		return -1;
+
+	p = w->out + w->out_len;
+	*(p++) = ':';
+	p = put_hex(p, len);
+	p = put_hex(p, addr >> 8);
+	p = put_hex(p, addr);
+	p = put_hex(p, type);
+
+	for (i = 0; i < len; i++) {
+		p = put_hex(p, data[i]);
+		cksum += data[i];
+	}
+
+	p = put_hex(p, -cksum);
+	*(p++) = '\n';
+
+	w->out_len = p - w->out;
+	return 0;
+}
+
+static int srec_record(struct writer *w, char type, address_t addr,
+		       const uint8_t *data, int len)
+{
+	const int count = w->addr_bytes + len + 1;
+	uint8_t cksum = count;
+	char *p;
+	int i;
+
+	if (out_reserve(w, count * 2 + 5) < 0)
+		return -1;
+
+	p = w->out + w->out_len;
+	*(p++) = 'S';
+	*(p++) = type;
+	p = put_hex(p, count);
+
+	for (i = w->addr_bytes - 1; i >= 0; i--) {
+		const uint8_t b = addr >> (i * 8);
+
+		p = put_hex(p, b);
+		cksum += b;
+	}
+
+	for (i = 0; i < len; i++) {
+		p = put_hex(p, data[i]);
+		cksum += data[i];
+	}
+
+	p = put_hex(p, ~cksum);
+	*(p++) = '\n';
+
+	w->out_len = p - w->out;
+	return 0;
+}
+
+static int titext_line(struct writer *w, address_t addr,
+		       const uint8_t *data, int len)
+{
+	char *p;
+	int i;
+
+	if (out_reserve(w, len * 3 + 16) < 0)
+		return -1;
+
+	p = w->out + w->out_len;
+
+	if (!w->started || addr != w->next)
+		p += sprintf(p, "@%04X\n", addr);
+
+	for (i = 0; i < len; i++) {
+		p = put_hex(p, data[i]);
+		*(p++) = (i + 1 < len) ? ' ' : '\n';
+	}
+
+	w->out_len = p - w->out;
+	w->started = 1;
+	w->next = addr + len;
+	return 0;
+}
+
+/* Format whatever data is pending. */
+static int write_line(struct writer *w)
+{
+	while (w->len) {
+		const address_t segoff = IHEX_SEG(w->addr);
+		int count = w->len;
+
+		switch (w->fmt) {
+		case EXPORT_IHEX:
+			if (segoff != w->segoff) {
+				const uint8_t seg[2] = {segoff >> 8, segoff};
+
+				if (ihex_record(w, IHEX_REC_ELAR, 0,
+						seg, 2) < 0)
+					return -1;
+
+				w->segoff = segoff;
+			}
+
+			/* Split records which would cross into the next
+			 * segment, so that an ELAR record can be emitted.
+			 */
+			if (IHEX_SEG(w->addr + count) != segoff)
+				count = 0x10000 - (w->addr & 0xffff);
+
+			if (ihex_record(w, IHEX_REC_DATA, w->addr,
+					w->line, count) < 0)
+				return -1;
+			break;
+
+		case EXPORT_SREC:
+			if (srec_record(w, '0' + w->addr_bytes - 1,
+					w->addr, w->line, count) < 0)
+				return -1;
+			break;
+
+		case EXPORT_TITEXT:
+			if (titext_line(w, w->addr, w->line, count) < 0)
+				return -1;
+			break;
+
+		case EXPORT_RAW:
+			break;
+		}
+
+		w->len -= count;
+		w->addr += count;
+		memmove(w->line, w->line + count, w->len);
+	}
+
+	return 0;
+}
+
+static int writer_feed(struct writer *w, address_t addr,
+		       const uint8_t *data, address_t len)
+{
+	if (w->fmt == EXPORT_RAW) {
+		while (len) {
+			int count = sizeof(w->out) - w->out_len;
+
+			if (count > len)
+				count = len;
+
+			memcpy(w->out + w->out_len, data, count);
+			w->out_len += count;
+			data += count;
+			len -= count;
+
+			if (w->out_len == sizeof(w->out) && out_flush(w) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	while (len) {
+		int count;
+
+		if ((w->addr + w->len != addr || w->len >= LINE_BYTES) &&
+		    write_line(w) < 0)
+			return -1;
+
+		if (!w->len)
+			w->addr = addr;
+
+		count = LINE_BYTES - w->len;
+		if (count > len)
+			count = len;
+
+		memcpy(w->line + w->len, data, count);
+		w->len += count;
+
+		addr += count;
+		data += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+/* Write out pending data and the end-of-file record. */
+static int writer_finish(struct writer *w)
+{
+	if (write_line(w) < 0)
+		return -1;
+
+	switch (w->fmt) {
+	case EXPORT_IHEX:
+		if (ihex_record(w, IHEX_REC_EOF, 0, NULL, 0) < 0)
+			return -1;
+		break;
+
+	case EXPORT_SREC:
+		if (srec_record(w, '0' + 11 - w->addr_bytes, 0, NULL, 0) < 0)
+			return -1;
+		break;
+
+	case EXPORT_TITEXT:
+		if (out_reserve(w, 2) < 0)
+			return -1;
+		memcpy(w->out + w->out_len, "q\n", 2);
+		w->out_len += 2;
+		break;
+
+	case EXPORT_RAW:
+		break;
+	}
+
+	return out_flush(w);
+}
+
+/************************************************************************
+ * Reader thread
+ *
+ * The reader fills the two blocks alternately, and the formatter
+ * empties them in the same order. num_full counts blocks which have
+ * been read but not yet written.
+ */
+
+struct block {
+	address_t		addr;
+	address_t		len;
+	uint8_t			data[BLOCK_SIZE];
+};
+
+struct pipeline {
+	/* Range remaining to be read (reader only) */
+	address_t		addr;
+	address_t		len;
+
+	struct block		blocks[2];
+
+	thread_lock_t		lock;
+	thread_cond_t		filled;
+	thread_cond_t		emptied;
+	int			num_full;
+	int			reader_done;
+	int			reader_failed;
+	int			cancelled;
+};
+
+/* Read the next block. Returns 0 on success or -1 on error. */
+static int read_block(struct pipeline *p, struct block *b)
+{
+	b->addr = p->addr;
+	b->len = p->len;
+	if (b->len > BLOCK_SIZE)
+		b->len = BLOCK_SIZE;
+
+	if (ctrlc_check()) {
+		printc_err("export: interrupted\n");
+		return -1;
+	}
+
+	if (device_readmem(b->addr, b->data, b->len) < 0) {
+		printc_err("export: can't read memory at 0x%04x\n", b->addr);
+		return -1;
+	}
+
+	p->addr += b->len;
+	p->len -= b->len;
+	return 0;
+}
+
+static void reader_thread(void *user_data)
+{
+	struct pipeline *p = (struct pipeline *)user_data;
+	int next = 0;
+	int failed = 0;
+
+	while (p->len) {
+		thread_lock_acquire(&p->lock);
+		while (p->num_full >= 2 && !p->cancelled)
+			thread_cond_wait(&p->emptied, &p->lock);
+		failed = p->cancelled;
+		thread_lock_release(&p->lock);
+
+		if (failed || read_block(p, &p->blocks[next]) < 0) {
+			failed = 1;
+			break;
+		}
+
+		thread_lock_acquire(&p->lock);
+		p->num_full++;
+		thread_cond_notify(&p->filled);
+		thread_lock_release(&p->lock);
+
+		next ^= 1;
+	}
+
+	thread_lock_acquire(&p->lock);
+	p->reader_done = 1;
+	p->reader_failed = failed;
+	thread_cond_notify(&p->filled);
+	thread_lock_release(&p->lock);
+}
+
+/* Consume blocks as the reader produces them. */
+static int format_blocks(struct pipeline *p, struct writer *w)
+{
+	int next = 0;
+
+	for (;;) {
+		struct block *b = &p->blocks[next];
+		int ret;
+
+		thread_lock_acquire(&p->lock);
+		while (!p->num_full && !p->reader_done)
+			thread_cond_wait(&p->filled, &p->lock);
+		ret = p->num_full ? 0 : (p->reader_failed ? -1 : 1);
+		thread_lock_release(&p->lock);
+
+		if (ret)
+			return ret < 0 ? -1 : 0;
+
+		ret = writer_feed(w, b->addr, b->data, b->len);
+
+		thread_lock_acquire(&p->lock);
+		p->num_full--;
+		if (ret < 0)
+			p->cancelled = 1;
+		thread_cond_notify(&p->emptied);
+		thread_lock_release(&p->lock);
+
+		if (ret < 0)
+			return -1;
+
+		next ^= 1;
+	}
+}
+
+static int run_pipeline(struct pipeline *p, struct writer *w)
+{
+	thread_t reader;
+	int ret;
+
+	/* If we can't start the reader, read and format in turn */
+	if (thread_create(&reader, reader_thread, p)) {
+		while (p->len) {
+			struct block *b = &p->blocks[0];
+
+			if (read_block(p, b) < 0 ||
+			    writer_feed(w, b->addr, b->data, b->len) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	ret = format_blocks(p, w);
+	thread_join(reader);
+
+	return (ret < 0 || p->reader_failed) ? -1 : 0;
+}
+
+/************************************************************************
+ * Public interface
+ */
+
+int export_format_parse(const char *name, export_format_t *fmt)
+{
+	static const struct {
+		const char		*name;
+		export_format_t		fmt;
+	} formats[] = {
+		{"ihex",	EXPORT_IHEX},
+		{"srec",	EXPORT_SREC},
+		{"titext",	EXPORT_TITEXT},
+		{"raw",		EXPORT_RAW}
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(formats); i++)
+		if (!strcasecmp(name, formats[i].name)) {
+			*fmt = formats[i].fmt;
+			return 0;
+		}
+
+	return -1;
+}
+
+int export_memory(const char *path, address_t addr, address_t len,
+		  export_format_t fmt)
+{
+	struct pipeline *p;
+	struct writer *w;
+	char *fullpath;
+	int ret = -1;
+
+	fullpath = expand_tilde(path);
+	if (!fullpath)
+		return -1;
+
+	p = malloc(sizeof(*p));
+	w = malloc(sizeof(*w));
+	if (!(p && w)) {
+		printc_err("export: can't allocate memory\n");
+		goto out;
+	}
+
+	memset(w, 0, sizeof(*w));
+	w->fmt = fmt;
+	w->addr_bytes = 2;
+	if (len && addr + len - 1 > 0xffff)
+		w->addr_bytes = (addr + len - 1 > 0xffffff) ? 4 : 3;
+
+	w->file = fopen(fullpath, fmt == EXPORT_RAW ? "wb" : "w");
+	if (!w->file) {
+		printc_err("%s: %s\n", path, last_error());
+		goto out;
+	}
+
+	memset(p, 0, sizeof(*p));
+	p->addr = addr;
+	p->len = len;
+	thread_lock_init(&p->lock);
+	thread_cond_init(&p->filled);
+	thread_cond_init(&p->emptied);
+
+	/* Drivers may report errors from the reader thread */
+	output_enable_locking();
+
+	ret = run_pipeline(p, w);
+	if (!ret)
+		ret = writer_finish(w);
+
+	thread_cond_destroy(&p->emptied);
+	thread_cond_destroy(&p->filled);
+	thread_lock_destroy(&p->lock);
+
+	if (fclose(w->file) && !ret) {
+		printc_err("%s: error on close: %s\n", path, last_error());
+		ret = -1;
+	}
+
+	if (ret < 0)
+		unlink(fullpath);
+
+ out:
+	free(fullpath);
+	free(p);
+	free(w);
+	return ret;
+}
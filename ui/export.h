@@ -0,0 +1,49 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef EXPORT_H_
+#define EXPORT_H_
+
+#include "util.h"
+
+/* Streaming export of device memory. One thread reads large blocks
+ * from the device while the caller's thread formats and writes the
+ * previous block, so that long dumps are limited by the speed of the
+ * link rather than by formatting.
+ */
+typedef enum {
+	EXPORT_IHEX,
+	EXPORT_SREC,
+	EXPORT_TITEXT,
+	EXPORT_RAW
+} export_format_t;
+
+/* Look up an output format by name ("ihex", "srec", "titext" or
+ * "raw"). Returns 0 on success or -1 if the name isn't recognised.
+ */
+int export_format_parse(const char *name, export_format_t *fmt);
+
+/* Read the given range of the default device's memory and write it to
+ * a file, replacing any existing file. On failure, the partial file is
+ * removed. Returns 0 on success or -1 if an error occurs.
+ */
+int export_memory(const char *path, address_t addr, address_t len,
+		  export_format_t fmt);
+
+#endif
@@ -28,6 +28,7 @@
 #include "device.h"
 #include "expr.h"
 #include "output_util.h"
+#include "export.h"
 
 enum operation {
 	LOAD,
@@ -86,36 +87,6 @@ static int read_flatfile(const char *path, uint8_t **buf, address_t *len)
 	return 0;
 }
 
-static int write_flatfile(const char *path, uint8_t *buf, address_t len)
-{
-	FILE *out;
-	char *fullpath = expand_tilde(path);
-	const char *errmsg = NULL;
-
-	if (!fullpath)
-		return -1;
-
-	out = fopen(fullpath, "wb");
-	free(fullpath);
-
-	if (!out) {
-		printc_err("%s: %s\n", path, last_error());
-		return -1;
-	}
-
-	if (len && (fwrite(buf, len, 1, out) != 1))
-		errmsg = last_error();
-
-	if (fclose(out) != 0 && !errmsg)
-		errmsg = last_error();
-
-	if (errmsg) {
-		printc_err("%s: failed to write: %s\n", path, errmsg);
-		return -1;
-	}
-	return 0;
-}
-
 static int do_flatfile(enum operation op, const char *path, address_t addr, address_t len)
 {
 	uint8_t *in_buf = NULL;
@@ -135,6 +106,9 @@ static int do_flatfile(enum operation op, const char *path, address_t addr, addr
 	if (op == LOAD) {
 		if (device_writemem(addr, in_buf, len) != 0)
 			goto out;
+	} else if (op == SAVE) {
+		if (export_memory(path, addr, len, EXPORT_RAW) < 0)
+			goto out;
 	} else {
 		out_buf = malloc(len);
 		if (!out_buf) {
@@ -162,8 +136,8 @@ static int do_flatfile(enum operation op, const char *path, address_t addr, addr
 			}
 		}
 		ret = 0;
-	} else if (op == SAVE) {
-		ret = write_flatfile(path, out_buf, len);
+	} else {
+		ret = 0;
 	}
 
 	if (ret == 0)
@@ -0,0 +1,280 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gang.h"
+#include "binfile.h"
+#include "image.h"
+#include "prog.h"
+#include "output.h"
+#include "output_util.h"
+#include "reader.h"
+#include "thread.h"
+#include "util.h"
+
+struct gang_target {
+	device_t		dev;
+	const char		*name;
+};
+
+static struct gang_target targets[GANG_MAX_TARGETS];
+static int num_targets;
+
+int gang_add(device_t dev, const char *name)
+{
+	if (num_targets >= GANG_MAX_TARGETS) {
+		printc_err("gang: too many targets (maximum is %d)\n",
+			   GANG_MAX_TARGETS);
+		return -1;
+	}
+
+	targets[num_targets].dev = dev;
+	targets[num_targets].name = name;
+	num_targets++;
+
+	return 0;
+}
+
+int gang_count(void)
+{
+	return num_targets;
+}
+
+device_t gang_get(int n)
+{
+	return targets[n].dev;
+}
+
+void gang_exit(void)
+{
+	int i;
+
+	for (i = 0; i < num_targets; i++)
+		if (targets[i].dev != device_default)
+			device_destroy_dev(targets[i].dev);
+
+	num_targets = 0;
+}
+
+/************************************************************************
+ * Worker threads
+ */
+
+struct gang_job {
+	const struct gang_target	*target;
+	const struct image		*img;
+	int				flags;
+
+	/* Results, filled in by the worker */
+	int				result;
+	address_t			total;
+	unsigned long long		elapsed_ms;
+};
+
+static int run_job(struct gang_job *job)
+{
+	device_t dev = job->target->dev;
+	struct prog_data prog;
+
+	if (device_ctl_dev(dev, DEVICE_CTL_HALT) < 0)
+		return -1;
+
+	prog_init(&prog, job->flags);
+	prog.dev = dev;
+
+	if (prog_image(&prog, job->img) < 0)
+		return -1;
+
+	job->total = prog.total_written;
+
+	if (device_ctl_dev(dev, DEVICE_CTL_RESET) < 0)
+		printc_err("warning: gang: %s: failed to reset after "
+			   "programming\n", job->target->name);
+
+	return 0;
+}
+
+static void gang_worker(void *user_data)
+{
+	struct gang_job *job = (struct gang_job *)user_data;
+	unsigned long long start = time_ms();
+
+	job->result = run_job(job);
+	job->elapsed_ms = time_ms() - start;
+}
+
+static void show_report(const struct gang_job *jobs,
+			unsigned long long elapsed_ms)
+{
+	int passed = 0;
+	int i;
+
+	printc("\n");
+	printc("    %-3s %-20s %-16s %-6s %10s %9s\n",
+	       "#", "Target", "Chip", "Result", "Bytes", "Time");
+
+	for (i = 0; i < num_targets; i++) {
+		const struct gang_job *j = &jobs[i];
+		const struct chipinfo *chip = j->target->dev->chip;
+
+		printc("    %-3d %-20s %-16s %s%-6s\x1b[0m %10u "
+		       "%5llu.%03llu\n",
+		       i, j->target->name, chip ? chip->name : "(unknown)",
+		       j->result < 0 ? "\x1b[1m" : "",
+		       j->result < 0 ? "FAIL" : "PASS",
+		       j->total, j->elapsed_ms / 1000, j->elapsed_ms % 1000);
+
+		if (!j->result)
+			passed++;
+	}
+
+	printc("\n%d of %d targets passed in %llu.%03llu s\n",
+	       passed, num_targets, elapsed_ms / 1000, elapsed_ms % 1000);
+}
+
+static int do_gang_prog(char **arg, int flags)
+{
+	const char *path_arg = get_arg(arg);
+	struct gang_job jobs[GANG_MAX_TARGETS];
+	thread_t threads[GANG_MAX_TARGETS];
+	const struct image *img;
+	unsigned long long start;
+	char *path;
+	int ret = 0;
+	int i;
+
+	if (!path_arg) {
+		printc_err("gang: you need to specify a filename\n");
+		return -1;
+	}
+
+	if ((flags & PROG_WANT_ERASE) && prompt_abort(MODIFY_SYMS))
+		return 0;
+
+	path = expand_tilde(path_arg);
+	if (!path)
+		return -1;
+
+	img = image_load(path);
+	if (!img) {
+		free(path);
+		return -1;
+	}
+
+	if ((flags & PROG_WANT_ERASE) && (img->info & BINFILE_HAS_SYMS))
+		image_load_syms(img);
+	free(path);
+
+	printc("%s %d targets with %u bytes in %d segments...\n",
+	       (flags & PROG_VERIFY) ? "Verifying" : "Programming",
+	       num_targets, img->total, img->num_segs);
+
+	output_enable_locking();
+	start = time_ms();
+
+	for (i = 0; i < num_targets; i++) {
+		struct gang_job *j = &jobs[i];
+
+		memset(j, 0, sizeof(*j));
+		j->target = &targets[i];
+		j->img = img;
+		j->flags = flags;
+		j->result = -1;
+	}
+
+	/* If thread creation fails, the remaining targets are
+	 * programmed serially from this thread.
+	 */
+	for (i = 0; i < num_targets; i++)
+		if (thread_create(&threads[i], gang_worker, &jobs[i]))
+			break;
+
+	if (i < num_targets) {
+		int j;
+
+		printc_err("gang: can't create worker thread, continuing "
+			   "serially\n");
+		for (j = i; j < num_targets; j++)
+			gang_worker(&jobs[j]);
+	}
+
+	while (i > 0)
+		thread_join(threads[--i]);
+
+	show_report(jobs, time_ms() - start);
+
+	for (i = 0; i < num_targets; i++)
+		if (jobs[i].result < 0)
+			ret = -1;
+
+	image_release(img);
+
+	if (!ret && (flags & PROG_WANT_ERASE))
+		unmark_modified(MODIFY_SYMS);
+
+	return ret;
+}
+
+static int gang_list(void)
+{
+	int i;
+
+	if (!num_targets) {
+		printc("No gang targets. Use --gang to open several "
+		       "devices.\n");
+		return 0;
+	}
+
+	for (i = 0; i < num_targets; i++) {
+		const struct chipinfo *chip = targets[i].dev->chip;
+
+		printc("    %-3d %-20s %s%s\n", i, targets[i].name,
+		       chip ? chip->name : "(unknown)",
+		       targets[i].dev == device_default ? " [default]" : "");
+	}
+
+	return 0;
+}
+
+int cmd_gang(char **arg)
+{
+	const char *op = get_arg(arg);
+
+	if (!op || !strcasecmp(op, "list"))
+		return gang_list();
+
+	if (!num_targets) {
+		printc_err("gang: no targets are open\n");
+		return -1;
+	}
+
+	if (!strcasecmp(op, "prog"))
+		return do_gang_prog(arg, prog_erase_flags());
+
+	if (!strcasecmp(op, "load"))
+		return do_gang_prog(arg, 0);
+
+	if (!strcasecmp(op, "verify"))
+		return do_gang_prog(arg, PROG_VERIFY);
+
+	printc_err("gang: unknown operation: %s\n", op);
+	return -1;
+}
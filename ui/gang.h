@@ -0,0 +1,49 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GANG_H_
+#define GANG_H_
+
+#include "device.h"
+
+/* Gang programming. A gang is a set of devices, each opened with the
+ * same driver, which are programmed in parallel with the same image.
+ * The default device is normally the first member of the gang.
+ */
+#define GANG_MAX_TARGETS	32
+
+/* Add an open device to the gang. The name is used only for reporting,
+ * and must remain valid for the life of the gang. Returns 0 on success
+ * or -1 if the gang is full.
+ */
+int gang_add(device_t dev, const char *name);
+
+/* Number of devices in the gang. */
+int gang_count(void);
+
+/* Retrieve the nth device in the gang. */
+device_t gang_get(int n);
+
+/* Destroy all gang members except the default device, which is left
+ * for the caller to destroy.
+ */
+void gang_exit(void);
+
+int cmd_gang(char **arg);
+
+#endif
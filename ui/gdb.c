@@ -34,19 +34,49 @@
 #include "expr.h"
 #include "gdb_proto.h"
 #include "ctrlc.h"
+#include "chipinfo.h"
 
-static int register_bytes;
+/* The first client to connect controls the target. While it's
+ * connected, one further client may connect as a read-only monitor,
+ * which may inspect the target while it's stopped but not modify or
+ * resume it.
+ */
+#define GDB_CONTROL		0
+#define GDB_MONITOR		1
+#define GDB_MAX_CLIENTS		2
+
+struct gdb_client {
+	struct gdb_data		data;
+	int			connected;
+	int			register_bytes;
+};
+
+static struct gdb_client clients[GDB_MAX_CLIENTS];
+
+/* Set when the controlling client asks for non-stop mode. Resume
+ * requests are then acknowledged immediately, and stops are reported
+ * with asynchronous notifications.
+ */
+static int non_stop;
+
+/* The target has been resumed, and a stop reply is still owed to the
+ * controlling client.
+ */
+static int target_running;
 
 /************************************************************************
  * GDB server
  */
 
-static int read_registers(struct gdb_data *data)
+static int read_registers(struct gdb_client *cl)
 {
+	struct gdb_data *data = &cl->data;
 	address_t regs[DEVICE_NUM_REGS];
 	int i;
 
+#ifdef DEBUG_GDB
 	printc("Reading registers\n");
+#endif
 	if (device_getregs(regs) < 0)
 		return gdb_send(data, "E00");
 
@@ -56,7 +86,7 @@ static int read_registers(struct gdb_data *data)
 		address_t value = regs[i];
 		int j;
 
-		for (j = 0; j < register_bytes; j++) {
+		for (j = 0; j < cl->register_bytes; j++) {
 			gdb_printf(data, "%02x", value & 0xff);
 			value >>= 8;
 		}
@@ -95,7 +125,6 @@ static int monitor_command(struct gdb_data *data, char *buf)
 {
 	char cmd[128];
 	int len = 0;
-	int i;
 	struct monitor_buf mbuf;
 
 	while (len + 1 < sizeof(cmd) && *buf && buf[1]) {
@@ -119,8 +148,7 @@ static int monitor_command(struct gdb_data *data, char *buf)
 		return gdb_send(data, "OK");
 
 	gdb_packet_start(data);
-	for (i = 0; i < mbuf.len; i++)
-		gdb_printf(data, "%02x", mbuf.buf[i]);
+	gdb_hex(data, (const uint8_t *)mbuf.buf, mbuf.len);
 	gdb_packet_end(data);
 
 	return gdb_flush_ack(data);
@@ -140,7 +168,9 @@ static int write_registers(struct gdb_data *data, char *buf)
 		return gdb_send(data, "E00");
 	}
 
+#ifdef DEBUG_GDB
 	printc("Writing registers (%d bits each)\n", nibbles * 4);
+#endif
 	for (int i = 0; i < DEVICE_NUM_REGS; i++) {
 		uint32_t r = 0;
 
@@ -162,7 +192,6 @@ static int read_memory(struct gdb_data *data, char *text)
 	char *length_text = strchr(text, ',');
 	address_t length, addr;
 	uint8_t buf[GDB_MAX_XFER];
-	int i;
 
 	if (!length_text) {
 		printc_err("gdb: malformed memory read request\n");
@@ -177,14 +206,11 @@ static int read_memory(struct gdb_data *data, char *text)
 	if (length > sizeof(buf))
 		length = sizeof(buf);
 
-	printc("Reading %4d bytes from 0x%04x\n", length, addr);
-
 	if (device_readmem(addr, buf, length) < 0)
 		return gdb_send(data, "E00");
 
 	gdb_packet_start(data);
-	for (i = 0; i < length; i++)
-		gdb_printf(data, "%02x", buf[i]);
+	gdb_hex(data, buf, length);
 	gdb_packet_end(data);
 
 	return gdb_flush_ack(data);
@@ -220,7 +246,9 @@ static int write_memory(struct gdb_data *data, char *text)
 		return gdb_send(data, "E00");
 	}
 
+#ifdef DEBUG_GDB
 	printc("Writing %4d bytes to 0x%04x\n", length, addr);
+#endif
 
 	if (device_writemem(addr, buf, buflen) < 0)
 		return gdb_send(data, "E00");
@@ -228,6 +256,49 @@ static int write_memory(struct gdb_data *data, char *text)
 	return gdb_send(data, "OK");
 }
 
+/* Binary memory write: "Xaddr,length:data", with '}' escapes in the
+ * data. GDB probes for support with a zero-length write.
+ */
+static int write_memory_binary(struct gdb_data *data, char *text, int len)
+{
+	char *data_text = memchr(text, ':', len);
+	char *length_text;
+	address_t length, addr;
+	int buflen;
+
+	if (data_text)
+		*(data_text++) = 0;
+
+	length_text = strchr(text, ',');
+	if (!(data_text && length_text)) {
+		printc_err("gdb: malformed memory write request\n");
+		return gdb_send(data, "E00");
+	}
+
+	*(length_text++) = 0;
+
+	length = strtoul(length_text, NULL, 16);
+	addr = strtoul(text, NULL, 16);
+	buflen = gdb_unescape(data_text, len - (data_text - text));
+
+	if (buflen != length) {
+		printc_err("gdb: length mismatch\n");
+		return gdb_send(data, "E00");
+	}
+
+	if (!length)
+		return gdb_send(data, "OK");
+
+#ifdef DEBUG_GDB
+	printc("Writing %4d bytes to 0x%04x\n", length, addr);
+#endif
+
+	if (device_writemem(addr, (const uint8_t *)data_text, buflen) < 0)
+		return gdb_send(data, "E00");
+
+	return gdb_send(data, "OK");
+}
+
 static int run_set_pc(char *buf)
 {
 	address_t regs[DEVICE_NUM_REGS];
@@ -242,17 +313,28 @@ static int run_set_pc(char *buf)
 	return device_setregs(regs);
 }
 
-static int run_final_status(struct gdb_data *data)
+/* Send a stop reply describing the current state of the target. In
+ * non-stop mode, this may be sent as an asynchronous notification.
+ */
+static int send_stop(struct gdb_client *cl, int sig, int notify)
 {
+	struct gdb_data *data = &cl->data;
 	address_t regs[DEVICE_NUM_REGS];
+	int have_regs = device_getregs(regs) >= 0;
 	int i;
 
-	if (device_getregs(regs) < 0)
+	if (!have_regs && !notify)
 		return gdb_send(data, "E00");
 
-	gdb_packet_start(data);
-	gdb_printf(data, "T05");
-	for (i = 0; i < 16; i++) {
+	if (notify) {
+		gdb_notify_start(data);
+		gdb_printf(data, "Stop:");
+	} else {
+		gdb_packet_start(data);
+	}
+
+	gdb_printf(data, "T%02x", sig);
+	for (i = 0; have_regs && i < 16; i++) {
 		address_t value = regs[i];
 		int j;
 
@@ -260,68 +342,139 @@ static int run_final_status(struct gdb_data *data)
 		 *       register. It complains if we give the full data.
 		 */
 		gdb_printf(data, "%02x:", i);
-		for (j = 0; j < register_bytes; j++) {
+		for (j = 0; j < cl->register_bytes; j++) {
 			gdb_printf(data, "%02x", value & 0xff);
 			value >>= 8;
 		}
 		gdb_printf(data, ";");
 	}
+
+	if (non_stop)
+		gdb_printf(data, "thread:1;");
+
 	gdb_packet_end(data);
 
-	return gdb_flush_ack(data);
+	return notify ? gdb_flush(data) : gdb_flush_ack(data);
 }
 
-static int single_step(struct gdb_data *data, char *buf)
+static int halt_reason(struct gdb_client *cl)
 {
-	printc("Single stepping\n");
+	if (target_running)
+		return gdb_send(&cl->data, non_stop ? "OK" : "E01");
+
+	return send_stop(cl, 5, 0);
+}
+
+/* Halt the running target and send the owed stop reply to the
+ * controlling client.
+ */
+static int report_stop(int sig)
+{
+	struct gdb_client *cl = &clients[GDB_CONTROL];
+
+	target_running = 0;
+
+	if (device_ctl(DEVICE_CTL_HALT) < 0 && !non_stop)
+		return gdb_send(&cl->data, "E00");
+
+	return send_stop(cl, sig, non_stop);
+}
+
+/* Check on the running target. Returns -1 if the controlling client
+ * couldn't be sent a reply.
+ */
+static int poll_target(void)
+{
+	switch (device_poll()) {
+	case DEVICE_STATUS_ERROR:
+		target_running = 0;
+		if (non_stop)
+			return send_stop(&clients[GDB_CONTROL], 5, 1);
+		return gdb_send(&clients[GDB_CONTROL].data, "E00");
+
+	case DEVICE_STATUS_HALTED:
+		printc("Target halted\n");
+		return report_stop(5);
+
+	case DEVICE_STATUS_INTR:
+		return report_stop(5);
 
+	default:
+		return 0;
+	}
+}
+
+static int single_step(struct gdb_client *cl, char *buf)
+{
+	printc("Single stepping\n");
 	if (run_set_pc(buf) < 0 ||
 	    device_ctl(DEVICE_CTL_STEP) < 0)
-		gdb_send(data, "E00");
+		return gdb_send(&cl->data, "E00");
+
+	if (!non_stop)
+		return send_stop(cl, 5, 0);
+
+	if (gdb_send(&cl->data, "OK") < 0)
+		return -1;
 
-	return run_final_status(data);
+	return send_stop(cl, 5, 1);
 }
 
-static int run(struct gdb_data *data, char *buf)
+/* Resume the target. The stop reply is sent by poll_target() when it
+ * halts, so that other clients are serviced in the meantime.
+ */
+static int run(struct gdb_client *cl, char *buf)
 {
 	printc("Running\n");
-
 	if (run_set_pc(buf) < 0 ||
 	    device_ctl(DEVICE_CTL_RUN) < 0)
-		return gdb_send(data, "E00");
+		return gdb_send(&cl->data, "E00");
 
-	for (;;) {
-		device_status_t status = device_poll();
+	target_running = 1;
+	return non_stop ? gdb_send(&cl->data, "OK") : 0;
+}
 
-		if (status == DEVICE_STATUS_ERROR)
-			return gdb_send(data, "E00");
+static int stop_thread(struct gdb_client *cl)
+{
+	if (target_running) {
+		target_running = 0;
+		if (device_ctl(DEVICE_CTL_HALT) < 0)
+			return gdb_send(&cl->data, "E00");
+	}
 
-		if (status == DEVICE_STATUS_HALTED) {
-			printc("Target halted\n");
-			goto out;
-		}
+	if (gdb_send(&cl->data, "OK") < 0)
+		return -1;
 
-		if (status == DEVICE_STATUS_INTR)
-			goto out;
+	return send_stop(cl, 0, 1);
+}
 
-		while (gdb_peek(data, 0)) {
-			int c = gdb_getc(data);
+/* Only the first action of a vCont packet is honoured, since there's
+ * only one thread.
+ */
+static int vcont(struct gdb_client *cl, char *buf)
+{
+	if (*buf == '?')
+		return gdb_send(&cl->data, "vCont;c;C;s;S;t");
 
-			if (c < 0)
-				return -1;
+	if (*(buf++) != ';')
+		return gdb_send(&cl->data, "");
 
-			if (c == 3) {
-				printc("Interrupted by gdb\n");
-				goto out;
-			}
-		}
-	}
+	switch (*buf) {
+	case 'c':
+	case 'C':
+		return run(cl, "");
 
- out:
-	if (device_ctl(DEVICE_CTL_HALT) < 0)
-		return gdb_send(data, "E00");
+	case 's':
+	case 'S':
+		return single_step(cl, "");
 
-	return run_final_status(data);
+	case 't':
+		if (non_stop)
+			return stop_thread(cl);
+		break;
+	}
+
+	return gdb_send(&cl->data, "E00");
 }
 
 static int set_breakpoint(struct gdb_data *data, int enable, char *buf)
@@ -403,22 +556,280 @@ static int gdb_send_empty_threadlist(struct gdb_data *data)
 	return gdb_send(data, "<?xml version=\"1.0\"?><threads></threads>");
 }
 
+static int gdb_send_threadlist(struct gdb_data *data)
+{
+	if (non_stop)
+		return gdb_send(data, "m1");
+
+	return gdb_send_empty_threadlist(data);
+}
+
 static int gdb_send_supported(struct gdb_data *data)
 {
 	gdb_packet_start(data);
-	gdb_printf(data, "PacketSize=%x", GDB_MAX_XFER * 2);
+	gdb_printf(data, "PacketSize=%x;QNonStop+;QStartNoAckMode+",
+		   GDB_MAX_XFER * 2);
+	if (device_default->chip)
+		gdb_printf(data, ";qXfer:memory-map:read+");
 	gdb_packet_end(data);
 	return gdb_flush_ack(data);
 }
 
-static int process_gdb_command(struct gdb_data *data, char *buf)
+/************************************************************************
+ * Memory map and flash programming
+ */
+
+#define MEMORY_MAP_SIZE		4096
+
+static int region_cmp(const void *a, const void *b)
+{
+	const struct chipinfo_memory *x =
+		*(const struct chipinfo_memory **)a;
+	const struct chipinfo_memory *y =
+		*(const struct chipinfo_memory **)b;
+
+	if (x->offset < y->offset)
+		return -1;
+	if (x->offset > y->offset)
+		return 1;
+
+	return 0;
+}
+
+/* Flash is reported as such (so that GDB uses the vFlash packets to
+ * load it) only if we know how to erase it. FRAM is written like RAM.
+ */
+static const char *region_type(const struct chipinfo_memory *m)
+{
+	switch (m->type) {
+	case CHIPINFO_MEMTYPE_FLASH:
+		if (m->seg_size && !device_is_fram(device_default))
+			return "flash";
+		return "ram";
+
+	case CHIPINFO_MEMTYPE_ROM:
+		return "rom";
+
+	default:
+		return "ram";
+	}
+}
+
+static int build_memory_map(char *out, int max)
+{
+	const struct chipinfo *chip = device_default->chip;
+	const struct chipinfo_memory *regions[CHIPINFO_MAX_MEMORY];
+	address_t end = 0;
+	int count = 0;
+	int len;
+	int i;
+
+	for (i = 0; i < CHIPINFO_MAX_MEMORY && chip->memory[i].name; i++) {
+		const struct chipinfo_memory *m = &chip->memory[i];
+
+		if (m->mapped && m->size)
+			regions[count++] = m;
+	}
+
+	qsort(regions, count, sizeof(regions[0]), region_cmp);
+
+	len = snprintf(out, max,
+		"<?xml version=\"1.0\"?>"
+		"<!DOCTYPE memory-map PUBLIC "
+		"\"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+		"\"http://sourceware.org/gdb/gdb-memory-map.dtd\">"
+		"<memory-map>");
+
+	for (i = 0; i < count && len < max; i++) {
+		const struct chipinfo_memory *m = regions[i];
+		const char *type = region_type(m);
+
+		/* GDB rejects overlapping regions */
+		if (m->offset < end)
+			continue;
+
+		end = m->offset + m->size;
+		len += snprintf(out + len, max - len,
+			"<memory type=\"%s\" start=\"0x%x\" "
+			"length=\"0x%x\">", type, m->offset, m->size);
+
+		if (len < max && !strcmp(type, "flash"))
+			len += snprintf(out + len, max - len,
+				"<property name=\"blocksize\">0x%x"
+				"</property>", m->seg_size);
+
+		if (len < max)
+			len += snprintf(out + len, max - len, "</memory>");
+	}
+
+	if (len < max)
+		len += snprintf(out + len, max - len, "</memory-map>");
+
+	if (len >= max) {
+		printc_err("gdb: memory map too large\n");
+		return -1;
+	}
+
+	return len;
+}
+
+static int send_memory_map(struct gdb_data *data, char *buf)
+{
+	char map[MEMORY_MAP_SIZE];
+	char *length_text = strchr(buf, ',');
+	address_t offset, length;
+	int map_len;
+
+	if (!device_default->chip || !length_text)
+		return gdb_send(data, "E00");
+
+	offset = strtoul(buf, NULL, 16);
+	length = strtoul(length_text + 1, NULL, 16);
+
+	map_len = build_memory_map(map, sizeof(map));
+	if (map_len < 0)
+		return gdb_send(data, "E00");
+
+	if (offset >= map_len)
+		return gdb_send(data, "l");
+
+	if (length > map_len - offset)
+		length = map_len - offset;
+	if (length > GDB_MAX_XFER)
+		length = GDB_MAX_XFER;
+
+	gdb_packet_start(data);
+	gdb_printf(data, "%c%.*s",
+		   offset + length >= map_len ? 'l' : 'm',
+		   (int)length, map + offset);
+	gdb_packet_end(data);
+
+	return gdb_flush_ack(data);
+}
+
+static int flash_erase(struct gdb_data *data, char *buf)
+{
+	char *length_text = strchr(buf, ',');
+	address_t addr, end;
+
+	if (!length_text) {
+		printc_err("gdb: malformed flash erase request\n");
+		return gdb_send(data, "E00");
+	}
+
+	addr = strtoul(buf, NULL, 16);
+	end = addr + strtoul(length_text + 1, NULL, 16);
+
+	while (addr < end) {
+		const struct chipinfo_memory *m = NULL;
+
+		if (device_default->chip)
+			check_range(device_default->chip, addr, 1, &m);
+
+		if (!m || m->type != CHIPINFO_MEMTYPE_FLASH || !m->seg_size) {
+			printc_err("gdb: can't erase non-flash address "
+				   "0x%04x\n", addr);
+			return gdb_send(data, "E00");
+		}
+
+		addr -= (addr - m->offset) % m->seg_size;
+		if (device_erase(DEVICE_ERASE_SEGMENT, addr) < 0)
+			return gdb_send(data, "E00");
+
+		addr += m->seg_size;
+	}
+
+	return gdb_send(data, "OK");
+}
+
+static int flash_write(struct gdb_data *data, char *buf, int len)
 {
+	char *bin = memchr(buf, ':', len);
+	address_t addr;
+	int bin_len;
+
+	if (!bin) {
+		printc_err("gdb: malformed flash write request\n");
+		return gdb_send(data, "E00");
+	}
+
+	*(bin++) = 0;
+	addr = strtoul(buf, NULL, 16);
+	bin_len = gdb_unescape(bin, len - (bin - buf));
+
+	if (device_writemem(addr, (const uint8_t *)bin, bin_len) < 0)
+		return gdb_send(data, "E00");
+
+	return gdb_send(data, "OK");
+}
+
+/* Packets which the read-only monitor client may send */
+static int is_read_only(const char *buf)
+{
+	switch (buf[0]) {
+	case '?':
+	case 'g':
+	case 'm':
+	case 'H':
+	case 'T':
+	case 'D':
+	case 'k':
+		return 1;
+
+	case 'q':
+		return strncmp(buf, "qRcmd,", 6) != 0;
+
+	case 'Q':
+		return !strcmp(buf, "QStartNoAckMode");
+
+	case 'v':
+		return !strcmp(buf, "vCont?");
+	}
+
+	return 0;
+}
+
+/* Packets which need the target to be stopped */
+static int needs_halt(const char *buf)
+{
+	switch (buf[0]) {
+	case 'g':
+	case 'G':
+	case 'm':
+	case 'M':
+	case 'X':
+	case 'z':
+	case 'Z':
+		return 1;
+
+	case 'q':
+		return !strncmp(buf, "qRcmd,", 6);
+
+	case 'v':
+		return !strncmp(buf, "vFlash", 6);
+	}
+
+	return 0;
+}
+
+static int process_gdb_command(struct gdb_client *cl, char *buf, int len)
+{
+	struct gdb_data *data = &cl->data;
+
 #ifdef DEBUG_GDB
 	printc("process_gdb_command: %s\n", buf);
 #endif
+	if (cl != &clients[GDB_CONTROL] && !is_read_only(buf)) {
+		printc_err("gdb: monitor client may not send: %.32s\n", buf);
+		return gdb_send(data, "E01");
+	}
+
+	if (target_running && needs_halt(buf))
+		return gdb_send(data, "E01");
+
 	switch (buf[0]) {
 	case '?': /* Return target halt reason */
-		return run_final_status(data);
+		return halt_reason(cl);
 
 	case 'z':
 	case 'Z':
@@ -429,11 +840,15 @@ static int process_gdb_command(struct gdb_data *data, char *buf)
 		return restart_program(data);
 
 	case 'g': /* Read registers */
-		return read_registers(data);
+		return read_registers(cl);
 
 	case 'G': /* Write registers */
 		return write_registers(data, buf + 1);
 
+	case 'H': /* Set thread */
+	case 'T': /* Thread alive */
+		return gdb_send(data, "OK");
+
 	case 'q': /* Query */
 		if (!strncmp(buf, "qRcmd,", 6))
 			return monitor_command(data, buf + 6);
@@ -443,12 +858,43 @@ static int process_gdb_command(struct gdb_data *data, char *buf)
 			 * register fields.
 			 */
 			if (strstr(buf, "multiprocess+"))
-				register_bytes = 4;
+				cl->register_bytes = 4;
 
 			return gdb_send_supported(data);
 		}
 		if (!strncmp(buf, "qfThreadInfo", 12))
-			return gdb_send_empty_threadlist(data);
+			return gdb_send_threadlist(data);
+		if (!strncmp(buf, "qsThreadInfo", 12))
+			return gdb_send(data, "l");
+		if (!strncmp(buf, "qXfer:memory-map:read::", 23))
+			return send_memory_map(data, buf + 23);
+		break;
+
+	case 'Q':
+		if (!strcmp(buf, "QNonStop:0") ||
+		    !strcmp(buf, "QNonStop:1")) {
+			non_stop = buf[9] == '1';
+			return gdb_send(data, "OK");
+		}
+		if (!strcmp(buf, "QStartNoAckMode")) {
+			if (gdb_send(data, "OK") < 0)
+				return -1;
+			data->no_ack = 1;
+			return 0;
+		}
+		break;
+
+	case 'v':
+		if (!strncmp(buf, "vCont", 5))
+			return vcont(cl, buf + 5);
+		if (!strcmp(buf, "vStopped"))
+			return gdb_send(data, "OK");
+		if (!strncmp(buf, "vFlashErase:", 12))
+			return flash_erase(data, buf + 12);
+		if (!strncmp(buf, "vFlashWrite:", 12))
+			return flash_write(data, buf + 12, len - 12);
+		if (!strcmp(buf, "vFlashDone"))
+			return gdb_send(data, "OK");
 		break;
 
 	case 'm': /* Read memory */
@@ -457,11 +903,19 @@ static int process_gdb_command(struct gdb_data *data, char *buf)
 	case 'M': /* Write memory */
 		return write_memory(data, buf + 1);
 
+	case 'X': /* Write memory (binary) */
+		return write_memory_binary(data, buf + 1, len - 1);
+
 	case 'c': /* Continue */
-		return run(data, buf + 1);
+		return run(cl, buf + 1);
 
 	case 's': /* Single step */
-		return single_step(data, buf + 1);
+		return single_step(cl, buf + 1);
+
+	case 'D': /* Detach */
+		gdb_send(data, "OK");
+		return -1;
+
 	case 'k': /* kill */
 		return -1;
 	}
@@ -474,34 +928,20 @@ static int process_gdb_command(struct gdb_data *data, char *buf)
 	return gdb_send(data, "");
 }
 
-static void gdb_reader_loop(struct gdb_data *data)
-{
-	while (!ctrlc_check()) {
-		char buf[GDB_BUF_SIZE];
-		int len = 0;
-
-		len = gdb_read_packet(data, buf);
-		if (len < 0)
-			return;
-		if (len && process_gdb_command(data, buf) < 0)
-			return;
-	}
-}
+/************************************************************************
+ * Connection handling
+ */
 
-static int gdb_server(int port)
+static SOCKET open_listener(int port)
 {
-	int sock;
-	int client;
 	struct sockaddr_in addr;
-	socklen_t len;
+	SOCKET sock;
 	int arg;
-	struct gdb_data data;
-	int i;
 
 	sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (SOCKET_ISERR(sock)) {
 		pr_error("gdb: can't create socket");
-		return -1;
+		return sock;
 	}
 
 	arg = 1;
@@ -516,53 +956,213 @@ static int gdb_server(int port)
 		printc_err("gdb: can't bind to port %d: %s\n",
 			port, last_error());
 		closesocket(sock);
-		return -1;
+		return INVALID_SOCKET;
 	}
 
-	if (listen(sock, 1) < 0) {
+	if (listen(sock, GDB_MAX_CLIENTS) < 0) {
 		pr_error("gdb: can't listen on socket");
 		closesocket(sock);
-		return -1;
+		return INVALID_SOCKET;
 	}
 
-	printc("Bound to port %d. Now waiting for connection...\n", port);
+	return sock;
+}
+
+static void start_session(void)
+{
+	int i;
+
+	non_stop = 0;
+	target_running = 0;
+	/* Put the hardware breakpoint setting into a known state. */
+	printc("Clearing all breakpoints...\n");
+	for (i = 0; i < device_default->max_breakpoints; i++)
+		device_setbrk(device_default, i, 0, 0, 0);
+}
 
-	len = sizeof(addr);
-	client = sockets_accept(sock, (struct sockaddr *)&addr, &len);
-	if (SOCKET_ISERR(client)) {
+static void accept_client(SOCKET listener)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct gdb_client *cl;
+	SOCKET sock;
+	int arg;
+
+	sock = sockets_accept(listener, (struct sockaddr *)&addr, &len);
+	if (SOCKET_ISERR(sock)) {
 		pr_error("gdb: failed to accept connection");
+		return;
+	}
+
+	if (!clients[GDB_CONTROL].connected) {
+		cl = &clients[GDB_CONTROL];
+	} else if (!clients[GDB_MONITOR].connected) {
+		cl = &clients[GDB_MONITOR];
+	} else {
+		printc_err("gdb: rejecting connection from %s:%d: "
+			   "too many clients\n",
+			   inet_ntoa(addr.sin_addr), htons(addr.sin_port));
 		closesocket(sock);
+		return;
+	}
+
+	printc("Client connected from %s:%d%s\n",
+	       inet_ntoa(addr.sin_addr), htons(addr.sin_port),
+	       cl == &clients[GDB_MONITOR] ? " (read-only)" : "");
+
+	/* Acknowledgements and replies are sent separately. Without
+	 * this, each reply is held back until the previous ACK is
+	 * acknowledged.
+	 */
+	arg = 1;
+	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+		       (void *)&arg, sizeof(arg)) < 0)
+		pr_error("gdb: warning: can't disable Nagle's algorithm");
+
+	gdb_init(&cl->data, sock);
+	cl->data.async = 1;
+	cl->connected = 1;
+	cl->register_bytes = 2;
+
+	if (cl == &clients[GDB_CONTROL])
+		start_session();
+}
+
+static void drop_client(struct gdb_client *cl)
+{
+	closesocket(cl->data.sock);
+	cl->connected = 0;
+
+	if (cl != &clients[GDB_CONTROL])
+		return;
+
+	/* Leave the target stopped, as it would be after a synchronous
+	 * run.
+	 */
+	if (target_running) {
+		target_running = 0;
+		device_ctl(DEVICE_CTL_HALT);
+	}
+
+	non_stop = 0;
+}
+
+/* Handle whatever a client has sent. Only complete packets are
+ * processed; a partial one is kept until the rest arrives, so that a
+ * slow client doesn't hold up the others.
+ */
+static int service_client(struct gdb_client *cl)
+{
+	struct gdb_data *data = &cl->data;
+
+	switch (gdb_rx_poll(data)) {
+	case GDB_RX_PACKET:
+		if (data->rx_len &&
+		    process_gdb_command(cl, data->rx_buf, data->rx_len) < 0)
+			return -1;
+		break;
+
+	case GDB_RX_INTR:
+		if (cl == &clients[GDB_CONTROL] && target_running) {
+			printc("Interrupted by gdb\n");
+			return report_stop(5);
+		}
+		break;
+
+	case -1:
 		return -1;
 	}
 
-	closesocket(sock);
-	printc("Client connected from %s:%d\n",
-	       inet_ntoa(addr.sin_addr), htons(addr.sin_port));
+	return 0;
+}
 
-	register_bytes = 2;
-	gdb_init(&data, client);
+static int has_buffered(const struct gdb_client *cl)
+{
+	return cl->data.head != cl->data.tail;
+}
 
-	/* Put the hardware breakpoint setting into a known state. */
-	printc("Clearing all breakpoints...\n");
-	for (i = 0; i < device_default->max_breakpoints; i++)
-		device_setbrk(device_default, i, 0, 0, 0);
+/* Serve clients until the controlling client disconnects (or, if
+ * gdb_loop is set, until interrupted). The listening socket stays
+ * open throughout, so GDB may attach and detach repeatedly.
+ */
+static int gdb_server(SOCKET listener)
+{
+	int ret = 0;
+	int i;
 
-#ifdef DEBUG_GDB
-	printc("starting GDB reader loop...\n");
-#endif
-	gdb_reader_loop(&data);
-#ifdef DEBUG_GDB
-	printc("... reader loop returned\n");
-#endif
-	closesocket(client);
+	while (!ctrlc_check()) {
+		SOCKET socks[GDB_MAX_CLIENTS + 1];
+		struct gdb_client *owner[GDB_MAX_CLIENTS + 1];
+		int ready[GDB_MAX_CLIENTS + 1];
+		int pending[GDB_MAX_CLIENTS + 1];
+		int timeout_ms = -1;
+		int was_connected = clients[GDB_CONTROL].connected;
+		int n = 1;
+
+		if (target_running) {
+			if (poll_target() < 0)
+				drop_client(&clients[GDB_CONTROL]);
+			timeout_ms = 0;
+		}
+
+		socks[0] = listener;
+		owner[0] = NULL;
+		pending[0] = 0;
+
+		for (i = 0; i < GDB_MAX_CLIENTS; i++) {
+			struct gdb_client *cl = &clients[i];
+
+			if (!cl->connected)
+				continue;
+
+			pending[n] = has_buffered(cl);
+			if (pending[n])
+				timeout_ms = 0;
 
-	return data.error ? -1 : 0;
+			socks[n] = cl->data.sock;
+			owner[n++] = cl;
+		}
+
+		if (sockets_wait_readable(socks, n, ready, timeout_ms) < 0) {
+			if (!ctrlc_check()) {
+				pr_error("gdb: wait");
+				ret = -1;
+			}
+			break;
+		}
+
+		for (i = 1; i < n; i++) {
+			struct gdb_client *cl = owner[i];
+
+			if (cl->connected && (ready[i] || pending[i]) &&
+			    service_client(cl) < 0)
+				drop_client(cl);
+		}
+
+		if (ready[0])
+			accept_client(listener);
+
+		if (was_connected && !clients[GDB_CONTROL].connected) {
+			if (!opdb_get_boolean("gdb_loop"))
+				break;
+
+			printc("Waiting for connection...\n");
+		}
+	}
+
+	for (i = 0; i < GDB_MAX_CLIENTS; i++)
+		if (clients[i].connected)
+			drop_client(&clients[i]);
+
+	return ret;
 }
 
 int cmd_gdb(char **arg)
 {
 	char *port_text = get_arg(arg);
 	address_t port = opdb_get_numeric("gdb_default_port");
+	SOCKET listener;
+	int ret;
 
 	if (port_text && expr_eval(port_text, &port) < 0) {
 		printc_err("gdb: can't parse port: %s\n", port_text);
@@ -574,10 +1174,13 @@ int cmd_gdb(char **arg)
 		return -1;
 	}
 
-	do {
-		if (gdb_server(port) < 0)
-			return -1;
-	} while (opdb_get_boolean("gdb_loop"));
+	listener = open_listener(port);
+	if (SOCKET_ISERR(listener))
+		return -1;
 
-	return 0;
+	printc("Bound to port %d. Now waiting for connection...\n", port);
+	ret = gdb_server(listener);
+	closesocket(listener);
+
+	return ret;
 }
@@ -191,6 +191,21 @@ static rl_compentry_func_t *complete_erase(char **arg, const char *line, int sta
 		return complete_addrcmd(arg, line, start);
 }
 
+static char *export_format_generator(const char *text, int state)
+{
+	const char *formats[] = { "ihex", "srec", "titext", "raw", NULL };
+	return array_generator(text, state, formats);
+}
+
+static rl_compentry_func_t *complete_export(char **arg, const char *line, int start)
+{
+	const char *format = get_arg(arg);
+	if (format == NULL || format == line + start)
+		return export_format_generator;
+	else
+		return complete_addrcmd(arg, line, start);
+}
+
 static rl_compentry_func_t *complete_help(char **arg, const char *line, int start)
 {
 	const char *topic = get_arg(arg);
@@ -274,6 +289,7 @@ static const struct cmd_completer cmd_completers[] = {
 	{ "cgraph",     complete_addrcmd },
 	{ "dis",        complete_addrcmd },
 	{ "erase",	complete_erase },
+	{ "export",     complete_export },
 	{ "fill",       complete_addrcmd },
 	{ "help",       complete_help },
 	{ "hexout",     complete_addrcmd },
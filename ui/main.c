@@ -59,6 +59,7 @@
 #include "rom_bsl.h"
 #include "chipinfo.h"
 #include "mehfet.h"
+#include "gang.h"
 
 #ifdef __CYGWIN__
 #include <sys/cygwin.h>
@@ -72,6 +73,10 @@ struct cmdline_args {
 	const char		*alt_config;
 	int			flags;
 	struct device_args	devarg;
+
+	/* Gang targets: serial numbers, or tty paths if -d is given */
+	const char		*gang[GANG_MAX_TARGETS];
+	int			gang_count;
 };
 
 static const struct device_class *const driver_table[] = {
@@ -162,6 +167,13 @@ static void usage(const char *progname)
 "        On some host (say RaspberryPi) defines a GPIO pin# to be used as DTR\n"
 "    --bsl-entry-password <hex string>\n"
 "        Use the given hex byte string as a BSL entry password.\n"
+"    --bsl-baud <rate>\n"
+"        Raise the serial baud rate after connecting to a flash BSL.\n"
+"    --gang <serial|device>\n"
+"        Open a device as a gang programming target. This option may be\n"
+"        given more than once, and the first target becomes the default\n"
+"        device. The argument is a serial number, or a tty device if -d\n"
+"        is also given.\n"
 "\n"
 "Most drivers connect by default via USB, unless told otherwise via the\n"
 "-d option. By default, the first USB device found is opened.\n"
@@ -309,6 +321,8 @@ static int parse_cmdline_args(int argc, char **argv,
 		LOPT_BSL_GPIO_RTS,
 		LOPT_BSL_GPIO_DTR,
 		LOPT_BSL_ENTRY_PASSWORD,
+		LOPT_BSL_BAUD,
+		LOPT_GANG,
 	};
 
 	static const struct option longopts[] = {
@@ -327,6 +341,8 @@ static int parse_cmdline_args(int argc, char **argv,
 		{"bsl-gpio-rts",	1, 0, LOPT_BSL_GPIO_RTS},
 		{"bsl-gpio-dtr",	1, 0, LOPT_BSL_GPIO_DTR},
 		{"bsl-entry-password",  1, 0, LOPT_BSL_ENTRY_PASSWORD},
+		{"bsl-baud",		1, 0, LOPT_BSL_BAUD},
+		{"gang",		1, 0, LOPT_GANG},
 		{NULL, 0, 0, 0}
 	};
 
@@ -374,10 +390,23 @@ static int parse_cmdline_args(int argc, char **argv,
 			args->devarg.bsl_gpio_dtr = atoi ( optarg );
 			break;
 
+		case LOPT_BSL_BAUD:
+			args->devarg.bsl_baud_rate = atoi(optarg);
+			break;
+
 		case LOPT_EMBEDDED:
 			args->flags |= OPT_EMBEDDED;
 			break;
 
+		case LOPT_GANG:
+			if (args->gang_count >= GANG_MAX_TARGETS) {
+				printc_err("Too many gang targets (maximum "
+					   "is %d).\n", GANG_MAX_TARGETS);
+				return -1;
+			}
+			args->gang[args->gang_count++] = optarg;
+			break;
+
 		case LOPT_ALLOW_FW_UPDATE:
 			args->devarg.flags |= DEVICE_FLAG_DO_FWUPDATE;
 			break;
@@ -482,6 +511,47 @@ static int parse_cmdline_args(int argc, char **argv,
 	return 0;
 }
 
+/* Open every gang target with the same driver and options, differing
+ * only in the selected serial number or tty device. The first target
+ * becomes the default device.
+ */
+static int setup_gang(const struct device_class *drv,
+		      struct cmdline_args *args)
+{
+	int i;
+
+	for (i = 0; i < args->gang_count; i++) {
+		struct device_args devarg = args->devarg;
+		device_t dev;
+
+		if (devarg.flags & DEVICE_FLAG_TTY)
+			devarg.path = args->gang[i];
+		else
+			devarg.requested_serial = args->gang[i];
+
+		printc("Opening gang target %d: %s\n", i, args->gang[i]);
+		dev = drv->open(&devarg);
+		if (!dev) {
+			printc_err("gang: failed to open %s\n", args->gang[i]);
+			goto fail;
+		}
+
+		gang_add(dev, args->gang[i]);
+		if (!i)
+			device_default = dev;
+	}
+
+	return 0;
+
+fail:
+	gang_exit();
+	if (device_default)
+		device_destroy();
+	device_default = NULL;
+	stab_exit();
+	return -1;
+}
+
 int setup_driver(struct cmdline_args *args)
 {
 	int i;
@@ -499,6 +569,9 @@ int setup_driver(struct cmdline_args *args)
 	if (stab_init() < 0)
 		return -1;
 
+	if (args->gang_count)
+		return setup_gang(driver_table[i], args);
+
 	device_default = driver_table[i]->open(&args->devarg);
 	if (!device_default) {
 		stab_exit();
@@ -534,6 +607,7 @@ int main(int argc, char **argv)
 {
 	struct cmdline_args args = {0};
 	int ret = 0;
+	int i;
 
 	setvbuf(stderr, NULL, _IOFBF, 0);
 	setvbuf(stdout, NULL, _IOFBF, 0);
@@ -573,6 +647,12 @@ int main(int argc, char **argv)
 	if (device_probe_id(device_default, args.devarg.forced_chip_id) < 0)
 		printc_err("warning: device ID probe failed\n");
 
+	for (i = 1; i < gang_count(); i++)
+		if (device_probe_id(gang_get(i),
+				    args.devarg.forced_chip_id) < 0)
+			printc_err("warning: gang: device ID probe failed "
+				   "for %s\n", args.gang[i]);
+
 	if (!(args.flags & OPT_NO_RC))
 		process_rc_file(args.alt_config);
 
@@ -589,6 +669,7 @@ int main(int argc, char **argv)
 	}
 
 	simio_exit();
+	gang_exit();
 	device_destroy();
 	stab_exit();
 fail_driver:
@@ -27,29 +27,37 @@
 #include "device.h"
 #include "power.h"
 #include "powerbuf.h"
+#include "opdb.h"
+
+/* Number of samples read from a stream at a time */
+#define READ_CHUNK	1024
 
 static void print_header(powerbuf_t pb, unsigned int s)
 {
-	unsigned int length;
-	const struct powerbuf_session *rec =
-		powerbuf_session_info(pb, s, &length);
+	struct powerbuf_stream_info info;
+
+	powerbuf_stream_info(pb, s, &info);
 
-	printc("Session #%d: %s", s, ctime(&rec->wall_clock));
-	printc("%d samples (spanning %.03f ms)\n",
-		length, (double)(length * pb->interval_us) / 1000.0);
+	printc("Session #%d: %s", s, ctime(&info.wall_clock));
+	printc("%llu samples (spanning %.03f ms)\n",
+		info.length,
+		(double)info.length * pb->interval_us / 1000.0);
 	printc("%.01f uA average (%.01f uAs total charge)\n",
-		(double)rec->total_ua / (double)length,
-		(double)(rec->total_ua * pb->interval_us) / 1000000.0);
+		(double)info.total_ua / (double)info.length,
+		(double)info.total_ua * pb->interval_us / 1000000.0);
 }
 
-static void dump_session_data(powerbuf_t pb, unsigned int s,
-			      unsigned int gran)
+static int dump_session_data(powerbuf_t pb, unsigned int s,
+			     unsigned int gran)
 {
-	unsigned int length;
-	const struct powerbuf_session *rec =
-		powerbuf_session_info(pb, s, &length);
-	unsigned int i;
-	int idx;
+	unsigned int current_ua[READ_CHUNK];
+	address_t mab[READ_CHUNK];
+	struct powerbuf_stream *st;
+	unsigned long long time_us = 0;
+	unsigned long ua_tot = 0;
+	address_t group_mab = 0;
+	unsigned int group = 0;
+	int n;
 
 	print_header(pb, s);
 	printc("\n");
@@ -57,33 +65,49 @@ static void dump_session_data(powerbuf_t pb, unsigned int s,
 	printc("%15s %15s %-15s\n", "Time (us)", "Current (uA)", "MAB");
 	printc("------------------------------------------------\n");
 
-	idx = rec->start_index;
+	st = powerbuf_stream_open(pb, s);
+	if (!st)
+		return -1;
 
-	for (i = 0; i + gran <= length; i += gran) {
-		address_t mab = pb->mab[idx];
-		unsigned long ua_tot = 0;
-		char addr[128];
-		int j;
+	while ((n = powerbuf_stream_read(st, current_ua, mab,
+					 READ_CHUNK)) > 0) {
+		int i;
 
-		for (j = 0; j < gran; j++) {
-			ua_tot += pb->current_ua[idx];
-			idx = (idx + 1) % pb->max_samples;
-		}
+		for (i = 0; i < n; i++) {
+			char addr[128];
+
+			if (!group)
+				group_mab = mab[i];
 
-		print_address(mab, addr, sizeof(addr), 0);
-		printc("%15d %15.01f %s\n", i * pb->interval_us,
-			((double)ua_tot) / (double)gran, addr);
+			ua_tot += current_ua[i];
+			if (++group < gran)
+				continue;
+
+			print_address(group_mab, addr, sizeof(addr), 0);
+			printc("%15llu %15.01f %s\n", time_us,
+				((double)ua_tot) / (double)gran, addr);
+
+			time_us += (unsigned long long)gran * pb->interval_us;
+			ua_tot = 0;
+			group = 0;
+		}
 	}
 
+	powerbuf_stream_close(st);
 	printc("\n");
+
+	return n;
 }
 
 static int sc_info(powerbuf_t pb)
 {
-	int sess_num = powerbuf_num_sessions(pb);
+	const char *spill = powerbuf_spill_path(pb);
+	int sess_num = powerbuf_stream_sessions(pb);
 	int i;
 
 	printc("Sample granularity is %d us\n", pb->interval_us);
+	if (spill)
+		printc("Spilling samples to %s\n", spill);
 	printc("%d sessions:\n", sess_num);
 
 	for (i = sess_num - 1; i >= 0; i--) {
@@ -131,8 +155,9 @@ static int sc_all(powerbuf_t pb, char **arg)
 	if (parse_granularity(pb, arg, &gran) < 0)
 		return -1;
 
-	for (i = powerbuf_num_sessions(pb) - 1; i >= 0; i--)
-		dump_session_data(pb, i, gran);
+	for (i = powerbuf_stream_sessions(pb) - 1; i >= 0; i--)
+		if (dump_session_data(pb, i, gran) < 0)
+			return -1;
 
 	return 0;
 }
@@ -149,7 +174,7 @@ static int sc_session(powerbuf_t pb, char **arg)
 	}
 
 	sess = atoi(sess_text);
-	if (sess < 0 || sess >= powerbuf_num_sessions(pb)) {
+	if (sess < 0 || sess >= powerbuf_stream_sessions(pb)) {
 		printc_err("power: invalid session: %d\n", sess);
 		return -1;
 	}
@@ -157,19 +182,20 @@ static int sc_session(powerbuf_t pb, char **arg)
 	if (parse_granularity(pb, arg, &gran) < 0)
 		return -1;
 
-	dump_session_data(pb, sess, gran);
-	return 0;
+	return dump_session_data(pb, sess, gran);
 }
 
 static int sc_export_csv(powerbuf_t pb, char **arg)
 {
 	const char *sess_text = get_arg(arg);
 	const char *filename = get_arg(arg);
-	unsigned int length;
-	const struct powerbuf_session *rec;
+	unsigned int current_ua[READ_CHUNK];
+	address_t mab[READ_CHUNK];
+	struct powerbuf_stream *st;
+	unsigned long long count = 0;
 	FILE *out;
 	int sess;
-	unsigned int i;
+	int n;
 
 	if (!(sess_text && filename)) {
 		printc_err("power: expected a session number and filename\n");
@@ -177,13 +203,11 @@ static int sc_export_csv(powerbuf_t pb, char **arg)
 	}
 
 	sess = atoi(sess_text);
-	if (sess < 0 || sess >= powerbuf_num_sessions(pb)) {
+	if (sess < 0 || sess >= powerbuf_stream_sessions(pb)) {
 		printc_err("power: invalid session: %d\n", sess);
 		return -1;
 	}
 
-	rec = powerbuf_session_info(pb, sess, &length);
-
 	out = fopen(filename, "w");
 	if (!out) {
 		printc_err("power: can't open %s: %s\n",
@@ -191,27 +215,76 @@ static int sc_export_csv(powerbuf_t pb, char **arg)
 		return -1;
 	}
 
-	for (i = 0; i < length; i++) {
-		const unsigned int idx =
-			(rec->start_index + i) % pb->max_samples;
+	st = powerbuf_stream_open(pb, sess);
+	if (!st) {
+		fclose(out);
+		return -1;
+	}
 
-		if (fprintf(out, "%15d,%15d, 0x%05x\n",
-			    i * pb->interval_us,
-			    pb->current_ua[idx], pb->mab[idx]) < 0) {
-			printc_err("power: write error: %s: %s\n",
-				   filename, last_error());
-			fclose(out);
-			return -1;
-		}
+	while ((n = powerbuf_stream_read(st, current_ua, mab,
+					 READ_CHUNK)) > 0) {
+		int i;
+
+		for (i = 0; i < n; i++, count++)
+			if (fprintf(out, "%15llu,%15d, 0x%05x\n",
+				    count * pb->interval_us,
+				    current_ua[i], mab[i]) < 0) {
+				printc_err("power: write error: %s: %s\n",
+					   filename, last_error());
+				n = -1;
+				break;
+			}
+
+		if (n < 0)
+			break;
 	}
 
+	powerbuf_stream_close(st);
+
 	if (fclose(out) < 0) {
 		printc_err("power: error on close of %s: %s\n",
 			    filename, last_error());
 		return -1;
 	}
 
-	printc("Exported %d samples to %s\n", length, filename);
+	if (n < 0)
+		return -1;
+
+	printc("Exported %llu samples to %s\n", count, filename);
+	return 0;
+}
+
+static int sc_export_bin(powerbuf_t pb, char **arg)
+{
+	const char *filename = get_arg(arg);
+
+	if (!filename) {
+		printc_err("power: expected a filename\n");
+		return -1;
+	}
+
+	if (powerbuf_export(pb, filename) < 0)
+		return -1;
+
+	printc("Exported %d sessions to %s\n",
+	       powerbuf_stream_sessions(pb), filename);
+	return 0;
+}
+
+static int sc_import_bin(powerbuf_t pb, char **arg)
+{
+	const char *filename = get_arg(arg);
+
+	if (!filename) {
+		printc_err("power: expected a filename\n");
+		return -1;
+	}
+
+	if (powerbuf_import(pb, filename) < 0)
+		return -1;
+
+	printc("Imported %d sessions from %s\n",
+	       powerbuf_stream_sessions(pb), filename);
 	return 0;
 }
 
@@ -219,7 +292,7 @@ struct profile_rec {
 	char			name[64];
 	address_t		addr;
 	unsigned long long	charge;
-	int			samples;
+	unsigned long long	samples;
 };
 
 static int add_symbol(void *user_data, const char *name, address_t offset)
@@ -237,37 +310,32 @@ static int add_symbol(void *user_data, const char *name, address_t offset)
 	return vector_push(v, &rec, 1);
 }
 
-static void merge_power(struct vector *list, powerbuf_t pb)
+/* Charge the samples for a MAB to the last symbol at or below it. The
+ * list must be sorted by address.
+ */
+static void add_power(void *user_data, address_t mab, unsigned int samples,
+		      unsigned long long sum_ua)
 {
-	int num_samples =
-		(pb->current_head + pb->max_samples - pb->current_tail) %
-			pb->max_samples;
-	int dst = 0;
-	int src = 0;
-
-	/* Skip samples that don't match any known symbol */
-	while ((dst < list->size) && (src < num_samples) &&
-	       (pb->mab[pb->sorted[src]] <
-		VECTOR_PTR(*list, dst, struct profile_rec)->addr))
-		src++;
-
-	while ((dst < list->size) && (src < num_samples)) {
-		address_t mab = pb->mab[pb->sorted[src]];
-		unsigned int ua = pb->current_ua[pb->sorted[src]];
-
-		if ((dst + 1 < list->size) &&
-		    (VECTOR_PTR(*list, dst + 1,
-				struct profile_rec)->addr <= mab)) {
-			dst++;
-		} else {
-			struct profile_rec *r =
-				VECTOR_PTR(*list, dst, struct profile_rec);
-
-			r->charge += ua;
-			r->samples++;
-			src++;
-		}
+	struct vector *list = (struct vector *)user_data;
+	struct profile_rec *r;
+	int lo = 0;
+	int hi = list->size;
+
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (VECTOR_PTR(*list, mid, struct profile_rec)->addr <= mab)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+
+	if (!lo)
+		return;
+
+	r = VECTOR_PTR(*list, lo - 1, struct profile_rec);
+	r->charge += sum_ua;
+	r->samples += samples;
 }
 
 static int cmp_by_addr(const void *a, const void *b)
@@ -334,8 +402,7 @@ static int sc_profile(powerbuf_t pb)
 
 	/* Merge in power profile samples */
 	qsort(list.ptr, list.size, list.elemsize, cmp_by_addr);
-	powerbuf_sort(pb);
-	merge_power(&list, pb);
+	powerbuf_enum_by_mab(pb, add_power, &list);
 
 	/* Prepare and print profile */
 	qsort(list.ptr, list.size, list.elemsize, cmp_by_charge_rev);
@@ -345,6 +412,260 @@ static int sc_profile(powerbuf_t pb)
 	return 0;
 }
 
+static int sc_spill(powerbuf_t pb, char **arg)
+{
+	const char *path = get_arg(arg);
+
+	if (!path) {
+		const char *cur = powerbuf_spill_path(pb);
+
+		if (cur)
+			printc("Spilling samples to %s\n", cur);
+		else
+			printc("Spill mode is off\n");
+
+		return 0;
+	}
+
+	if (!strcasecmp(path, "off")) {
+		powerbuf_spill_stop(pb);
+		return 0;
+	}
+
+	if (powerbuf_spill_start(pb, path) < 0)
+		return -1;
+
+	printc("Spilling samples to %s\n", path);
+	return 0;
+}
+
+/************************************************************************
+ * Live profile, shown while the target runs
+ */
+
+/* Interval between refreshes of the live table */
+#define LIVE_REFRESH_MS		1000
+
+/* Size of the MAB to symbol cache (must be a power of two) */
+#define LIVE_CACHE_SIZE		1024
+
+struct live_rec {
+	unsigned long long	charge;
+	unsigned long long	samples;
+	unsigned long long	total_charge;
+};
+
+struct live_cache_ent {
+	address_t		mab;
+	int			sym;
+};
+
+static struct {
+	powerbuf_t		pb;
+	int			top;
+
+	/* Symbols sorted by address, and a parallel array of records. The
+	 * record one past the last symbol collects samples which aren't
+	 * covered by any symbol.
+	 */
+	struct vector		syms;
+	struct live_rec		*recs;
+	int			*order;
+
+	struct live_cache_ent	cache[LIVE_CACHE_SIZE];
+
+	unsigned long long	seq;
+	unsigned long long	lost;
+	unsigned long long	start_ms;
+	unsigned long long	last_ms;
+} live;
+
+static int live_lookup(address_t mab)
+{
+	struct live_cache_ent *c =
+		&live.cache[(mab * 2654435761u) & (LIVE_CACHE_SIZE - 1)];
+	int lo = 0;
+	int hi = live.syms.size;
+
+	if (c->mab == mab)
+		return c->sym;
+
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (VECTOR_PTR(live.syms, mid, struct profile_rec)->addr <= mab)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	c->mab = mab;
+	c->sym = lo ? lo - 1 : live.syms.size;
+
+	return c->sym;
+}
+
+static int cmp_live_rev(const void *a, const void *b)
+{
+	const struct live_rec *ra = &live.recs[*(const int *)a];
+	const struct live_rec *rb = &live.recs[*(const int *)b];
+
+	if (ra->charge < rb->charge)
+		return 1;
+	if (ra->charge > rb->charge)
+		return -1;
+	if (ra->total_charge < rb->total_charge)
+		return 1;
+	if (ra->total_charge > rb->total_charge)
+		return -1;
+
+	return 0;
+}
+
+static void live_print(unsigned long long now)
+{
+	const int n = live.syms.size + 1;
+	const unsigned int interval_us = live.pb->interval_us;
+	unsigned long long charge = 0;
+	unsigned long long samples = 0;
+	int shown = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		charge += live.recs[i].charge;
+		samples += live.recs[i].samples;
+		live.order[i] = i;
+	}
+
+	if (!samples)
+		return;
+
+	qsort(live.order, n, sizeof(live.order[0]), cmp_live_rev);
+
+	printc("\nLive profile at %.01f s: %.01f uA average",
+	       (double)(now - live.start_ms) / 1000.0,
+	       samples ? (double)charge / (double)samples : 0.0);
+	if (live.lost)
+		printc(" (%llu samples lost)", live.lost);
+	printc("\n");
+
+	printc("%-23s %15s %15s %8s %15s\n",
+	       "Name", "Charge (uAs)", "Current (uA)", "Time (%)",
+	       "Total (uAs)");
+	printc("---------------------------------------"
+	       "-----------------------------------------\n");
+
+	for (i = 0; i < n && shown < live.top; i++) {
+		const int k = live.order[i];
+		struct live_rec *r = &live.recs[k];
+
+		if (!r->samples)
+			break;
+
+		printc("%-23s %15.01f %15.01f %8.01f %15.01f\n",
+		       k < live.syms.size ?
+		       VECTOR_PTR(live.syms, k, struct profile_rec)->name :
+		       "(unknown)",
+		       (double)(r->charge * interval_us) / 1000000.0,
+		       (double)r->charge / (double)r->samples,
+		       (double)r->samples * 100.0 / (double)samples,
+		       (double)(r->total_charge * interval_us) / 1000000.0);
+		shown++;
+	}
+
+	for (i = 0; i < n; i++) {
+		live.recs[i].charge = 0;
+		live.recs[i].samples = 0;
+	}
+}
+
+int power_live_begin(void)
+{
+	powerbuf_t pb = device_default->power_buf;
+	const int top = opdb_get_numeric("power_live");
+	int i;
+
+	if (!pb || top <= 0)
+		return 0;
+
+	live.pb = pb;
+	live.top = top;
+
+	vector_init(&live.syms, sizeof(struct profile_rec));
+	if (stab_enum(add_symbol, &live.syms) < 0)
+		goto fail;
+
+	qsort(live.syms.ptr, live.syms.size, live.syms.elemsize,
+	      cmp_by_addr);
+
+	live.recs = calloc(live.syms.size + 1, sizeof(live.recs[0]));
+	live.order = malloc((live.syms.size + 1) * sizeof(live.order[0]));
+	if (!live.recs || !live.order)
+		goto fail;
+
+	for (i = 0; i < LIVE_CACHE_SIZE; i++)
+		live.cache[i].mab = POWERBUF_MAB_NONE;
+
+	live.seq = pb->total_samples;
+	live.lost = 0;
+	live.start_ms = live.last_ms = time_ms();
+
+	return 0;
+
+fail:
+	printc_err("power: can't start live profile: out of memory\n");
+	vector_destroy(&live.syms);
+	free(live.recs);
+	free(live.order);
+	live.recs = NULL;
+	live.order = NULL;
+	live.pb = NULL;
+	return -1;
+}
+
+void power_live_poll(void)
+{
+	unsigned int current_ua[READ_CHUNK];
+	address_t mab[READ_CHUNK];
+	unsigned long long now;
+	unsigned int n;
+
+	if (!live.pb)
+		return;
+
+	while ((n = powerbuf_read_since(live.pb, &live.seq, &live.lost,
+					current_ua, mab, READ_CHUNK)) > 0) {
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			struct live_rec *r = &live.recs[live_lookup(mab[i])];
+
+			r->charge += current_ua[i];
+			r->samples++;
+			r->total_charge += current_ua[i];
+		}
+	}
+
+	now = time_ms();
+	if (now - live.last_ms >= LIVE_REFRESH_MS) {
+		live_print(now);
+		live.last_ms = now;
+	}
+}
+
+void power_live_end(void)
+{
+	if (!live.pb)
+		return;
+
+	vector_destroy(&live.syms);
+	free(live.recs);
+	free(live.order);
+	live.recs = NULL;
+	live.order = NULL;
+	live.pb = NULL;
+}
+
 int cmd_power(char **arg)
 {
 	powerbuf_t pb = device_default->power_buf;
@@ -372,8 +693,14 @@ int cmd_power(char **arg)
 		return sc_session(pb, arg);
 	if (!strcasecmp(subcmd, "export-csv"))
 		return sc_export_csv(pb, arg);
+	if (!strcasecmp(subcmd, "export-bin"))
+		return sc_export_bin(pb, arg);
+	if (!strcasecmp(subcmd, "import-bin"))
+		return sc_import_bin(pb, arg);
 	if (!strcasecmp(subcmd, "profile"))
 		return sc_profile(pb);
+	if (!strcasecmp(subcmd, "spill"))
+		return sc_spill(pb, arg);
 
 	printc_err("power: unknown subcommand: %s (try \"help power\")\n",
 		   subcmd);
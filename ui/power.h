@@ -21,4 +21,15 @@
 
 int cmd_power(char **arg);
 
+/* Live profile display. If the "power_live" option is set and the
+ * default device supports power profiling, the run command calls
+ * power_live_poll() as the target runs, and the top functions by
+ * charge are printed once a second.
+ *
+ * power_live_begin() returns -1 if the profile can't be started.
+ */
+int power_live_begin(void);
+void power_live_poll(void);
+void power_live_end(void);
+
 #endif
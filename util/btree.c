@@ -27,6 +27,28 @@
 
 #define MAX_HEIGHT 16
 
+/* Pages are allocated from slabs owned by the tree. The first slab
+ * holds SLAB_MIN_PAGES pages, and each subsequent slab is twice the
+ * size of the last, up to SLAB_MAX_PAGES. Slabs are only released when
+ * the tree is destroyed: clearing a tree returns all of its pages to the
+ * pool, so that a table which is cleared and reloaded reuses memory
+ * which is already mapped. Free pages are kept on a list, linked through
+ * their first word.
+ */
+#define SLAB_MIN_PAGES	4
+#define SLAB_MAX_PAGES	256
+#define PAGE_ALIGN	16
+
+struct btree_slab {
+	struct btree_slab	*next;
+	int			num_pages;
+};
+
+#define SLAB_HEADER_SIZE					\
+	((sizeof(struct btree_slab) + PAGE_ALIGN - 1) & ~(PAGE_ALIGN - 1))
+#define SLAB_PAGE(bt, s, i)					\
+	((void *)(((char *)(s)) + SLAB_HEADER_SIZE + (i) * (bt)->page_size))
+
 /* Btree pages consist of the following: a page header (struct btree_page),
  * followed by a block of memory consisting of:
  *
@@ -36,7 +58,8 @@
  * For a non-leaf node:
  *    An array of N keys, then an array of N struct btree_page *.
  *
- * Where N is the branch factor.
+ * Where N is the branch factor. All pages are the same size, large
+ * enough for either kind of node.
  */
 struct btree_page {
 	int                     height;
@@ -64,6 +87,12 @@ struct btree {
 
 	struct btree_page       *path[MAX_HEIGHT];
 	int                     slot[MAX_HEIGHT];
+
+	/* Page pool */
+	size_t                  page_size;
+	struct btree_slab       *slabs;
+	void                    *free_pages;
+	int                     next_slab_pages;
 };
 
 /************************************************************************
@@ -126,40 +155,75 @@ static void check_btree(btree_t bt)
  * B+Tree auxiliary functions
  */
 
-static void destroy_page(struct btree_page *p)
+static int add_slab(btree_t bt)
 {
-	if (!p)
-		return;
+	struct btree_slab *s;
+	int i;
+
+	s = malloc(SLAB_HEADER_SIZE + bt->next_slab_pages * bt->page_size);
+	if (!s)
+		return -1;
+
+	s->num_pages = bt->next_slab_pages;
+	s->next = bt->slabs;
+	bt->slabs = s;
+
+	for (i = s->num_pages - 1; i >= 0; i--) {
+		void **page = SLAB_PAGE(bt, s, i);
+
+		*page = bt->free_pages;
+		bt->free_pages = page;
+	}
+
+	if (bt->next_slab_pages < SLAB_MAX_PAGES)
+		bt->next_slab_pages *= 2;
 
-	if (p->height) {
+	return 0;
+}
+
+/* Return every page of every slab to the free list */
+static void reset_pool(btree_t bt)
+{
+	struct btree_slab *s;
+
+	bt->free_pages = NULL;
+
+	for (s = bt->slabs; s; s = s->next) {
 		int i;
 
-		for (i = 0; i < p->num_children; i++)
-			destroy_page(*PAGE_PTR(p, i));
+		for (i = s->num_pages - 1; i >= 0; i--) {
+			void **page = SLAB_PAGE(bt, s, i);
+
+			*page = bt->free_pages;
+			bt->free_pages = page;
+		}
 	}
+}
+
+static void free_pool(btree_t bt)
+{
+	while (bt->slabs) {
+		struct btree_slab *s = bt->slabs;
 
-	free(p);
+		bt->slabs = s->next;
+		free(s);
+	}
 }
 
 static struct btree_page *allocate_page(btree_t bt, int height)
 {
-	const struct btree_def *def = bt->def;
 	struct btree_page *p;
-	int size = sizeof(*p) + def->key_size * def->branches;
 
-	if (height)
-		size += sizeof(struct btree_page *) * def->branches;
-	else
-		size += sizeof(def->data_size) * def->branches;
-
-	p = malloc(size);
-	if (!p) {
+	if (!bt->free_pages && add_slab(bt) < 0) {
 		printc_err("btree: couldn't allocate page: %s\n",
 			   last_error());
 		return NULL;
 	}
 
-	memset(p, 0, size);
+	p = bt->free_pages;
+	bt->free_pages = *(void **)p;
+
+	memset(p, 0, bt->page_size);
 	p->def = bt->def;
 	p->owner = bt;
 	p->height = height;
@@ -167,6 +231,12 @@ static struct btree_page *allocate_page(btree_t bt, int height)
 	return p;
 }
 
+static void free_page(btree_t bt, struct btree_page *p)
+{
+	*(void **)p = bt->free_pages;
+	bt->free_pages = p;
+}
+
 static void split_page(struct btree_page *op, struct btree_page *np)
 {
 	const struct btree_def *def = op->def;
@@ -427,6 +497,7 @@ static void cursor_next(btree_t bt)
 btree_t btree_alloc(const struct btree_def *def)
 {
 	btree_t bt;
+	size_t item_size;
 
 	if (def->branches < 2 || (def->branches & 1)) {
 		printc_err("btree: invalid branch count: %d\n",
@@ -445,6 +516,15 @@ btree_t btree_alloc(const struct btree_def *def)
 	bt->def = def;
 	bt->slot[0] = -1;
 
+	item_size = def->data_size;
+	if (item_size < sizeof(struct btree_page *))
+		item_size = sizeof(struct btree_page *);
+
+	bt->page_size = sizeof(struct btree_page) +
+		(def->key_size + item_size) * def->branches;
+	bt->page_size = (bt->page_size + PAGE_ALIGN - 1) & ~(PAGE_ALIGN - 1);
+	bt->next_slab_pages = SLAB_MIN_PAGES;
+
 	bt->root = allocate_page(bt, 0);
 	if (!bt->root) {
 		printc_err("btree: couldn't allocate root node: %s\n",
@@ -459,38 +539,158 @@ btree_t btree_alloc(const struct btree_def *def)
 void btree_free(btree_t bt)
 {
 	check_btree(bt);
-	destroy_page(bt->root);
+	free_pool(bt);
 	free(bt);
 }
 
+/* Empty the tree without examining it. The slabs are kept, so
+ * allocating the new root can't fail.
+ */
+static void reset_tree(btree_t bt)
+{
+	bt->slot[0] = -1;
+	reset_pool(bt);
+
+	bt->root = allocate_page(bt, 0);
+	assert (bt->root);
+}
+
 void btree_clear(btree_t bt)
 {
-	struct btree_page *p;
-	struct btree_page *path_up = 0;
+	check_btree(bt);
+	reset_tree(bt);
+}
+
+/* Number of items in page i of n, when count items are spread over a
+ * level. Pages are filled completely, except that if the last page
+ * would be less than half full, the last two share what's left.
+ */
+static int bulk_page_size(int count, int n, int branches, int i)
+{
+	const int rem = count - (n - 1) * branches;
+
+	if (n < 2 || rem >= branches / 2 || i < n - 2)
+		return i < n - 1 ? branches : rem;
+
+	if (i == n - 2)
+		return (branches + rem) / 2;
+
+	return branches + rem - (branches + rem) / 2;
+}
+
+int btree_bulk_load(btree_t bt, const void *keys, const void *data,
+		    int count)
+{
+	const struct btree_def *def = bt->def;
+	struct btree_page **level = NULL;
+	int n = count;
+	int h;
+	int i;
 
 	check_btree(bt);
+	reset_tree(bt);
 
-	/* The cursor will have nothing to point to after this. */
-	bt->slot[0] = -1;
+	for (i = 1; i < count; i++)
+		if (def->compare((const char *)keys + (i - 1) * def->key_size,
+				 (const char *)keys + i * def->key_size) >= 0) {
+			printc_err("btree: bulk load keys are out of "
+				   "order\n");
+			return -1;
+		}
 
-	/* First, find the last leaf node, which we can re-use as an
-	 * empty root.
-	 */
-	p = bt->root;
-	while (p->height) {
-		path_up = p;
-		p = *PAGE_PTR(p, p->num_children - 1);
+	if (!count)
+		return 0;
+
+	if (count <= def->branches) {
+		memcpy(PAGE_KEY(bt->root, 0), keys, count * def->key_size);
+		if (def->data_size)
+			memcpy(PAGE_DATA(bt->root, 0), data,
+			       count * def->data_size);
+
+		bt->root->num_children = count;
+		return 0;
 	}
 
-	/* Unlink it from the tree and then destroy everything else. */
-	if (path_up) {
-		path_up->num_children--;
-		destroy_page(bt->root);
+	/* Build each level from the one below, until a level fits in a
+	 * single page.
+	 */
+	free_page(bt, bt->root);
+
+	for (h = 0; n > 1; h++) {
+		const int np = (n + def->branches - 1) / def->branches;
+		struct btree_page **next;
+		int pos = 0;
+
+		if (h >= MAX_HEIGHT) {
+			printc_err("btree: maximum height exceeded\n");
+			goto fail;
+		}
+
+		next = malloc(sizeof(next[0]) * np);
+		if (!next) {
+			printc_err("btree: couldn't allocate memory: %s\n",
+				   last_error());
+			goto fail;
+		}
+
+		for (i = 0; i < np; i++) {
+			const int c = bulk_page_size(n, np, def->branches, i);
+			struct btree_page *p = allocate_page(bt, h);
+			int j;
+
+			if (!p) {
+				free(next);
+				goto fail;
+			}
+
+			if (h) {
+				for (j = 0; j < c; j++) {
+					struct btree_page *child =
+						level[pos + j];
+
+					memcpy(PAGE_KEY(p, j),
+					       PAGE_KEY(child, 0),
+					       def->key_size);
+					*PAGE_PTR(p, j) = child;
+				}
+			} else {
+				memcpy(PAGE_KEY(p, 0),
+				       (const char *)keys +
+				       pos * def->key_size,
+				       c * def->key_size);
+				if (def->data_size)
+					memcpy(PAGE_DATA(p, 0),
+					       (const char *)data +
+					       pos * def->data_size,
+					       c * def->data_size);
+			}
+
+			p->num_children = c;
+			next[i] = p;
+			pos += c;
+		}
+
+		/* The leftmost key of each non-leaf level must be no
+		 * greater than any key which might later be inserted.
+		 */
+		if (h)
+			memcpy(PAGE_KEY(next[0], 0), def->zero,
+			       def->key_size);
+
+		free(level);
+		level = next;
+		n = np;
 	}
 
-	/* Clear it out and make it the new root */
-	p->num_children = 0;
-	bt->root = p;
+	bt->root = level[0];
+	free(level);
+	check_btree(bt);
+	return 0;
+
+ fail:
+	free(level);
+	reset_tree(bt);
+	return -1;
 }
 
 int btree_put(btree_t bt, const void *key, const void *data)
@@ -615,7 +815,7 @@ int btree_put(btree_t bt, const void *key, const void *data)
  fail:
 	for (h = 0; h <= bt->root->height; h++)
 		if (path_new[h])
-			free(path_new[h]);
+			free_page(bt, path_new[h]);
 	return -1;
 }
 
@@ -674,7 +874,7 @@ int btree_delete(btree_t bt, const void *key)
 
 			merge_pages(d, c);
 			delete_item(p, s);
-			free(c);
+			free_page(bt, c);
 		} else {
 			/* Borrow/merge from higher page */
 			struct btree_page *d = *PAGE_PTR(p, s + 1);
@@ -689,7 +889,7 @@ int btree_delete(btree_t bt, const void *key)
 
 			merge_pages(c, d);
 			delete_item(p, s + 1);
-			free(d);
+			free_page(bt, d);
 		}
 
 		if (p->num_children >= halfsize)
@@ -703,7 +903,7 @@ int btree_delete(btree_t bt, const void *key)
 		struct btree_page *old = bt->root;
 
 		bt->root = *PAGE_PTR(old, 0);
-		free(old);
+		free_page(bt, old);
 	}
 
 	return 0;
@@ -735,11 +935,9 @@ int btree_get(btree_t bt, const void *key, void *data)
 	return 1;
 }
 
-int btree_select(btree_t bt, const void *key, btree_selmode_t mode,
-		 void *key_ret, void *data_ret)
+int btree_select_ptr(btree_t bt, const void *key, btree_selmode_t mode,
+		     const void **key_ret, void **data_ret)
 {
-	const struct btree_def *def = bt->def;
-
 	check_btree(bt);
 
 	switch (mode) {
@@ -769,15 +967,29 @@ int btree_select(btree_t bt, const void *key, btree_selmode_t mode,
 	/* Return the data at the cursor */
 	if (bt->slot[0] >= 0) {
 		if (key_ret)
-			memcpy(key_ret,
-			       PAGE_KEY(bt->path[0], bt->slot[0]),
-			       def->key_size);
+			*key_ret = PAGE_KEY(bt->path[0], bt->slot[0]);
 		if (data_ret)
-			memcpy(data_ret,
-			       PAGE_DATA(bt->path[0], bt->slot[0]),
-			       def->data_size);
+			*data_ret = PAGE_DATA(bt->path[0], bt->slot[0]);
 		return 0;
 	}
 
 	return 1;
 }
+
+int btree_select(btree_t bt, const void *key, btree_selmode_t mode,
+		 void *key_ret, void *data_ret)
+{
+	const struct btree_def *def = bt->def;
+	const void *k;
+	void *d;
+
+	if (btree_select_ptr(bt, key, mode, &k, &d))
+		return 1;
+
+	if (key_ret)
+		memcpy(key_ret, k, def->key_size);
+	if (data_ret)
+		memcpy(data_ret, d, def->data_size);
+
+	return 0;
+}
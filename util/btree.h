@@ -46,6 +46,17 @@ void btree_free(btree_t bt);
 /* Clear all data from a B+Tree */
 void btree_clear(btree_t bt);
 
+/* Replace the contents of a B+Tree with count records. The keys and
+ * data are given as arrays (data may be NULL if the data size is 0),
+ * and the keys must be in strictly ascending order. The tree is built
+ * from the bottom up, with pages filled completely.
+ *
+ * Returns 0 on success or -1 if an error occurs, in which case the
+ * tree is left empty.
+ */
+int btree_bulk_load(btree_t bt, const void *keys, const void *data,
+		    int count);
+
 /* Add or update a record in a B+Tree. Any existing data for the key will
  * be overwritten.
  *
@@ -93,4 +104,11 @@ typedef enum {
 int btree_select(btree_t bt, const void *key, btree_selmode_t mode,
 		 void *key_ret, void *data_ret);
 
+/* As for btree_select(), but return pointers to the key and value of
+ * the selected record, rather than copies. The pointers remain valid
+ * until the tree is next modified.
+ */
+int btree_select_ptr(btree_t bt, const void *key, btree_selmode_t mode,
+		     const void **key_ret, void **data_ret);
+
 #endif
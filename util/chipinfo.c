@@ -17,9 +17,75 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "chipinfo.h"
-#include "../chipinfo.db"
+#include "util.h"
+#include "../chipinfo_pool.db"
+
+/* Chips are indexed by name, and by ID. Chips which match on the whole
+ * of ver_id (in practice, all of them) are held in by_id, sorted by
+ * ver_id and otherwise in database order, so a lookup need only
+ * consider the run with the right ver_id. Any chips with a partial
+ * ver_id mask are kept in database order in loose_id, and are also
+ * checked.
+ *
+ * by_name holds chips sorted by name.
+ *
+ * Both are built on first use.
+ */
+#define NUM_CHIPS	(ARRAY_LEN(chipinfo_db) - 1)
+
+static uint16_t by_id[NUM_CHIPS];
+static int num_by_id;
+static uint16_t loose_id[NUM_CHIPS];
+static int num_loose_id;
+static uint16_t by_name[NUM_CHIPS];
+static int index_ready;
+
+static int id_cmp(const void *a, const void *b)
+{
+	const int ia = *(const uint16_t *)a;
+	const int ib = *(const uint16_t *)b;
+	const int va = chipinfo_db[ia].id.ver_id;
+	const int vb = chipinfo_db[ib].id.ver_id;
+
+	return (va != vb) ? va - vb : ia - ib;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	const int ia = *(const uint16_t *)a;
+	const int ib = *(const uint16_t *)b;
+	const int r = strcasecmp(chipinfo_db[ia].name, chipinfo_db[ib].name);
+
+	return r ? r : ia - ib;
+}
+
+static void build_index(void)
+{
+	int i;
+
+	if (index_ready)
+		return;
+
+	num_by_id = 0;
+	num_loose_id = 0;
+
+	for (i = 0; i < NUM_CHIPS; i++) {
+		if (chipinfo_db[i].id_mask.ver_id == 0xffff)
+			by_id[num_by_id++] = i;
+		else
+			loose_id[num_loose_id++] = i;
+
+		by_name[i] = i;
+	}
+
+	qsort(by_id, num_by_id, sizeof(by_id[0]), id_cmp);
+	qsort(by_name, NUM_CHIPS, sizeof(by_name[0]), name_cmp);
+
+	index_ready = 1;
+}
 
 static int is_match(const struct chipinfo_id *a,
 		    const struct chipinfo_id *b,
@@ -45,22 +111,66 @@ static int is_match(const struct chipinfo_id *a,
 
 const struct chipinfo *chipinfo_find_by_id(const struct chipinfo_id *id)
 {
-	const struct chipinfo *i;
+	int best = NUM_CHIPS;
+	int lo = 0;
+	int hi;
+	int i;
 
-	for (i = chipinfo_db; i->name; i++)
-		if (is_match(&i->id, id, &i->id_mask))
-			return i;
+	build_index();
 
-	return NULL;
+	/* Find the first chip with this ver_id */
+	hi = num_by_id;
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (chipinfo_db[by_id[mid]].id.ver_id < id->ver_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = lo; i < num_by_id &&
+	     chipinfo_db[by_id[i]].id.ver_id == id->ver_id; i++) {
+		const struct chipinfo *c = &chipinfo_db[by_id[i]];
+
+		if (is_match(&c->id, id, &c->id_mask)) {
+			best = by_id[i];
+			break;
+		}
+	}
+
+	/* The first match in database order wins */
+	for (i = 0; i < num_loose_id && loose_id[i] < best; i++) {
+		const struct chipinfo *c = &chipinfo_db[loose_id[i]];
+
+		if (is_match(&c->id, id, &c->id_mask)) {
+			best = loose_id[i];
+			break;
+		}
+	}
+
+	return (best < NUM_CHIPS) ? &chipinfo_db[best] : NULL;
 }
 
 const struct chipinfo *chipinfo_find_by_name(const char *name)
 {
-	const struct chipinfo *i;
+	int lo = 0;
+	int hi = NUM_CHIPS;
+
+	build_index();
+
+	/* Find the first chip whose name is not less than the key */
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (strcasecmp(chipinfo_db[by_name[mid]].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	for (i = chipinfo_db; i->name; i++)
-		if (!strcasecmp(name, i->name))
-			return i;
+	if (lo < NUM_CHIPS && !strcasecmp(chipinfo_db[by_name[lo]].name, name))
+		return &chipinfo_db[by_name[lo]];
 
 	return NULL;
 }
@@ -97,6 +207,71 @@ const struct chipinfo_memory *chipinfo_find_mem_by_addr
 	return best;
 }
 
+static int cmp_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+unsigned int chipinfo_flatten(const struct chipinfo *info,
+			      struct chipinfo_interval *iv)
+{
+	uint32_t bounds[CHIPINFO_MAX_INTERVALS];
+	unsigned int num_bounds = 0;
+	unsigned int n = 0;
+	const struct chipinfo_memory *m;
+	unsigned int i;
+
+	/* The result can only change where a region starts or ends */
+	bounds[num_bounds++] = 0;
+	for (m = info->memory; m->name &&
+	     num_bounds + 2 <= CHIPINFO_MAX_INTERVALS; m++) {
+		if (!m->mapped)
+			continue;
+
+		bounds[num_bounds++] = m->offset;
+		if (m->offset + m->size > m->offset)
+			bounds[num_bounds++] = m->offset + m->size;
+	}
+
+	qsort(bounds, num_bounds, sizeof(bounds[0]), cmp_u32);
+
+	for (i = 0; i < num_bounds; i++) {
+		const struct chipinfo_memory *r =
+			chipinfo_find_mem_by_addr(info, bounds[i]);
+
+		if (n && iv[n - 1].mem == r)
+			continue;
+
+		iv[n].start = bounds[i];
+		iv[n].mem = r;
+		n++;
+	}
+
+	return n;
+}
+
+const struct chipinfo_memory *chipinfo_find_interval
+	(const struct chipinfo_interval *iv, unsigned int n,
+	 uint32_t offset, uint32_t *start, uint32_t *last)
+{
+	const struct chipinfo_interval *end = iv + n;
+
+	/* Find the last interval starting at or below offset */
+	while (n > 1) {
+		const unsigned int half = n / 2;
+
+		iv = (iv[half].start <= offset) ? iv + half : iv;
+		n -= half;
+	}
+
+	*start = iv->start;
+	*last = (iv + 1 < end) ? iv[1].start - 1 : UINT32_MAX;
+	return iv->mem;
+}
+
 const char *chipinfo_copyright(void)
 {
 	return "Chip info database from MSP430.dll v"
@@ -127,6 +127,20 @@ struct chipinfo_memory {
 	unsigned int		banks;
 };
 
+#define CHIPINFO_MAX_MEMORY	16
+
+/* The result of chipinfo_find_mem_by_addr() for every address, as a
+ * sorted list of intervals. Each applies from its start address up to
+ * the start of the next, and the last to the end of the address space.
+ * The first always starts at 0.
+ */
+struct chipinfo_interval {
+	uint32_t			start;
+	const struct chipinfo_memory	*mem;
+};
+
+#define CHIPINFO_MAX_INTERVALS	(CHIPINFO_MAX_MEMORY * 2 + 1)
+
 struct chipinfo_clockmap {
 	const char		*name;
 	uint8_t			value;
@@ -147,10 +161,15 @@ struct chipinfo {
 	struct chipinfo_eem		eem;
 	struct chipinfo_voltage		voltage;
 	struct chipinfo_power		power;
-	struct chipinfo_memory		memory[16];
-	struct chipinfo_clockmap	clock_map[32];
+	/* Tables shared between chips. The memory map is terminated by
+	 * an entry with no name, and holds at most CHIPINFO_MAX_MEMORY
+	 * regions. The clock map always has 32 entries, and the V3
+	 * function map 128.
+	 */
+	const struct chipinfo_memory	*memory;
+	const struct chipinfo_clockmap	*clock_map;
+	const uint8_t			*v3_functions;
 
-	uint8_t				v3_functions[128];
 	const struct chipinfo_funclet	*v3_erase;
 	const struct chipinfo_funclet	*v3_write;
 	const struct chipinfo_funclet	*v3_unlock;
@@ -161,8 +180,26 @@ extern const struct chipinfo chipinfo_db[];
 const struct chipinfo *chipinfo_find_by_id(const struct chipinfo_id *id);
 const struct chipinfo *chipinfo_find_by_name(const char *name);
 
+/* Find the mapped region containing the given address or, failing
+ * that, the lowest region above it.
+ */
 const struct chipinfo_memory *chipinfo_find_mem_by_addr
 	(const struct chipinfo *info, uint32_t offset);
+
+/* Flatten a chip's memory map into the list of intervals over which
+ * chipinfo_find_mem_by_addr() gives the same result. The array must
+ * hold CHIPINFO_MAX_INTERVALS entries. Returns the number used.
+ */
+unsigned int chipinfo_flatten(const struct chipinfo *info,
+			      struct chipinfo_interval *iv);
+
+/* Search a flattened memory map. The region found is returned, along
+ * with the extent (*start to *last inclusive) of the interval holding
+ * the given address.
+ */
+const struct chipinfo_memory *chipinfo_find_interval
+	(const struct chipinfo_interval *iv, unsigned int n,
+	 uint32_t offset, uint32_t *start, uint32_t *last);
 const struct chipinfo_memory *chipinfo_find_mem_by_name
 	(const struct chipinfo *info, const char *name);
 
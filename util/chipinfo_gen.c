@@ -0,0 +1,550 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Chip database converter, run on the build host.
+ *
+ * chipinfo.db, as generated from MSP430.DLL, gives every chip its own
+ * copy of its memory map, clock map and V3 function map. This program
+ * is compiled against chipinfo.db with that layout, and writes out an
+ * equivalent database in which identical tables are shared, for use
+ * with the struct chipinfo declared in chipinfo.h. The licence header
+ * is copied from the original file, which is given as an argument.
+ *
+ * Usage: chipinfo_gen chipinfo.db chipinfo_pool.db
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chipinfo.h"
+
+#define CLOCK_MAP_SIZE		32
+#define V3_FUNCTIONS_SIZE	128
+
+/* Layout of chipinfo.db as generated */
+struct chipinfo_raw {
+	const char			*name;
+
+	unsigned int			bits;
+	chipinfo_psa_t			psa;
+	uint8_t				clock_control;
+	uint32_t			mclk_control;
+	chipinfo_clock_sys_t		clock_sys;
+	chipinfo_features_t		features;
+
+	struct chipinfo_id		id;
+	struct chipinfo_id		id_mask;
+	struct chipinfo_eem		eem;
+	struct chipinfo_voltage		voltage;
+	struct chipinfo_power		power;
+	struct chipinfo_memory		memory[CHIPINFO_MAX_MEMORY];
+	struct chipinfo_clockmap	clock_map[CLOCK_MAP_SIZE];
+
+	uint8_t				v3_functions[V3_FUNCTIONS_SIZE];
+	const struct chipinfo_funclet	*v3_erase;
+	const struct chipinfo_funclet	*v3_write;
+	const struct chipinfo_funclet	*v3_unlock;
+};
+
+#define chipinfo chipinfo_raw
+#define chipinfo_db chipinfo_raw_db
+#include "../chipinfo.db"
+#undef chipinfo
+#undef chipinfo_db
+
+#define MAX_CHIPS		4096
+
+/* Index of each chip's table in the pool of distinct tables */
+static int mem_pool[MAX_CHIPS];
+static int clk_pool[MAX_CHIPS];
+static int v3f_pool[MAX_CHIPS];
+
+/* Distinct funclets, in order of first use */
+static const struct chipinfo_funclet *funclets[MAX_CHIPS * 3];
+static int num_funclets;
+
+static int str_eq(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return !strcmp(a, b);
+}
+
+static int mem_eq(const struct chipinfo_memory *a,
+		  const struct chipinfo_memory *b)
+{
+	for (;;) {
+		if (!str_eq(a->name, b->name))
+			return 0;
+
+		if (!a->name)
+			return 1;
+
+		if (a->type != b->type || a->bits != b->bits ||
+		    a->mapped != b->mapped || a->size != b->size ||
+		    a->offset != b->offset || a->seg_size != b->seg_size ||
+		    a->bank_size != b->bank_size || a->banks != b->banks)
+			return 0;
+
+		a++;
+		b++;
+	}
+}
+
+static int clk_eq(const struct chipinfo_clockmap *a,
+		  const struct chipinfo_clockmap *b)
+{
+	int i;
+
+	for (i = 0; i < CLOCK_MAP_SIZE; i++)
+		if (!str_eq(a[i].name, b[i].name) ||
+		    a[i].value != b[i].value)
+			return 0;
+
+	return 1;
+}
+
+/* Assign each chip's tables to a pool entry, given by the first chip
+ * with identical contents.
+ */
+static void build_pools(int num_chips)
+{
+	int i;
+
+	for (i = 0; i < num_chips; i++) {
+		const struct chipinfo_raw *c = &chipinfo_raw_db[i];
+		const struct chipinfo_funclet *f[3];
+		int j;
+
+		mem_pool[i] = i;
+		clk_pool[i] = i;
+		v3f_pool[i] = i;
+
+		for (j = 0; j < i; j++) {
+			const struct chipinfo_raw *o = &chipinfo_raw_db[j];
+
+			if (mem_pool[i] == i && mem_pool[j] == j &&
+			    mem_eq(c->memory, o->memory))
+				mem_pool[i] = j;
+			if (clk_pool[i] == i && clk_pool[j] == j &&
+			    clk_eq(c->clock_map, o->clock_map))
+				clk_pool[i] = j;
+			if (v3f_pool[i] == i && v3f_pool[j] == j &&
+			    !memcmp(c->v3_functions, o->v3_functions,
+				    V3_FUNCTIONS_SIZE))
+				v3f_pool[i] = j;
+		}
+
+		f[0] = c->v3_erase;
+		f[1] = c->v3_write;
+		f[2] = c->v3_unlock;
+
+		for (j = 0; j < 3; j++) {
+			int k;
+
+			if (!f[j])
+				continue;
+
+			for (k = 0; k < num_funclets; k++)
+				if (funclets[k] == f[j])
+					break;
+
+			if (k == num_funclets)
+				funclets[num_funclets++] = f[j];
+		}
+	}
+}
+
+/* Number of the table assigned to a chip, counting distinct tables
+ * only.
+ */
+static int pool_number(const int *pool, int i)
+{
+	int n = 0;
+	int j;
+
+	for (j = 0; j < pool[i]; j++)
+		if (pool[j] == j)
+			n++;
+
+	return n;
+}
+
+static int funclet_number(const struct chipinfo_funclet *f)
+{
+	int i;
+
+	for (i = 0; i < num_funclets; i++)
+		if (funclets[i] == f)
+			return i;
+
+	return -1;
+}
+
+static void print_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+/* Copy the comment at the top of the original file */
+static int copy_header(const char *path)
+{
+	FILE *in = fopen(path, "r");
+	char buf[256];
+
+	if (!in) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), in)) {
+		fputs(buf, stdout);
+		if (!strncmp(buf, " */", 3))
+			break;
+	}
+
+	fclose(in);
+	return 0;
+}
+
+static void print_funclet(int n)
+{
+	const struct chipinfo_funclet *f = funclets[n];
+	int i;
+
+	printf("static const struct chipinfo_funclet chipinfo_funclet_%d = {\n",
+	       n);
+	printf("\t.code_size\t= %d,\n", f->code_size);
+	printf("\t.max_payload\t= %d,\n", f->max_payload);
+	printf("\t.entry_point\t= 0x%04x,\n", f->entry_point);
+	printf("\t.code\t\t= {");
+	for (i = 0; i < f->code_size; i++)
+		printf("%s0x%04x,", (i & 7) ? " " : "\n\t\t", f->code[i]);
+	printf("\n\t}\n};\n\n");
+}
+
+static const char *memtype_name(chipinfo_memtype_t t)
+{
+	switch (t) {
+	case CHIPINFO_MEMTYPE_ROM: return "CHIPINFO_MEMTYPE_ROM";
+	case CHIPINFO_MEMTYPE_RAM: return "CHIPINFO_MEMTYPE_RAM";
+	case CHIPINFO_MEMTYPE_FLASH: return "CHIPINFO_MEMTYPE_FLASH";
+	case CHIPINFO_MEMTYPE_REGISTER: return "CHIPINFO_MEMTYPE_REGISTER";
+	}
+
+	return NULL;
+}
+
+static void print_memory(int n, const struct chipinfo_memory *m)
+{
+	printf("static const struct chipinfo_memory chipinfo_mem_%d[] = {\n",
+	       n);
+
+	for (; m->name; m++) {
+		printf("\t{\n");
+		printf("\t\t.name\t\t= ");
+		print_string(m->name);
+		printf(",\n");
+		printf("\t\t.type\t\t= %s,\n", memtype_name(m->type));
+		printf("\t\t.bits\t\t= %u,\n", m->bits);
+		printf("\t\t.mapped\t\t= %u,\n", m->mapped);
+		printf("\t\t.size\t\t= %u,\n", m->size);
+		printf("\t\t.offset\t\t= 0x%05x,\n", m->offset);
+		printf("\t\t.seg_size\t= %u,\n", m->seg_size);
+		printf("\t\t.bank_size\t= %u,\n", m->bank_size);
+		printf("\t\t.banks\t\t= %u,\n", m->banks);
+		printf("\t},\n");
+	}
+
+	printf("\t{0}\n};\n\n");
+}
+
+static void print_clock_map(int n, const struct chipinfo_clockmap *c)
+{
+	int i;
+
+	printf("static const struct chipinfo_clockmap "
+	       "chipinfo_clk_%d[%d] = {\n", n, CLOCK_MAP_SIZE);
+
+	for (i = 0; i < CLOCK_MAP_SIZE; i++) {
+		if (!c[i].name) {
+			printf("\t{0},\n");
+			continue;
+		}
+
+		printf("\t{");
+		print_string(c[i].name);
+		printf(", 0x%02x},\n", c[i].value);
+	}
+
+	printf("};\n\n");
+}
+
+static void print_v3_functions(int n, const uint8_t *v)
+{
+	int count = 0;
+	int i;
+
+	printf("static const uint8_t chipinfo_v3f_%d[%d] = {\n",
+	       n, V3_FUNCTIONS_SIZE);
+
+	for (i = 0; i < V3_FUNCTIONS_SIZE; i++)
+		if (v[i]) {
+			printf("\t[0x%02x]\t= 0x%02x,\n", i, v[i]);
+			count++;
+		}
+
+	if (!count)
+		printf("\t0\n");
+
+	printf("};\n\n");
+}
+
+static void print_id(const char *field, const struct chipinfo_id *id)
+{
+	printf("\t\t.%s\t= {\n", field);
+	printf("\t\t\t.ver_id\t\t= 0x%04x,\n", id->ver_id);
+	printf("\t\t\t.ver_sub_id\t= 0x%04x,\n", id->ver_sub_id);
+	printf("\t\t\t.revision\t= 0x%02x,\n", id->revision);
+	printf("\t\t\t.fab\t\t= 0x%02x,\n", id->fab);
+	printf("\t\t\t.self\t\t= 0x%04x,\n", id->self);
+	printf("\t\t\t.config\t\t= 0x%02x,\n", id->config);
+	printf("\t\t\t.fuses\t\t= 0x%02x,\n", id->fuses);
+	printf("\t\t\t.activation_key\t= 0x%08x,\n", id->activation_key);
+	printf("\t\t},\n");
+}
+
+static void print_eem(const struct chipinfo_eem *e)
+{
+	printf("\t\t.eem\t\t= {\n");
+	printf("\t\t\t.state_storage\t\t= 0x%02x,\n", e->state_storage);
+	printf("\t\t\t.cycle_counter\t\t= 0x%02x,\n", e->cycle_counter);
+	printf("\t\t\t.cycle_counter_ops\t= 0x%02x,\n",
+	       e->cycle_counter_ops);
+	printf("\t\t\t.trig_emulation_level\t= 0x%02x,\n",
+	       e->trig_emulation_level);
+	printf("\t\t\t.trig_mem\t\t= 0x%02x,\n", e->trig_mem);
+	printf("\t\t\t.trig_reg\t\t= 0x%02x,\n", e->trig_reg);
+	printf("\t\t\t.trig_combinations\t= 0x%02x,\n",
+	       e->trig_combinations);
+	printf("\t\t\t.trig_options\t\t= 0x%02x,\n", e->trig_options);
+	printf("\t\t\t.trig_dma\t\t= 0x%02x,\n", e->trig_dma);
+	printf("\t\t\t.trig_read_write\t= 0x%02x,\n", e->trig_read_write);
+	printf("\t\t\t.trig_reg_ops\t\t= 0x%02x,\n", e->trig_reg_ops);
+	printf("\t\t\t.trig_comp_level\t= 0x%02x,\n", e->trig_comp_level);
+	printf("\t\t\t.trig_mem_cond_level\t= 0x%02x,\n",
+	       e->trig_mem_cond_level);
+	printf("\t\t\t.trig_mem_umask_level\t= 0x%02x,\n",
+	       e->trig_mem_umask_level);
+	printf("\t\t\t.seq_states\t\t= 0x%02x,\n", e->seq_states);
+	printf("\t\t\t.seq_start\t\t= 0x%02x,\n", e->seq_start);
+	printf("\t\t\t.seq_end\t\t= 0x%02x,\n", e->seq_end);
+	printf("\t\t\t.seq_reset\t\t= 0x%02x,\n", e->seq_reset);
+	printf("\t\t\t.seq_blocked\t\t= 0x%02x,\n", e->seq_blocked);
+	printf("\t\t},\n");
+}
+
+static void print_features(chipinfo_features_t f)
+{
+	static const struct {
+		chipinfo_features_t	bit;
+		const char		*name;
+	} names[] = {
+		{CHIPINFO_FEATURE_I2C,		  "CHIPINFO_FEATURE_I2C"},
+		{CHIPINFO_FEATURE_LCFE,		  "CHIPINFO_FEATURE_LCFE"},
+		{CHIPINFO_FEATURE_QUICK_MEM_READ,
+					"CHIPINFO_FEATURE_QUICK_MEM_READ"},
+		{CHIPINFO_FEATURE_SFLLDH,	  "CHIPINFO_FEATURE_SFLLDH"},
+		{CHIPINFO_FEATURE_FRAM,		  "CHIPINFO_FEATURE_FRAM"},
+		{CHIPINFO_FEATURE_NO_BSL,	  "CHIPINFO_FEATURE_NO_BSL"},
+		{CHIPINFO_FEATURE_TMR,		  "CHIPINFO_FEATURE_TMR"},
+		{CHIPINFO_FEATURE_JTAG,		  "CHIPINFO_FEATURE_JTAG"},
+		{CHIPINFO_FEATURE_DTC,		  "CHIPINFO_FEATURE_DTC"},
+		{CHIPINFO_FEATURE_SYNC,		  "CHIPINFO_FEATURE_SYNC"},
+		{CHIPINFO_FEATURE_INSTR,	  "CHIPINFO_FEATURE_INSTR"},
+		{CHIPINFO_FEATURE_1337,		  "CHIPINFO_FEATURE_1337"},
+		{CHIPINFO_FEATURE_PSACH,	  "CHIPINFO_FEATURE_PSACH"}
+	};
+	unsigned int rest = f;
+	unsigned int i;
+
+	printf("\t\t.features\t= 0");
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (f & names[i].bit) {
+			printf("\n\t\t\t| %s", names[i].name);
+			rest &= ~names[i].bit;
+		}
+
+	if (rest)
+		printf("\n\t\t\t| 0x%04x", rest);
+
+	printf(",\n");
+}
+
+static const char *psa_name(chipinfo_psa_t p)
+{
+	return (p == CHIPINFO_PSA_ENHANCED) ?
+		"CHIPINFO_PSA_ENHANCED" : "CHIPINFO_PSA_REGULAR";
+}
+
+static const char *clock_sys_name(chipinfo_clock_sys_t c)
+{
+	switch (c) {
+	case CHIPINFO_CLOCK_SYS_BC_1XX: return "CHIPINFO_CLOCK_SYS_BC_1XX";
+	case CHIPINFO_CLOCK_SYS_BC_2XX: return "CHIPINFO_CLOCK_SYS_BC_2XX";
+	case CHIPINFO_CLOCK_SYS_FLL_PLUS: return "CHIPINFO_CLOCK_SYS_FLL_PLUS";
+	case CHIPINFO_CLOCK_SYS_MOD_OSC: return "CHIPINFO_CLOCK_SYS_MOD_OSC";
+	}
+
+	return NULL;
+}
+
+static void print_funclet_ref(const char *field,
+			      const struct chipinfo_funclet *f)
+{
+	if (f)
+		printf("\t\t.%s\t= &chipinfo_funclet_%d,\n",
+		       field, funclet_number(f));
+}
+
+static void print_chip(int i)
+{
+	const struct chipinfo_raw *c = &chipinfo_raw_db[i];
+	const struct chipinfo_voltage *v = &c->voltage;
+	const struct chipinfo_power *p = &c->power;
+
+	printf("\t{\n");
+	printf("\t\t.name\t\t= ");
+	print_string(c->name);
+	printf(",\n");
+	printf("\t\t.bits\t\t= %u,\n", c->bits);
+	printf("\t\t.psa\t\t= %s,\n", psa_name(c->psa));
+	printf("\t\t.clock_control\t= 0x%02x,\n", c->clock_control);
+	printf("\t\t.mclk_control\t= 0x%08x,\n", c->mclk_control);
+	printf("\t\t.clock_sys\t= %s,\n", clock_sys_name(c->clock_sys));
+	print_features(c->features);
+	print_id("id", &c->id);
+	print_id("id_mask", &c->id_mask);
+	print_eem(&c->eem);
+
+	printf("\t\t.voltage\t= {\n");
+	printf("\t\t\t.vcc_min\t= %u,\n", v->vcc_min);
+	printf("\t\t\t.vcc_max\t= %u,\n", v->vcc_max);
+	printf("\t\t\t.vcc_flash_min\t= %u,\n", v->vcc_flash_min);
+	printf("\t\t\t.vcc_secure_min\t= %u,\n", v->vcc_secure_min);
+	printf("\t\t\t.vpp_secure_min\t= %u,\n", v->vpp_secure_min);
+	printf("\t\t\t.vpp_secure_max\t= %u,\n", v->vpp_secure_max);
+	printf("\t\t\t.has_test_vpp\t= %u,\n", v->has_test_vpp);
+	printf("\t\t},\n");
+
+	printf("\t\t.power\t\t= {\n");
+	printf("\t\t\t.reg_mask\t\t= 0x%05x,\n", p->reg_mask);
+	printf("\t\t\t.enable_lpm5\t\t= 0x%05x,\n", p->enable_lpm5);
+	printf("\t\t\t.disable_lpm5\t\t= 0x%05x,\n", p->disable_lpm5);
+	printf("\t\t\t.reg_mask_3v\t\t= 0x%05x,\n", p->reg_mask_3v);
+	printf("\t\t\t.enable_lpm5_3v\t\t= 0x%05x,\n", p->enable_lpm5_3v);
+	printf("\t\t\t.disable_lpm5_3v\t= 0x%05x,\n", p->disable_lpm5_3v);
+	printf("\t\t},\n");
+
+	printf("\t\t.memory\t\t= chipinfo_mem_%d,\n",
+	       pool_number(mem_pool, i));
+	printf("\t\t.clock_map\t= chipinfo_clk_%d,\n",
+	       pool_number(clk_pool, i));
+	printf("\t\t.v3_functions\t= chipinfo_v3f_%d,\n",
+	       pool_number(v3f_pool, i));
+	print_funclet_ref("v3_erase", c->v3_erase);
+	print_funclet_ref("v3_write", c->v3_write);
+	print_funclet_ref("v3_unlock", c->v3_unlock);
+	printf("\t},\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	int num_chips = 0;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: chipinfo_gen chipinfo.db "
+			"chipinfo_pool.db\n");
+		return -1;
+	}
+
+	while (chipinfo_raw_db[num_chips].name)
+		num_chips++;
+
+	if (num_chips > MAX_CHIPS) {
+		fprintf(stderr, "chipinfo_gen: too many chips: %d\n",
+			num_chips);
+		return -1;
+	}
+
+	if (!freopen(argv[2], "w", stdout)) {
+		perror(argv[2]);
+		return -1;
+	}
+
+	if (copy_header(argv[1]) < 0) {
+		remove(argv[2]);
+		return -1;
+	}
+
+	printf("\n/* Converted by chipinfo_gen. Do not edit: change "
+	       "chipinfo.db instead. */\n\n");
+	printf("#define CI_DLL430_VERSION_STRING \"%s\"\n\n",
+	       CI_DLL430_VERSION_STRING);
+
+	build_pools(num_chips);
+
+	for (i = 0; i < num_funclets; i++)
+		print_funclet(i);
+
+	for (i = 0; i < num_chips; i++)
+		if (mem_pool[i] == i)
+			print_memory(pool_number(mem_pool, i),
+				     chipinfo_raw_db[i].memory);
+
+	for (i = 0; i < num_chips; i++)
+		if (clk_pool[i] == i)
+			print_clock_map(pool_number(clk_pool, i),
+					chipinfo_raw_db[i].clock_map);
+
+	for (i = 0; i < num_chips; i++)
+		if (v3f_pool[i] == i)
+			print_v3_functions(pool_number(v3f_pool, i),
+					   chipinfo_raw_db[i].v3_functions);
+
+	printf("const struct chipinfo chipinfo_db[] = {\n");
+	for (i = 0; i < num_chips; i++)
+		print_chip(i);
+	printf("\t{0}\n};\n");
+
+	if (fflush(stdout) || ferror(stdout)) {
+		perror(argv[2]);
+		remove(argv[2]);
+		return -1;
+	}
+
+	return 0;
+}
@@ -34,6 +34,10 @@ void gdb_init(struct gdb_data *data, int sock)
 	data->head = 0;
 	data->tail = 0;
 	data->outlen = 0;
+	data->async = 0;
+	data->no_ack = 0;
+	data->lastlen = 0;
+	data->rx_state = 0;
 }
 
 void gdb_printf(struct gdb_data *data, const char *fmt, ...)
@@ -50,6 +54,25 @@ void gdb_printf(struct gdb_data *data, const char *fmt, ...)
 	data->outlen += len;
 }
 
+void gdb_hex(struct gdb_data *data, const uint8_t *mem, int len)
+{
+	static const char digits[] = "0123456789abcdef";
+	char *out = data->outbuf + data->outlen;
+	int i;
+
+	/* Leave room for the checksum and terminator */
+	if (len > (sizeof(data->outbuf) - data->outlen - 4) / 2)
+		len = (sizeof(data->outbuf) - data->outlen - 4) / 2;
+
+	for (i = 0; i < len; i++) {
+		*(out++) = digits[mem[i] >> 4];
+		*(out++) = digits[mem[i] & 0xf];
+	}
+
+	data->outlen += len * 2;
+	*out = 0;
+}
+
 /* Returns -1 for error, 0 for timeout, >0 if data received. */
 static int gdb_read(struct gdb_data *data, int timeout_ms)
 {
@@ -93,13 +116,21 @@ int gdb_getc(struct gdb_data *data)
 	if (data->head == data->tail && gdb_read(data, -1) <= 0)
 		return -1;
 
-	c = data->xbuf[data->head];
+	c = (uint8_t)data->xbuf[data->head];
 	data->head++;
 
 	return c;
 }
 
-static int gdb_flush(struct gdb_data *data)
+int gdb_peekc(struct gdb_data *data)
+{
+	if (data->head == data->tail && gdb_read(data, -1) <= 0)
+		return -1;
+
+	return (uint8_t)data->xbuf[data->head];
+}
+
+int gdb_flush(struct gdb_data *data)
 {
 	if (sockets_send(data->sock, data->outbuf, data->outlen, 0) < 0) {
 		data->error = 1;
@@ -108,6 +139,7 @@ static int gdb_flush(struct gdb_data *data)
 	}
 
 	data->outlen = 0;
+	data->lastlen = 0;
 	return 0;
 }
 
@@ -120,6 +152,19 @@ int gdb_flush_ack(struct gdb_data *data)
 #endif
 	data->outbuf[data->outlen] = 0;
 
+	if (data->async) {
+		if (sockets_send(data->sock, data->outbuf,
+				 data->outlen, 0) < 0) {
+			data->error = 1;
+			pr_error("gdb: flush_ack");
+			return -1;
+		}
+
+		data->lastlen = data->no_ack ? 0 : data->outlen;
+		data->outlen = 0;
+		return 0;
+	}
+
 	do {
 		if (sockets_send(data->sock, data->outbuf,
 				 data->outlen, 0) < 0) {
@@ -144,6 +189,11 @@ void gdb_packet_start(struct gdb_data *data)
 	gdb_printf(data, "$");
 }
 
+void gdb_notify_start(struct gdb_data *data)
+{
+	gdb_printf(data, "%%");
+}
+
 void gdb_packet_end(struct gdb_data *data)
 {
 	int i;
@@ -220,3 +270,129 @@ int gdb_read_packet(struct gdb_data *data, char *buf)
 
 	return len;
 }
+
+enum {
+	RX_IDLE = 0,
+	RX_PAYLOAD,
+	RX_CKSUM_HI,
+	RX_CKSUM_LO
+};
+
+/* Send the last reply again, after a '-' from the client. */
+static int gdb_resend(struct gdb_data *data)
+{
+	if (!data->lastlen)
+		return 0;
+
+	if (sockets_send(data->sock, data->outbuf, data->lastlen, 0) < 0) {
+		data->error = 1;
+		pr_error("gdb: resend");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Finish a packet, and acknowledge it. Returns GDB_RX_PACKET if the
+ * checksum was good.
+ */
+static int gdb_rx_end(struct gdb_data *data)
+{
+	int ok = data->rx_len + 1 < GDB_BUF_SIZE &&
+		(data->no_ack || !data->rx_cksum);
+
+	data->rx_buf[data->rx_len] = 0;
+	data->rx_state = RX_IDLE;
+
+#ifdef DEBUG_GDB
+	printc("<- $%s\n", data->rx_buf);
+#endif
+
+	if (!ok) {
+		printc_err("gdb: bad packet\n");
+		printc_err("gdb: packet data was: %s\n", data->rx_buf);
+	}
+
+	if (data->no_ack)
+		return ok ? GDB_RX_PACKET : 0;
+
+	if (sockets_send(data->sock, ok ? "+" : "-", 1, 0) < 0) {
+		data->error = 1;
+		pr_error("gdb: ack");
+		return -1;
+	}
+
+	return ok ? GDB_RX_PACKET : 0;
+}
+
+int gdb_rx_poll(struct gdb_data *data)
+{
+	if (data->head == data->tail) {
+		int r = gdb_read(data, 0);
+
+		if (r <= 0)
+			return r;
+	}
+
+	while (data->head != data->tail) {
+		int c = (uint8_t)data->xbuf[data->head++];
+		int r;
+
+		switch (data->rx_state) {
+		case RX_IDLE:
+			if (c == '$') {
+				data->rx_state = RX_PAYLOAD;
+				data->rx_len = 0;
+				data->rx_cksum = 0;
+			} else if (c == 3) {
+				return GDB_RX_INTR;
+			} else if (c == '-' && gdb_resend(data) < 0) {
+				return -1;
+			}
+			break;
+
+		case RX_PAYLOAD:
+			if (c == '#') {
+				data->rx_state = RX_CKSUM_HI;
+				break;
+			}
+
+			/* Overlong packets are rejected by gdb_rx_end() */
+			if (data->rx_len + 1 < GDB_BUF_SIZE)
+				data->rx_buf[data->rx_len++] = c;
+			data->rx_cksum = (data->rx_cksum + c) & 0xff;
+			break;
+
+		case RX_CKSUM_HI:
+			data->rx_cksum ^= hexval(c) << 4;
+			data->rx_state = RX_CKSUM_LO;
+			break;
+
+		case RX_CKSUM_LO:
+			data->rx_cksum ^= hexval(c);
+			r = gdb_rx_end(data);
+			if (r)
+				return r;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int gdb_unescape(char *buf, int len)
+{
+	int in = 0;
+	int out = 0;
+
+	while (in < len) {
+		char c = buf[in++];
+
+		if (c == '}' && in < len)
+			c = buf[in++] ^ 0x20;
+
+		buf[out++] = c;
+	}
+
+	return out;
+}
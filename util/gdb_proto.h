@@ -19,7 +19,9 @@
 #ifndef GDB_PROTO_H_
 #define GDB_PROTO_H_
 
-#define GDB_MAX_XFER    8192
+#include <stdint.h>
+
+#define GDB_MAX_XFER    16384
 #define GDB_BUF_SIZE	(GDB_MAX_XFER * 2 + 64)
 
 struct gdb_data {
@@ -32,6 +34,20 @@ struct gdb_data {
 
 	char            outbuf[GDB_BUF_SIZE];
 	int             outlen;
+
+	/* Set by servers which mustn't block. Replies are then sent
+	 * without waiting for the acknowledgement: a '-' received later
+	 * by gdb_rx_poll() causes the last one to be sent again.
+	 */
+	int             async;
+	int             no_ack;
+	int             lastlen;
+
+	/* Packet receive state, for gdb_rx_poll() */
+	int             rx_state;
+	int             rx_cksum;
+	int             rx_len;
+	char            rx_buf[GDB_BUF_SIZE];
 };
 
 void gdb_init(struct gdb_data *d, int sock);
@@ -41,7 +57,39 @@ void gdb_packet_start(struct gdb_data *data);
 void gdb_packet_end(struct gdb_data *data);
 int gdb_peek(struct gdb_data *data, int timeout_ms);
 int gdb_getc(struct gdb_data *data);
+
+/* Return the next byte received without consuming it. Blocks until a
+ * byte is available. Returns -1 on error.
+ */
+int gdb_peekc(struct gdb_data *data);
+
+/* Send the contents of the output buffer without waiting for an
+ * acknowledgement (used for notifications).
+ */
+int gdb_flush(struct gdb_data *data);
+
+/* Start a notification packet. It's finished with gdb_packet_end(). */
+void gdb_notify_start(struct gdb_data *data);
 int gdb_flush_ack(struct gdb_data *data);
 int gdb_read_packet(struct gdb_data *data, char *buf);
 
+/* Parse whatever has been received so far, without blocking. At most
+ * one read from the socket is made. Returns GDB_RX_PACKET when a
+ * complete packet is in rx_buf (its length is in rx_len), GDB_RX_INTR
+ * if an interrupt request was received, 0 if more data is needed, or
+ * -1 on error.
+ */
+#define GDB_RX_PACKET	1
+#define GDB_RX_INTR	2
+
+int gdb_rx_poll(struct gdb_data *data);
+
+/* Append hex-encoded binary data to the output buffer. */
+void gdb_hex(struct gdb_data *data, const uint8_t *mem, int len);
+
+/* Decode binary data in place, removing '}' escapes. Returns the
+ * decoded length.
+ */
+int gdb_unescape(char *buf, int len);
+
 #endif
@@ -0,0 +1,153 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "hexdec.h"
+
+/* Each of the vector implementations below decodes as many whole
+ * 16-byte blocks as it can, and returns the number of bytes decoded,
+ * or -1 if it found an invalid character. Defining HEXDEC_SCALAR
+ * disables them, so that the benchmark can compare against the scalar
+ * decoder.
+ */
+#if defined(__SSE2__) && !defined(HEXDEC_SCALAR)
+#include <emmintrin.h>
+
+/* Convert 16 hex characters to their values. Lanes which don't hold a
+ * hex digit are cleared in *valid.
+ */
+static inline __m128i nibbles(__m128i c, __m128i *valid)
+{
+	const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	const __m128i alpha = _mm_sub_epi8(_mm_or_si128(c,
+		_mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+
+	/* Unsigned x <= n is equivalent to min(x, n) == x */
+	const __m128i is_digit = _mm_cmpeq_epi8(digit,
+		_mm_min_epu8(digit, _mm_set1_epi8(9)));
+	const __m128i is_alpha = _mm_cmpeq_epi8(alpha,
+		_mm_min_epu8(alpha, _mm_set1_epi8(5)));
+
+	*valid = _mm_and_si128(*valid, _mm_or_si128(is_digit, is_alpha));
+	return _mm_or_si128(_mm_and_si128(is_digit, digit),
+		_mm_and_si128(is_alpha,
+			_mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+/* Combine pairs of nibbles into bytes, leaving each in the low half of
+ * a 16-bit lane.
+ */
+static inline __m128i combine(__m128i n)
+{
+	const __m128i hi = _mm_slli_epi16(_mm_and_si128(n,
+		_mm_set1_epi16(0x00ff)), 4);
+
+	return _mm_or_si128(hi, _mm_srli_epi16(n, 8));
+}
+
+static ptrdiff_t decode_blocks(uint8_t *out, const char *text, size_t len)
+{
+	size_t done = 0;
+
+	while (len - done >= 16) {
+		const char *t = text + done * 2;
+		__m128i valid = _mm_set1_epi8(-1);
+		const __m128i a = nibbles(_mm_loadu_si128((const __m128i *)t),
+					  &valid);
+		const __m128i b = nibbles(_mm_loadu_si128(
+					  (const __m128i *)(t + 16)), &valid);
+
+		if (_mm_movemask_epi8(valid) != 0xffff)
+			return -1;
+
+		_mm_storeu_si128((__m128i *)(out + done),
+				 _mm_packus_epi16(combine(a), combine(b)));
+		done += 16;
+	}
+
+	return done;
+}
+#elif defined(__ARM_NEON) && !defined(HEXDEC_SCALAR)
+#include <arm_neon.h>
+
+static inline uint8x16_t nibbles(uint8x16_t c, uint8x16_t *valid)
+{
+	const uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+	const uint8x16_t alpha = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)),
+					  vdupq_n_u8('a'));
+	const uint8x16_t is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+	const uint8x16_t is_alpha = vcleq_u8(alpha, vdupq_n_u8(5));
+
+	*valid = vandq_u8(*valid, vorrq_u8(is_digit, is_alpha));
+	return vorrq_u8(vandq_u8(is_digit, digit),
+			vandq_u8(is_alpha, vaddq_u8(alpha, vdupq_n_u8(10))));
+}
+
+static ptrdiff_t decode_blocks(uint8_t *out, const char *text, size_t len)
+{
+	size_t done = 0;
+
+	while (len - done >= 16) {
+		/* De-interleave into high and low digits */
+		const uint8x16x2_t t =
+			vld2q_u8((const uint8_t *)text + done * 2);
+		uint8x16_t valid = vdupq_n_u8(0xff);
+		const uint8x16_t hi = nibbles(t.val[0], &valid);
+		const uint8x16_t lo = nibbles(t.val[1], &valid);
+		const uint64x2_t v = vreinterpretq_u64_u8(valid);
+
+		if ((vgetq_lane_u64(v, 0) & vgetq_lane_u64(v, 1)) !=
+		    ~(uint64_t)0)
+			return -1;
+
+		vst1q_u8(out + done, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+		done += 16;
+	}
+
+	return done;
+}
+#else
+static ptrdiff_t decode_blocks(uint8_t *out, const char *text, size_t len)
+{
+	(void)out;
+	(void)text;
+	(void)len;
+
+	return 0;
+}
+#endif
+
+int hexdec(uint8_t *out, const char *text, size_t len)
+{
+	ptrdiff_t done = decode_blocks(out, text, len);
+	size_t i;
+
+	if (done < 0)
+		return -1;
+
+	for (i = done; i < len; i++) {
+		const int hi = hexdec_nibble((uint8_t)text[i * 2]);
+		const int lo = hexdec_nibble((uint8_t)text[i * 2 + 1]);
+
+		if (hi < 0 || lo < 0)
+			return -1;
+
+		out[i] = (hi << 4) | lo;
+	}
+
+	return 0;
+}
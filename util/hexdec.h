@@ -0,0 +1,47 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef HEXDEC_H_
+#define HEXDEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Decode len bytes from 2 * len hex digits (upper or lower case).
+ * Long runs are decoded with SSE2 or NEON where the compiler provides
+ * them, and a scalar loop handles the remainder.
+ *
+ * Returns 0 on success, or -1 if any character isn't a hex digit (in
+ * which case the contents of out are undefined).
+ */
+int hexdec(uint8_t *out, const char *text, size_t len);
+
+/* Value of a single hex digit, or -1 if c isn't one. */
+static inline int hexdec_nibble(int c)
+{
+	if ((unsigned int)(c - '0') < 10)
+		return c - '0';
+
+	c |= 0x20;
+	if ((unsigned int)(c - 'a') < 6)
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+#endif
@@ -0,0 +1,135 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __Windows__
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "mapfile.h"
+#include "output.h"
+#include "util.h"
+
+#ifndef __Windows__
+static int try_mmap(struct mapfile *m, FILE *in)
+{
+	struct stat st;
+	void *data;
+
+	if (fstat(fileno(in), &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size <= 0)
+		return -1;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		    fileno(in), 0);
+	if (data == MAP_FAILED)
+		return -1;
+
+	m->data = data;
+	m->size = st.st_size;
+	m->is_mapped = 1;
+	return 0;
+}
+#endif
+
+static int read_all(struct mapfile *m, FILE *in)
+{
+	size_t cap = 65536;
+	uint8_t *buf = malloc(cap);
+
+	if (!buf) {
+		printc_err("mapfile: can't allocate memory\n");
+		return -1;
+	}
+
+	rewind(in);
+	m->size = 0;
+
+	for (;;) {
+		size_t len = fread(buf + m->size, 1, cap - m->size, in);
+		uint8_t *n;
+
+		m->size += len;
+		if (m->size < cap)
+			break;
+
+		cap *= 2;
+		n = realloc(buf, cap);
+
+		if (!n) {
+			printc_err("mapfile: can't allocate memory\n");
+			free(buf);
+			return -1;
+		}
+
+		buf = n;
+	}
+
+	if (ferror(in)) {
+		pr_error("mapfile: can't read file");
+		free(buf);
+		return -1;
+	}
+
+	m->data = buf;
+	m->is_mapped = 0;
+	return 0;
+}
+
+struct mapfile *mapfile_new(FILE *in)
+{
+	struct mapfile *m = malloc(sizeof(*m));
+
+	if (!m) {
+		printc_err("mapfile: can't allocate memory\n");
+		return NULL;
+	}
+
+	fflush(in);
+
+#ifndef __Windows__
+	if (!try_mmap(m, in))
+		return m;
+#endif
+
+	if (read_all(m, in) < 0) {
+		free(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+void mapfile_free(struct mapfile *m)
+{
+	if (!m)
+		return;
+
+#ifndef __Windows__
+	if (m->is_mapped)
+		munmap((void *)m->data, m->size);
+	else
+#endif
+		free((void *)m->data);
+
+	free(m);
+}
@@ -0,0 +1,50 @@
+/* MSPDebug - debugging tool for MSP430 MCUs
+ * Copyright (C) 2009-2017 Daniel Beer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MAPFILE_H_
+#define MAPFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* A read-only view of the entire contents of a file. Where possible,
+ * the file is memory-mapped, so that parsers can work on it in place
+ * without copying. Otherwise (or if mapping fails, for example because
+ * the file is a pipe), the contents are read into a heap buffer.
+ */
+struct mapfile {
+	const uint8_t		*data;
+	size_t			size;
+	int			is_mapped;
+};
+
+/* Map the whole of an open file. Returns NULL on error. The FILE may be
+ * closed afterwards without affecting the mapping.
+ */
+struct mapfile *mapfile_new(FILE *in);
+
+/* Release a mapping. Data obtained from it becomes invalid.
+ *
+ * Mappings shouldn't be kept beyond the command which made them. The
+ * file may be rewritten in place (by a rebuild, for example), and a
+ * stale mapping would then show torn data or fault.
+ */
+void mapfile_free(struct mapfile *m);
+
+#endif
@@ -95,6 +95,39 @@ static const struct opdb_key keys[] = {
 "If set, some drivers will allow erase/program access to flash\n"
 "BSL memory. If in doubt, do not enable this.\n"
 	},
+	{
+		.name = "incremental_prog",
+		.type = OPDB_TYPE_BOOLEAN,
+		.help =
+"If set, the \"prog\" command doesn't erase all of main memory. Instead,\n"
+"each flash segment touched by the image is compared against the device,\n"
+"and only those which differ are erased and rewritten.\n",
+		.defval = {
+			.boolean = 0
+		}
+	},
+	{
+		.name = "sparse_erase",
+		.type = OPDB_TYPE_BOOLEAN,
+		.help =
+"If set, the \"prog\" command erases only those flash segments which are\n"
+"touched by the image, rather than all of main memory. The contents of\n"
+"other segments are left as they are.\n",
+		.defval = {
+			.boolean = 0
+		}
+	},
+	{
+		.name = "mem_cache",
+		.type = OPDB_TYPE_BOOLEAN,
+		.help =
+"Cache target flash, ROM and RAM contents on the host while the CPU is\n"
+"halted. Flash and ROM stay cached until erased, written or the CPU\n"
+"runs. RAM is also discarded when the CPU is stepped or reset.\n",
+		.defval = {
+			.boolean = 1
+		}
+	},
 	{
 		.name = "gdb_default_port",
 		.type = OPDB_TYPE_NUMERIC,
@@ -104,6 +137,16 @@ static const struct opdb_key keys[] = {
 			.numeric = 2000
 		}
 	},
+	{
+		.name = "power_live",
+		.type = OPDB_TYPE_NUMERIC,
+		.help =
+"If non-zero, show a live power profile of this many functions, updated\n"
+"once a second, while the \"run\" command is waiting for the target.\n",
+		.defval = {
+			.numeric = 0
+		}
+	},
 	{
 		.name = "enable_fuse_blow",
 		.type = OPDB_TYPE_BOOLEAN,
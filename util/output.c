@@ -28,11 +28,19 @@
 #include "opdb.h"
 #include "output.h"
 #include "util.h"
+#include "thread.h"
 
 static capture_func_t capture_func;
 static void *capture_data;
 static int is_embedded_mode;
 
+/* Output may be produced by several threads at once (e.g. when gang
+ * programming). Once enabled, this lock serializes access to the line
+ * buffers.
+ */
+static thread_lock_t output_lock;
+static int output_is_locked;
+
 #define LINEBUF_SIZE	4096
 
 struct linebuf {
@@ -196,6 +204,9 @@ static int write_text(struct linebuf *ob, const char *text,
 {
 	int count = 0;
 
+	if (output_is_locked)
+		thread_lock_acquire(&output_lock);
+
 	/* Separate the text into lines and count the number of
 	 * printing characters.
 	 */
@@ -221,6 +232,9 @@ static int write_text(struct linebuf *ob, const char *text,
 		text++;
 	}
 
+	if (output_is_locked)
+		thread_lock_release(&output_lock);
+
 	return count;
 }
 
@@ -288,6 +302,15 @@ void output_set_embedded(int enable)
 	is_embedded_mode = enable;
 }
 
+void output_enable_locking(void)
+{
+	if (output_is_locked)
+		return;
+
+	thread_lock_init(&output_lock);
+	output_is_locked = 1;
+}
+
 void pr_error(const char *prefix)
 {
 	printc_err("%s: %s\n", prefix, last_error());
@@ -52,6 +52,12 @@ void pr_error(const char *prefix);
  */
 void output_set_embedded(int enable);
 
+/* Make output functions safe to call from multiple threads. This must
+ * be called from the main thread, before any other threads which might
+ * produce output are started. Once enabled, locking stays enabled.
+ */
+void output_enable_locking(void);
+
 /* Capture output. Capturing is started by calling capture_begin() with
  * a callback function. The callback is invoked for each line of output
  * printed to either stdout or stderr (output still goes to
@@ -16,9 +16,200 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+/* The spill file of a long capture can exceed 2 GiB, so 32-bit POSIX
+ * hosts need large file support.
+ */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include "powerbuf.h"
+#include "output.h"
+#include "thread.h"
+#include "vector.h"
+
+/* Offsets in the spill file. long is only 32 bits on Windows. */
+#ifdef __Windows__
+typedef __int64 spill_off_t;
+#define spill_seek _fseeki64
+#else
+typedef off_t spill_off_t;
+#define spill_seek fseeko
+#endif
+
+static void spill_reset(powerbuf_t pb);
+static void spill_begin_session(powerbuf_t pb, time_t when);
+static void spill_end_session(powerbuf_t pb);
+static void spill_add_samples(powerbuf_t pb, unsigned int count,
+			      const unsigned int *current_ua,
+			      const address_t *mab);
+
+/************************************************************************
+ * MAB tables
+ */
+
+#define MAB_TABLE_MIN_CAPACITY		1024
+
+static unsigned int mab_hash(address_t mab)
+{
+	return mab * 2654435761u;
+}
+
+static int mab_table_init(struct powerbuf_mab_table *t)
+{
+	unsigned int i;
+
+	t->ents = malloc(sizeof(t->ents[0]) * MAB_TABLE_MIN_CAPACITY);
+	if (!t->ents)
+		return -1;
+
+	t->capacity = MAB_TABLE_MIN_CAPACITY;
+	t->size = 0;
+
+	for (i = 0; i < t->capacity; i++)
+		t->ents[i].mab = POWERBUF_MAB_NONE;
+
+	return 0;
+}
+
+static void mab_table_destroy(struct powerbuf_mab_table *t)
+{
+	free(t->ents);
+}
+
+static void mab_table_clear(struct powerbuf_mab_table *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->capacity; i++)
+		t->ents[i].mab = POWERBUF_MAB_NONE;
+
+	t->size = 0;
+}
+
+static struct powerbuf_mab_entry *mab_table_probe(
+	const struct powerbuf_mab_table *t, address_t mab)
+{
+	const unsigned int mask = t->capacity - 1;
+	unsigned int i = mab_hash(mab) & mask;
+
+	while (t->ents[i].mab != mab &&
+	       t->ents[i].mab != POWERBUF_MAB_NONE)
+		i = (i + 1) & mask;
+
+	return &t->ents[i];
+}
+
+static int mab_table_grow(struct powerbuf_mab_table *t)
+{
+	struct powerbuf_mab_table n;
+	unsigned int i;
+
+	n.capacity = t->capacity * 2;
+	n.size = t->size;
+	n.ents = malloc(sizeof(n.ents[0]) * n.capacity);
+	if (!n.ents)
+		return -1;
+
+	for (i = 0; i < n.capacity; i++)
+		n.ents[i].mab = POWERBUF_MAB_NONE;
+
+	for (i = 0; i < t->capacity; i++)
+		if (t->ents[i].mab != POWERBUF_MAB_NONE)
+			*mab_table_probe(&n, t->ents[i].mab) = t->ents[i];
+
+	free(t->ents);
+	*t = n;
+	return 0;
+}
+
+/* Find the entry for a MAB, creating it if necessary. Returns NULL if
+ * the table is full and can't be grown.
+ */
+static struct powerbuf_mab_entry *mab_table_get(
+	struct powerbuf_mab_table *t, address_t mab)
+{
+	struct powerbuf_mab_entry *e = mab_table_probe(t, mab);
+
+	if (e->mab != POWERBUF_MAB_NONE)
+		return e;
+
+	/* Keep the load factor at or below 1/2 */
+	if ((t->size + 1) * 2 > t->capacity) {
+		if (mab_table_grow(t) < 0) {
+			if (t->size + 1 >= t->capacity)
+				return NULL;
+		} else {
+			e = mab_table_probe(t, mab);
+		}
+	}
+
+	e->mab = mab;
+	e->samples = 0;
+	e->sum_ua = 0;
+	t->size++;
+
+	return e;
+}
+
+static void mab_table_add(struct powerbuf_mab_table *t, unsigned int count,
+			  const unsigned int *current_ua,
+			  const address_t *mab)
+{
+	struct powerbuf_mab_entry *e = NULL;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		/* Consecutive samples usually share a MAB */
+		if (!e || e->mab != mab[i]) {
+			e = mab_table_get(t, mab[i]);
+			if (!e)
+				continue;
+		}
+
+		e->samples++;
+		e->sum_ua += current_ua[i];
+	}
+}
+
+/* Remove samples which were previously added. */
+static void mab_table_sub(struct powerbuf_mab_table *t, unsigned int count,
+			  const unsigned int *current_ua,
+			  const address_t *mab)
+{
+	struct powerbuf_mab_entry *e = NULL;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (!e || e->mab != mab[i])
+			e = mab_table_probe(t, mab[i]);
+
+		if (e->mab == POWERBUF_MAB_NONE || !e->samples)
+			continue;
+
+		e->samples--;
+		e->sum_ua -= current_ua[i];
+	}
+}
+
+static void mab_table_enum(const struct powerbuf_mab_table *t,
+			   powerbuf_mab_cb_t cb, void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->capacity; i++) {
+		const struct powerbuf_mab_entry *e = &t->ents[i];
+
+		if (e->mab != POWERBUF_MAB_NONE)
+			cb(user_data, e->mab, e->samples, e->sum_ua);
+	}
+}
+
+/************************************************************************
+ * Power buffer
+ */
 
 powerbuf_t powerbuf_new(unsigned int max_samples, unsigned int interval_us)
 {
@@ -47,8 +238,7 @@ powerbuf_t powerbuf_new(unsigned int max_samples, unsigned int interval_us)
 		return NULL;
 	}
 
-	pb->sorted = malloc(sizeof(pb->sorted[0]) * max_samples);
-	if (!pb->sorted) {
+	if (mab_table_init(&pb->by_mab) < 0) {
 		free(pb->current_ua);
 		free(pb->mab);
 		free(pb);
@@ -66,9 +256,10 @@ powerbuf_t powerbuf_new(unsigned int max_samples, unsigned int interval_us)
 
 void powerbuf_free(powerbuf_t pb)
 {
+	powerbuf_spill_stop(pb);
 	free(pb->current_ua);
 	free(pb->mab);
-	free(pb->sorted);
+	mab_table_destroy(&pb->by_mab);
 	free(pb);
 }
 
@@ -76,7 +267,10 @@ void powerbuf_clear(powerbuf_t pb)
 {
 	pb->session_head = pb->session_tail = 0;
 	pb->current_head = pb->current_tail = 0;
-	pb->sort_valid = 0;
+	mab_table_clear(&pb->by_mab);
+
+	if (pb->spill)
+		spill_reset(pb);
 }
 
 static unsigned int session_length(powerbuf_t pb, unsigned int idx)
@@ -96,14 +290,27 @@ static unsigned int session_length(powerbuf_t pb, unsigned int idx)
 		pb->max_samples;
 }
 
-static void pop_oldest_session(powerbuf_t pb)
+/* Remove samples from the tail of the current/MAB buffers. */
+static void drop_samples(powerbuf_t pb, unsigned int count)
 {
-	unsigned int length = session_length(pb, pb->session_tail);
+	while (count) {
+		unsigned int cont_len = pb->max_samples - pb->current_tail;
 
-	/* Remove corresponding samples from the tail of the current/MAB
-	 * buffers.
-	 */
-	pb->current_tail = (pb->current_tail + length) % pb->max_samples;
+		if (cont_len > count)
+			cont_len = count;
+
+		mab_table_sub(&pb->by_mab, cont_len,
+			      pb->current_ua + pb->current_tail,
+			      pb->mab + pb->current_tail);
+		pb->current_tail = (pb->current_tail + cont_len) %
+			pb->max_samples;
+		count -= cont_len;
+	}
+}
+
+static void pop_oldest_session(powerbuf_t pb)
+{
+	drop_samples(pb, session_length(pb, pb->session_tail));
 
 	/* Remove the session from the session buffer. */
 	pb->session_tail = (pb->session_tail + 1) % POWERBUF_MAX_SESSIONS;
@@ -130,6 +337,9 @@ void powerbuf_begin_session(powerbuf_t pb, time_t when)
 
 	/* Advance the head pointer */
 	pb->session_head = next_head;
+
+	if (pb->spill)
+		spill_begin_session(pb, when);
 }
 
 /* Return the index of the nth most recent session */
@@ -148,6 +358,9 @@ void powerbuf_end_session(powerbuf_t pb)
 	if (pb->session_head == pb->session_tail)
 		return;
 
+	if (pb->spill)
+		spill_end_session(pb);
+
 	/* If no samples were added since the session began, decrement
 	 * the head pointer.
 	 */
@@ -217,8 +430,7 @@ static void ensure_room(powerbuf_t pb, unsigned int required)
 		/* Advance the start index and buffer tail */
 		old->start_index = (old->start_index + cont_len) %
 			pb->max_samples;
-		pb->current_tail = (pb->current_tail + cont_len) %
-			pb->max_samples;
+		drop_samples(pb, cont_len);
 
 		room += cont_len;
 	}
@@ -235,11 +447,14 @@ void powerbuf_add_samples(powerbuf_t pb, unsigned int count,
 	if (pb->session_head == pb->session_tail)
 		return;
 
+	if (pb->spill)
+		spill_add_samples(pb, count, current_ua, mab);
+
 	/* Make sure that we can't overflow the buffer in a single
 	 * chunk.
 	 */
 	if (count > pb->max_samples - 1) {
-		int extra = pb->max_samples - 1 - count;
+		const unsigned int extra = count - (pb->max_samples - 1);
 
 		current_ua += extra;
 		mab += extra;
@@ -253,6 +468,9 @@ void powerbuf_add_samples(powerbuf_t pb, unsigned int count,
 	for (i = 0; i < count; i++)
 		cur->total_ua += current_ua[i];
 
+	mab_table_add(&pb->by_mab, count, current_ua, mab);
+	pb->total_samples += count;
+
 	/* Add samples in contiguous chunks */
 	while (count) {
 		unsigned int cont_len = pb->max_samples - pb->current_head;
@@ -274,8 +492,6 @@ void powerbuf_add_samples(powerbuf_t pb, unsigned int count,
 		mab += cont_len;
 		count -= cont_len;
 	}
-
-	pb->sort_valid = 0;
 }
 
 address_t powerbuf_last_mab(powerbuf_t pb)
@@ -290,144 +506,984 @@ address_t powerbuf_last_mab(powerbuf_t pb)
 	return pb->mab[last];
 }
 
-static void sift_down(powerbuf_t pb, int start, int end)
+unsigned int powerbuf_read_since(powerbuf_t pb, unsigned long long *seq,
+				 unsigned long long *lost,
+				 unsigned int *current_ua, address_t *mab,
+				 unsigned int max)
 {
-	int root = start;
+	const unsigned int held = (pb->current_head + pb->max_samples -
+				   pb->current_tail) % pb->max_samples;
+	const unsigned long long oldest = pb->total_samples - held;
+	unsigned int count;
+	unsigned int idx;
+	unsigned int i;
 
-	while (root * 2 + 1 <= end) {
-		int left_child = root * 2 + 1;
-		int biggest = root;
-		unsigned int temp;
+	if (*seq < oldest) {
+		*lost += oldest - *seq;
+		*seq = oldest;
+	}
 
-		/* Find the largest of
-		 *   (root, left child, right child)
-		 */
-		if (pb->mab[pb->sorted[biggest]] <
-		    pb->mab[pb->sorted[left_child]])
-			biggest = left_child;
-		if (left_child + 1 <= end &&
-		    (pb->mab[pb->sorted[biggest]] <
-		     pb->mab[pb->sorted[left_child + 1]]))
-			biggest = left_child + 1;
-
-		/* If no changes are needed, the heap property is ok and
-		 * we can stop.
-		 */
-		if (biggest == root)
-			break;
+	if (*seq >= pb->total_samples)
+		return 0;
+
+	count = pb->total_samples - *seq;
+	if (count > max)
+		count = max;
+
+	idx = (pb->current_head + pb->max_samples -
+	       (unsigned int)(pb->total_samples - *seq)) % pb->max_samples;
+
+	for (i = 0; i < count; i++) {
+		current_ua[i] = pb->current_ua[idx];
+		mab[i] = pb->mab[idx];
+		idx = (idx + 1) % pb->max_samples;
+	}
+
+	*seq += count;
+	return count;
+}
+
+int powerbuf_get_by_mab(powerbuf_t pb, address_t mab,
+			unsigned long long *sum_ua)
+{
+	const struct powerbuf_mab_entry *e =
+		mab_table_probe(&pb->by_mab, mab);
+
+	if (e->mab == POWERBUF_MAB_NONE || !e->samples)
+		return 0;
+
+	*sum_ua = e->sum_ua;
+	return e->samples;
+}
+
+/************************************************************************
+ * Spill mode
+ *
+ * The spill file is a sequence of blocks, each holding up to
+ * SPILL_BLOCK_SAMPLES samples from a single session. A block consists
+ * of a 16-byte header of little-endian 32-bit words:
+ *
+ *     magic, session number, sample count, payload length
+ *
+ * followed by the payload: the current samples, then the MAB samples,
+ * each stored as the difference from the previous value (starting at
+ * 0), zigzag-encoded and written as a little-endian base-128 varint.
+ * The blocks of each session are contiguous.
+ *
+ * Blocks are filled in place in a small queue, and a writer thread
+ * encodes and writes them in order. If the writer falls behind, adding
+ * samples waits for it, so memory use is bounded by the queue size.
+ */
+
+#define SPILL_BLOCK_SAMPLES	4096
+#define SPILL_QUEUE_BLOCKS	4
+#define SPILL_HEADER_SIZE	16
+#define SPILL_MAX_PAYLOAD	(SPILL_BLOCK_SAMPLES * 2 * 5)
+#define SPILL_MAGIC		0x31534250 /* "PBS1" */
+
+struct spill_block {
+	unsigned int		session;
+	unsigned int		count;
+	unsigned int		current_ua[SPILL_BLOCK_SAMPLES];
+	address_t		mab[SPILL_BLOCK_SAMPLES];
+};
+
+struct spill_session {
+	time_t			wall_clock;
+	unsigned long long	length;
+	unsigned long long	total_ua;
+
+	/* File offset of the first block, or -1 if none has been
+	 * written yet.
+	 */
+	spill_off_t		offset;
+};
+
+struct powerbuf_spill {
+	char			*path;
+	FILE			*out;
+
+	/* Queued blocks. The block at (head + count) is owned by the
+	 * producer, and is being filled if fill_count is non-zero.
+	 */
+	struct spill_block	queue[SPILL_QUEUE_BLOCKS];
+	unsigned int		head;
+	unsigned int		count;
+	unsigned int		fill_count;
+
+	/* Each condition has a single waiter: the writer waits for
+	 * ready, and the producer waits for done.
+	 */
+	thread_t		writer;
+	thread_lock_t		lock;
+	thread_cond_t		ready;
+	thread_cond_t		done;
+	int			stop;
+	int			failed;
+
+	/* Writer state */
+	spill_off_t		pos;
+	uint8_t			payload[SPILL_MAX_PAYLOAD];
+
+	/* Sessions in the file (struct spill_session). Protected by
+	 * the lock, since the writer fills in offsets.
+	 */
+	struct vector		sessions;
+
+	/* Totals by MAB of every sample in the file */
+	struct powerbuf_mab_table by_mab;
+};
+
+static void put_le32(uint8_t *out, uint32_t v)
+{
+	out[0] = v;
+	out[1] = v >> 8;
+	out[2] = v >> 16;
+	out[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *in)
+{
+	return ((uint32_t)in[0]) |
+		(((uint32_t)in[1]) << 8) |
+		(((uint32_t)in[2]) << 16) |
+		(((uint32_t)in[3]) << 24);
+}
 
-		/* Swap the root with its largest child */
-		temp = pb->sorted[biggest];
-		pb->sorted[biggest] = pb->sorted[root];
-		pb->sorted[root] = temp;
+static uint8_t *put_deltas(uint8_t *out, const uint32_t *v, unsigned int n)
+{
+	uint32_t prev = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		const int32_t d = v[i] - prev;
+		uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
 
-		/* Continue to push down the old root (now a child) */
-		root = biggest;
+		while (z >= 0x80) {
+			*(out++) = z | 0x80;
+			z >>= 7;
+		}
+
+		*(out++) = z;
+		prev = v[i];
 	}
+
+	return out;
 }
 
-static void heapify(powerbuf_t pb, int num_samples)
+/* Returns a pointer past the last byte consumed, or NULL if the data
+ * is truncated.
+ */
+static const uint8_t *get_deltas(const uint8_t *in, const uint8_t *end,
+				 uint32_t *v, unsigned int n)
 {
-	int start = (num_samples - 2) / 2;
+	uint32_t prev = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t z = 0;
+		int shift = 0;
+
+		do {
+			if (in >= end || shift > 28)
+				return NULL;
 
-	while (start >= 0) {
-		sift_down(pb, start, num_samples - 1);
-		start--;
+			z |= ((uint32_t)(*in & 0x7f)) << shift;
+			shift += 7;
+		} while (*(in++) & 0x80);
+
+		prev += (z >> 1) ^ -(z & 1);
+		v[i] = prev;
 	}
+
+	return in;
 }
 
-static void heap_extract(powerbuf_t pb, int num_samples)
+/* Encode and write a block, using the given payload buffer. Returns the
+ * number of bytes written, or -1 if an error occurs.
+ */
+static int put_block(FILE *out, uint8_t *payload, unsigned int session,
+		     unsigned int count, const unsigned int *current_ua,
+		     const address_t *mab)
 {
-	int end = num_samples - 1;
+	uint8_t header[SPILL_HEADER_SIZE];
+	uint8_t *end;
 
-	while (end > 0) {
-		unsigned int temp;
+	end = put_deltas(payload, current_ua, count);
+	end = put_deltas(end, mab, count);
+
+	put_le32(header, SPILL_MAGIC);
+	put_le32(header + 4, session);
+	put_le32(header + 8, count);
+	put_le32(header + 12, end - payload);
+
+	if (fwrite(header, sizeof(header), 1, out) != 1 ||
+	    fwrite(payload, end - payload, 1, out) != 1)
+		return -1;
+
+	return sizeof(header) + (end - payload);
+}
+
+/* Read and decode the next block, which must belong to the given
+ * session. Returns the number of samples, or -1 if an error occurs.
+ */
+static int get_block(FILE *in, const char *path, uint8_t *payload,
+		     unsigned int session,
+		     unsigned int *current_ua, address_t *mab)
+{
+	uint8_t header[SPILL_HEADER_SIZE];
+	const uint8_t *end;
+	unsigned int count;
+	unsigned int len;
+
+	if (fread(header, sizeof(header), 1, in) != 1) {
+		printc_err("power: %s: unexpected end of file\n", path);
+		return -1;
+	}
+
+	count = get_le32(header + 8);
+	len = get_le32(header + 12);
+
+	if (get_le32(header) != SPILL_MAGIC ||
+	    get_le32(header + 4) != session ||
+	    !count || count > SPILL_BLOCK_SAMPLES ||
+	    len > SPILL_MAX_PAYLOAD) {
+		printc_err("power: %s: invalid block\n", path);
+		return -1;
+	}
 
-		/* Swap the top of the heap with the end of the array,
-		 * and shrink the heap.
+	if (fread(payload, len, 1, in) != 1) {
+		printc_err("power: %s: unexpected end of file\n", path);
+		return -1;
+	}
+
+	end = get_deltas(payload, payload + len, current_ua, count);
+	if (end)
+		end = get_deltas(end, payload + len, mab, count);
+	if (!end) {
+		printc_err("power: %s: invalid block\n", path);
+		return -1;
+	}
+
+	return count;
+}
+
+static int write_block(struct powerbuf_spill *sp, const struct spill_block *b)
+{
+	const int len = put_block(sp->out, sp->payload, b->session,
+				  b->count, b->current_ua, b->mab);
+
+	if (len < 0)
+		return -1;
+
+	sp->pos += len;
+	return 0;
+}
+
+static void spill_writer(void *user_data)
+{
+	struct powerbuf_spill *sp = (struct powerbuf_spill *)user_data;
+
+	thread_lock_acquire(&sp->lock);
+
+	for (;;) {
+		const struct spill_block *b;
+		struct spill_session *s;
+		int last;
+
+		while (!sp->count && !sp->stop)
+			thread_cond_wait(&sp->ready, &sp->lock);
+
+		if (!sp->count)
+			break;
+
+		b = &sp->queue[sp->head];
+		s = VECTOR_PTR(sp->sessions, b->session,
+			       struct spill_session);
+		if (s->offset < 0)
+			s->offset = sp->pos;
+		last = (sp->count == 1);
+		thread_lock_release(&sp->lock);
+
+		/* Flush whenever the queue empties, so that readers see
+		 * everything after spill_sync().
 		 */
-		temp = pb->sorted[0];
-		pb->sorted[0] = pb->sorted[end];
-		pb->sorted[end] = temp;
-		end--;
+		if (!sp->failed &&
+		    (write_block(sp, b) < 0 ||
+		     (last && fflush(sp->out) < 0))) {
+			printc_err("power: error writing to %s: %s\n",
+				   sp->path, last_error());
+			sp->failed = 1;
+		}
+
+		thread_lock_acquire(&sp->lock);
+		sp->head = (sp->head + 1) % SPILL_QUEUE_BLOCKS;
+		sp->count--;
+		thread_cond_notify(&sp->done);
+	}
 
-		/* Fix up the heap (push down the new root) */
-		sift_down(pb, 0, end);
+	thread_lock_release(&sp->lock);
+}
+
+/* Queue the block being filled, if it holds any samples. */
+static void spill_submit(struct powerbuf_spill *sp)
+{
+	if (!sp->fill_count)
+		return;
+
+	thread_lock_acquire(&sp->lock);
+	sp->count++;
+	sp->fill_count = 0;
+	thread_cond_notify(&sp->ready);
+	thread_lock_release(&sp->lock);
+}
+
+/* Wait until the producer owns a free block. */
+static void spill_wait_room(struct powerbuf_spill *sp)
+{
+	thread_lock_acquire(&sp->lock);
+	while (sp->count >= SPILL_QUEUE_BLOCKS)
+		thread_cond_wait(&sp->done, &sp->lock);
+	thread_lock_release(&sp->lock);
+}
+
+/* Write out everything added so far. */
+static void spill_sync(struct powerbuf_spill *sp)
+{
+	spill_submit(sp);
+
+	thread_lock_acquire(&sp->lock);
+	while (sp->count)
+		thread_cond_wait(&sp->done, &sp->lock);
+	thread_lock_release(&sp->lock);
+}
+
+static struct spill_session *spill_last(struct powerbuf_spill *sp)
+{
+	if (!sp->sessions.size)
+		return NULL;
+
+	return VECTOR_PTR(sp->sessions, sp->sessions.size - 1,
+			  struct spill_session);
+}
+
+static void spill_begin_session(powerbuf_t pb, time_t when)
+{
+	struct powerbuf_spill *sp = pb->spill;
+	struct spill_session s;
+	int ret;
+
+	spill_submit(sp);
+
+	s.wall_clock = when;
+	s.length = 0;
+	s.total_ua = 0;
+	s.offset = -1;
+
+	thread_lock_acquire(&sp->lock);
+	ret = vector_push(&sp->sessions, &s, 1);
+	thread_lock_release(&sp->lock);
+
+	if (ret < 0) {
+		printc_err("power: can't allocate memory for spill "
+			   "session\n");
+		powerbuf_spill_stop(pb);
 	}
 }
 
-void powerbuf_sort(powerbuf_t pb)
+static void spill_end_session(powerbuf_t pb)
 {
-	const unsigned int num_samples =
-		(pb->current_head + pb->max_samples - pb->current_tail) %
-			pb->max_samples;
+	struct powerbuf_spill *sp = pb->spill;
+	const struct spill_session *s = spill_last(sp);
+
+	spill_submit(sp);
+
+	if (s && !s->length) {
+		thread_lock_acquire(&sp->lock);
+		vector_pop(&sp->sessions);
+		thread_lock_release(&sp->lock);
+	}
+}
+
+static void spill_add_samples(powerbuf_t pb, unsigned int count,
+			      const unsigned int *current_ua,
+			      const address_t *mab)
+{
+	struct powerbuf_spill *sp = pb->spill;
+	struct spill_session *s = spill_last(sp);
 	unsigned int i;
 
-	if (pb->sort_valid)
+	if (!s)
 		return;
 
-	/* Prepare an index list */
-	for (i = 0; i < num_samples; i++)
-		pb->sorted[i] = (pb->current_tail + i) % pb->max_samples;
+	s->length += count;
+	for (i = 0; i < count; i++)
+		s->total_ua += current_ua[i];
 
-	if (num_samples < 2) {
-		pb->sort_valid = 1;
-		return;
+	mab_table_add(&sp->by_mab, count, current_ua, mab);
+
+	while (count) {
+		struct spill_block *b;
+		unsigned int len = SPILL_BLOCK_SAMPLES - sp->fill_count;
+
+		if (!sp->fill_count)
+			spill_wait_room(sp);
+
+		b = &sp->queue[(sp->head + sp->count) % SPILL_QUEUE_BLOCKS];
+		b->session = sp->sessions.size - 1;
+
+		if (len > count)
+			len = count;
+
+		memcpy(b->current_ua + sp->fill_count, current_ua,
+		       sizeof(current_ua[0]) * len);
+		memcpy(b->mab + sp->fill_count, mab, sizeof(mab[0]) * len);
+		sp->fill_count += len;
+		b->count = sp->fill_count;
+
+		if (sp->fill_count >= SPILL_BLOCK_SAMPLES)
+			spill_submit(sp);
+
+		current_ua += len;
+		mab += len;
+		count -= len;
+	}
+}
+
+static void spill_reset(powerbuf_t pb)
+{
+	struct powerbuf_spill *sp = pb->spill;
+
+	spill_sync(sp);
+
+	/* The writer is idle now, and stays idle until we add more */
+	sp->sessions.size = 0;
+	sp->pos = 0;
+	sp->failed = 0;
+	mab_table_clear(&sp->by_mab);
+
+	if (!freopen(sp->path, "wb", sp->out)) {
+		printc_err("power: can't reopen %s: %s\n",
+			   sp->path, last_error());
+		sp->out = NULL;
+		powerbuf_spill_stop(pb);
+	}
+}
+
+int powerbuf_spill_start(powerbuf_t pb, const char *path)
+{
+	struct powerbuf_spill *sp;
+	unsigned int i;
+
+	powerbuf_spill_stop(pb);
+
+	sp = malloc(sizeof(*sp));
+	if (!sp) {
+		printc_err("power: can't allocate spill buffer\n");
+		return -1;
+	}
+
+	memset(sp, 0, sizeof(*sp));
+	vector_init(&sp->sessions, sizeof(struct spill_session));
+
+	sp->path = strdup(path);
+	if (!sp->path || mab_table_init(&sp->by_mab) < 0) {
+		printc_err("power: can't allocate memory\n");
+		free(sp->path);
+		free(sp);
+		return -1;
 	}
 
-	heapify(pb, num_samples);
-	heap_extract(pb, num_samples);
-	pb->sort_valid = 1;
+	sp->out = fopen(path, "wb");
+	if (!sp->out) {
+		printc_err("power: can't open %s: %s\n", path, last_error());
+		mab_table_destroy(&sp->by_mab);
+		free(sp->path);
+		free(sp);
+		return -1;
+	}
+
+	thread_lock_init(&sp->lock);
+	thread_cond_init(&sp->ready);
+	thread_cond_init(&sp->done);
+
+	/* The writer reports errors */
+	output_enable_locking();
+
+	if (thread_create(&sp->writer, spill_writer, sp)) {
+		printc_err("power: can't create spill writer thread\n");
+		thread_cond_destroy(&sp->done);
+		thread_cond_destroy(&sp->ready);
+		thread_lock_destroy(&sp->lock);
+		fclose(sp->out);
+		mab_table_destroy(&sp->by_mab);
+		free(sp->path);
+		free(sp);
+		return -1;
+	}
+
+	pb->spill = sp;
+
+	/* Start the file with the sessions already in memory, so that
+	 * session numbers stay the same.
+	 */
+	for (i = powerbuf_num_sessions(pb); i > 0; i--) {
+		unsigned int length;
+		const struct powerbuf_session *s =
+			powerbuf_session_info(pb, i - 1, &length);
+		unsigned int idx = s->start_index;
+
+		spill_begin_session(pb, s->wall_clock);
+		if (!pb->spill)
+			return -1;
+
+		while (length) {
+			unsigned int len = pb->max_samples - idx;
+
+			if (len > length)
+				len = length;
+
+			spill_add_samples(pb, len, pb->current_ua + idx,
+					  pb->mab + idx);
+			idx = (idx + len) % pb->max_samples;
+			length -= len;
+		}
+	}
+
+	return 0;
 }
 
-/* Find the index within the sorted index of the first sample with an
- * MAB >= the given mab parameter.
+void powerbuf_spill_stop(powerbuf_t pb)
+{
+	struct powerbuf_spill *sp = pb->spill;
+
+	if (!sp)
+		return;
+
+	pb->spill = NULL;
+	spill_sync(sp);
+
+	thread_lock_acquire(&sp->lock);
+	sp->stop = 1;
+	thread_cond_notify(&sp->ready);
+	thread_lock_release(&sp->lock);
+	thread_join(sp->writer);
+
+	if (sp->out && fclose(sp->out) < 0)
+		printc_err("power: error on close of %s: %s\n",
+			   sp->path, last_error());
+
+	thread_cond_destroy(&sp->done);
+	thread_cond_destroy(&sp->ready);
+	thread_lock_destroy(&sp->lock);
+	vector_destroy(&sp->sessions);
+	mab_table_destroy(&sp->by_mab);
+	free(sp->path);
+	free(sp);
+}
+
+const char *powerbuf_spill_path(powerbuf_t pb)
+{
+	return pb->spill ? pb->spill->path : NULL;
+}
+
+void powerbuf_enum_by_mab(powerbuf_t pb, powerbuf_mab_cb_t cb,
+			  void *user_data)
+{
+	if (pb->spill)
+		mab_table_enum(&pb->spill->by_mab, cb, user_data);
+	else
+		mab_table_enum(&pb->by_mab, cb, user_data);
+}
+
+/************************************************************************
+ * Streaming access
  */
-static int find_mab_ge(powerbuf_t pb, address_t mab)
+
+struct powerbuf_stream {
+	powerbuf_t		pb;
+	unsigned long long	left;
+
+	/* Reading from memory */
+	unsigned int		index;
+
+	/* Reading from the spill file */
+	FILE			*in;
+	unsigned int		session;
+	unsigned int		avail;
+	unsigned int		pos;
+	unsigned int		current_ua[SPILL_BLOCK_SAMPLES];
+	address_t		mab[SPILL_BLOCK_SAMPLES];
+	uint8_t			payload[SPILL_MAX_PAYLOAD];
+};
+
+unsigned int powerbuf_stream_sessions(powerbuf_t pb)
 {
-	const int num_samples =
-		(pb->current_head + pb->max_samples - pb->current_tail) %
-			pb->max_samples;
-	int low = 0;
-	int high = num_samples - 1;
+	if (pb->spill)
+		return pb->spill->sessions.size;
 
-	while (low <= high) {
-		int mid = (low + high) / 2;
+	return powerbuf_num_sessions(pb);
+}
 
-		if (pb->mab[pb->sorted[mid]] < mab)
-			low = mid + 1;
-		else if ((mid <= 0) || (pb->mab[pb->sorted[mid - 1]] < mab))
-			return mid;
-		else
-			high = mid - 1;
+void powerbuf_stream_info(powerbuf_t pb, unsigned int rev_idx,
+			  struct powerbuf_stream_info *info)
+{
+	const struct powerbuf_session *s;
+	unsigned int length;
+
+	if (pb->spill) {
+		const struct spill_session *ss =
+			VECTOR_PTR(pb->spill->sessions,
+				   pb->spill->sessions.size - 1 - rev_idx,
+				   struct spill_session);
+
+		info->wall_clock = ss->wall_clock;
+		info->length = ss->length;
+		info->total_ua = ss->total_ua;
+		return;
 	}
 
-	return -1;
+	s = powerbuf_session_info(pb, rev_idx, &length);
+	info->wall_clock = s->wall_clock;
+	info->length = length;
+	info->total_ua = s->total_ua;
 }
 
-int powerbuf_get_by_mab(powerbuf_t pb, address_t mab,
-			unsigned long long *sum_ua)
+struct powerbuf_stream *powerbuf_stream_open(powerbuf_t pb,
+					     unsigned int rev_idx)
 {
-	const unsigned int num_samples =
-		(pb->current_head + pb->max_samples - pb->current_tail) %
-			pb->max_samples;
-	int i;
-	int count = 0;
+	struct powerbuf_stream *st = malloc(sizeof(*st));
+	const struct spill_session *ss;
+
+	if (!st) {
+		printc_err("power: can't allocate memory\n");
+		return NULL;
+	}
 
-	if (!pb->sort_valid)
-		powerbuf_sort(pb);
+	memset(st, 0, sizeof(*st));
+	st->pb = pb;
 
-	i = find_mab_ge(pb, mab);
-	if (i < 0)
-		return 0;
+	if (!pb->spill) {
+		unsigned int length;
+		const struct powerbuf_session *s =
+			powerbuf_session_info(pb, rev_idx, &length);
+
+		st->index = s->start_index;
+		st->left = length;
+		return st;
+	}
+
+	spill_sync(pb->spill);
 
-	*sum_ua = 0;
+	st->session = pb->spill->sessions.size - 1 - rev_idx;
+	ss = VECTOR_PTR(pb->spill->sessions, st->session,
+			struct spill_session);
+	st->left = ss->length;
 
-	while ((i < num_samples) && (pb->mab[pb->sorted[i]] == mab)) {
-		*sum_ua += pb->current_ua[pb->sorted[i]];
-		count++;
-		i++;
+	if (!st->left)
+		return st;
+
+	st->in = fopen(pb->spill->path, "rb");
+	if (!st->in) {
+		printc_err("power: can't open %s: %s\n",
+			   pb->spill->path, last_error());
+		free(st);
+		return NULL;
+	}
+
+	if (spill_seek(st->in, ss->offset, SEEK_SET) < 0) {
+		printc_err("power: can't seek in %s: %s\n",
+			   pb->spill->path, last_error());
+		powerbuf_stream_close(st);
+		return NULL;
 	}
 
+	return st;
+}
+
+static int stream_next_block(struct powerbuf_stream *st)
+{
+	const char *path = st->pb->spill ? st->pb->spill->path : "spill file";
+	const int count = get_block(st->in, path, st->payload, st->session,
+				    st->current_ua, st->mab);
+
+	if (count < 0)
+		return -1;
+
+	st->avail = count;
+	st->pos = 0;
+	return 0;
+}
+
+int powerbuf_stream_read(struct powerbuf_stream *st,
+			 unsigned int *current_ua, address_t *mab,
+			 unsigned int max)
+{
+	powerbuf_t pb = st->pb;
+	unsigned int n = 0;
+
+	if (max > st->left)
+		max = st->left;
+
+	while (n < max) {
+		unsigned int len = max - n;
+
+		if (!st->in) {
+			const unsigned int cont =
+				pb->max_samples - st->index;
+
+			if (len > cont)
+				len = cont;
+
+			memcpy(current_ua + n, pb->current_ua + st->index,
+			       sizeof(current_ua[0]) * len);
+			memcpy(mab + n, pb->mab + st->index,
+			       sizeof(mab[0]) * len);
+			st->index = (st->index + len) % pb->max_samples;
+		} else {
+			if (st->pos >= st->avail &&
+			    stream_next_block(st) < 0)
+				return -1;
+
+			if (len > st->avail - st->pos)
+				len = st->avail - st->pos;
+
+			memcpy(current_ua + n, st->current_ua + st->pos,
+			       sizeof(current_ua[0]) * len);
+			memcpy(mab + n, st->mab + st->pos,
+			       sizeof(mab[0]) * len);
+			st->pos += len;
+		}
+
+		n += len;
+	}
+
+	st->left -= n;
+	return n;
+}
+
+void powerbuf_stream_close(struct powerbuf_stream *st)
+{
+	if (st->in)
+		fclose(st->in);
+
+	free(st);
+}
+
+/************************************************************************
+ * Binary export
+ *
+ * An export file begins with a 16-byte header of little-endian 32-bit
+ * words:
+ *
+ *     magic, sample interval (us), session count, reserved (0)
+ *
+ * followed by a table with one 16-byte entry per session, oldest first,
+ * giving its start time and length as little-endian 64-bit words. The
+ * samples of each session follow in order, as blocks in the spill file
+ * format, numbered by position in the session table.
+ */
+
+#define EXPORT_MAGIC		0x31584250 /* "PBX1" */
+#define EXPORT_HEADER_SIZE	16
+#define EXPORT_SESSION_SIZE	16
+
+struct export_buf {
+	unsigned int		current_ua[SPILL_BLOCK_SAMPLES];
+	address_t		mab[SPILL_BLOCK_SAMPLES];
+	uint8_t			payload[SPILL_MAX_PAYLOAD];
+};
+
+static void put_le64(uint8_t *out, unsigned long long v)
+{
+	put_le32(out, v);
+	put_le32(out + 4, v >> 32);
+}
+
+static unsigned long long get_le64(const uint8_t *in)
+{
+	return ((unsigned long long)get_le32(in)) |
+		(((unsigned long long)get_le32(in + 4)) << 32);
+}
+
+static int export_session(powerbuf_t pb, FILE *out, const char *path,
+			  struct export_buf *buf, unsigned int n,
+			  unsigned int rev_idx)
+{
+	struct powerbuf_stream *st = powerbuf_stream_open(pb, rev_idx);
+	int count;
+
+	if (!st)
+		return -1;
+
+	while ((count = powerbuf_stream_read(st, buf->current_ua, buf->mab,
+					     SPILL_BLOCK_SAMPLES)) > 0)
+		if (put_block(out, buf->payload, n, count,
+			      buf->current_ua, buf->mab) < 0) {
+			printc_err("power: error writing to %s: %s\n",
+				   path, last_error());
+			count = -1;
+			break;
+		}
+
+	powerbuf_stream_close(st);
 	return count;
 }
+
+int powerbuf_export(powerbuf_t pb, const char *path)
+{
+	const unsigned int n = powerbuf_stream_sessions(pb);
+	uint8_t header[EXPORT_HEADER_SIZE];
+	struct export_buf *buf;
+	FILE *out;
+	unsigned int i;
+	int ret = 0;
+
+	buf = malloc(sizeof(*buf));
+	if (!buf) {
+		printc_err("power: can't allocate memory\n");
+		return -1;
+	}
+
+	out = fopen(path, "wb");
+	if (!out) {
+		printc_err("power: can't open %s: %s\n", path, last_error());
+		free(buf);
+		return -1;
+	}
+
+	put_le32(header, EXPORT_MAGIC);
+	put_le32(header + 4, pb->interval_us);
+	put_le32(header + 8, n);
+	put_le32(header + 12, 0);
+
+	if (fwrite(header, sizeof(header), 1, out) != 1)
+		ret = -1;
+
+	for (i = 0; !ret && i < n; i++) {
+		uint8_t ent[EXPORT_SESSION_SIZE];
+		struct powerbuf_stream_info info;
+
+		powerbuf_stream_info(pb, n - 1 - i, &info);
+		put_le64(ent, info.wall_clock);
+		put_le64(ent + 8, info.length);
+
+		if (fwrite(ent, sizeof(ent), 1, out) != 1)
+			ret = -1;
+	}
+
+	if (ret)
+		printc_err("power: error writing to %s: %s\n",
+			   path, last_error());
+
+	for (i = 0; !ret && i < n; i++)
+		ret = export_session(pb, out, path, buf, i, n - 1 - i);
+
+	if (fclose(out) < 0 && !ret) {
+		printc_err("power: error on close of %s: %s\n",
+			   path, last_error());
+		ret = -1;
+	}
+
+	free(buf);
+	return ret;
+}
+
+int powerbuf_import(powerbuf_t pb, const char *path)
+{
+	uint8_t header[EXPORT_HEADER_SIZE];
+	unsigned long long *lengths = NULL;
+	time_t *starts = NULL;
+	struct export_buf *buf;
+	unsigned int n = 0;
+	unsigned int i;
+	FILE *in;
+	int ret = -1;
+
+	buf = malloc(sizeof(*buf));
+	if (!buf) {
+		printc_err("power: can't allocate memory\n");
+		return -1;
+	}
+
+	in = fopen(path, "rb");
+	if (!in) {
+		printc_err("power: can't open %s: %s\n", path, last_error());
+		free(buf);
+		return -1;
+	}
+
+	if (fread(header, sizeof(header), 1, in) != 1 ||
+	    get_le32(header) != EXPORT_MAGIC) {
+		printc_err("power: %s: not a power export file\n", path);
+		goto out;
+	}
+
+	if (get_le32(header + 4) != pb->interval_us) {
+		printc_err("power: %s: sample interval is %u us, but this "
+			   "device samples every %u us\n", path,
+			   get_le32(header + 4), pb->interval_us);
+		goto out;
+	}
+
+	/* Read the whole session table before touching the buffer */
+	n = get_le32(header + 8);
+	starts = malloc(sizeof(starts[0]) * (n ? n : 1));
+	lengths = malloc(sizeof(lengths[0]) * (n ? n : 1));
+	if (!starts || !lengths) {
+		printc_err("power: can't allocate memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		uint8_t ent[EXPORT_SESSION_SIZE];
+
+		if (fread(ent, sizeof(ent), 1, in) != 1) {
+			printc_err("power: %s: unexpected end of file\n",
+				   path);
+			goto out;
+		}
+
+		starts[i] = get_le64(ent);
+		lengths[i] = get_le64(ent + 8);
+	}
+
+	powerbuf_clear(pb);
+
+	for (i = 0; i < n; i++) {
+		unsigned long long left = lengths[i];
+
+		powerbuf_begin_session(pb, starts[i]);
+
+		while (left) {
+			const int count = get_block(in, path, buf->payload, i,
+						    buf->current_ua, buf->mab);
+
+			if (count < 0) {
+				powerbuf_end_session(pb);
+				goto out;
+			}
+
+			if (count > left) {
+				printc_err("power: %s: invalid block\n",
+					   path);
+				powerbuf_end_session(pb);
+				goto out;
+			}
+
+			powerbuf_add_samples(pb, count, buf->current_ua,
+					     buf->mab);
+			left -= count;
+		}
+
+		powerbuf_end_session(pb);
+	}
+
+	ret = 0;
+out:
+	free(starts);
+	free(lengths);
+	fclose(in);
+	free(buf);
+	return ret;
+}
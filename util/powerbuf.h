@@ -47,6 +47,28 @@ struct powerbuf_session {
 #define POWERBUF_MAX_SESSIONS		8
 #define POWERBUF_DEFAULT_SAMPLES	131072
 
+/* Spill file state (see powerbuf_spill_start() below) */
+struct powerbuf_spill;
+
+/* Charge totals by MAB. This is a hash table with linear probing, and
+ * its capacity is always a power of two. Unused entries have a MAB of
+ * POWERBUF_MAB_NONE. Entries are never removed, although their totals
+ * may fall to zero.
+ */
+#define POWERBUF_MAB_NONE		0xffffffff
+
+struct powerbuf_mab_entry {
+	address_t			mab;
+	unsigned int			samples;
+	unsigned long long		sum_ua;
+};
+
+struct powerbuf_mab_table {
+	struct powerbuf_mab_entry	*ents;
+	unsigned int			capacity;
+	unsigned int			size;
+};
+
 /* Power buffer data structure. The power buffer contains three circular
  * buffers, two of which are dynamically allocated. Helper functions are
  * provided for managing access.
@@ -79,16 +101,19 @@ struct powerbuf {
 	unsigned int			current_head;
 	unsigned int			current_tail;
 
-	/* Index by MAB. This is a flat array which points to indices
-	 * within current_ua/mab. The indices are sorted in order of
-	 * increasing MAB.
-	 *
-	 * Note that this array is invalidated by any modification to
-	 * the sample buffers. You need to call powerbuf_sort() before
-	 * accessing it.
+	/* Totals by MAB of the samples held in the buffer. This is
+	 * updated as samples are added and as they drop out the tail.
 	 */
-	int				sort_valid;
-	unsigned int			*sorted;
+	struct powerbuf_mab_table	by_mab;
+
+	/* Number of samples stored since the buffer was created. This
+	 * is never reset, and serves as a sequence number for readers
+	 * following the buffer as it fills (see powerbuf_read_since()).
+	 */
+	unsigned long long		total_samples;
+
+	/* If not NULL, all samples are also being written to a file. */
+	struct powerbuf_spill		*spill;
 };
 
 typedef struct powerbuf *powerbuf_t;
@@ -131,11 +156,23 @@ void powerbuf_add_samples(powerbuf_t pb, unsigned int count,
 /* Retrieve the last known MAB for this session, or 0 if none exists. */
 address_t powerbuf_last_mab(powerbuf_t pb);
 
-/* Prepare the sorted MAB index. */
-void powerbuf_sort(powerbuf_t pb);
+/* Copy out samples in the order they were added, starting with the
+ * sample numbered *seq (numbering as for total_samples). Up to max
+ * samples are copied, and *seq is advanced past them. If the requested
+ * samples have already dropped out of the buffer, reading skips
+ * forward to the oldest sample still held, and the number skipped is
+ * added to *lost.
+ *
+ * Returns the number of samples copied, which is 0 once the reader has
+ * caught up.
+ */
+unsigned int powerbuf_read_since(powerbuf_t pb, unsigned long long *seq,
+				 unsigned long long *lost,
+				 unsigned int *current_ua, address_t *mab,
+				 unsigned int max);
 
-/* Obtain charge consumption data by MAB over all sessions. This
- * automatically calls powerbuf_sort() if necessary.
+/* Obtain charge consumption data by MAB over all sessions held in
+ * memory.
  *
  * Returns the number of samples found on success. The sum of all
  * current samples is written to the sum_ua argument.
@@ -143,4 +180,75 @@ void powerbuf_sort(powerbuf_t pb);
 int powerbuf_get_by_mab(powerbuf_t pb, address_t mab,
 			unsigned long long *sum_ua);
 
+/* Enumerate charge totals for each MAB over all sessions available
+ * through the stream interface (see below). MABs are given in no
+ * particular order, and may be given with a sample count of zero.
+ */
+typedef void (*powerbuf_mab_cb_t)(void *user_data, address_t mab,
+				  unsigned int samples,
+				  unsigned long long sum_ua);
+
+void powerbuf_enum_by_mab(powerbuf_t pb, powerbuf_mab_cb_t cb,
+			  void *user_data);
+
+/* Spill mode. While enabled, every sample added is also appended to the
+ * given file, in compressed blocks which are written by a background
+ * thread. Only the most recent samples are kept in memory as usual, but
+ * the stream interface below reads back every session in the file.
+ *
+ * The file is truncated when spill mode starts, and when the buffer is
+ * cleared. Stopping spill mode leaves it in place.
+ *
+ * powerbuf_spill_start() returns 0 on success or -1 if an error occurs.
+ * powerbuf_spill_path() returns NULL if spill mode isn't enabled.
+ */
+int powerbuf_spill_start(powerbuf_t pb, const char *path);
+void powerbuf_spill_stop(powerbuf_t pb);
+const char *powerbuf_spill_path(powerbuf_t pb);
+
+/* Streaming access to recorded sessions. In spill mode, this covers
+ * every session in the spill file, including samples which have since
+ * dropped out of memory. Otherwise, it covers the sessions held in
+ * memory. Sessions are indexed as for powerbuf_session_info(), and the
+ * most recent sessions have the same index in both.
+ */
+struct powerbuf_stream_info {
+	time_t			wall_clock;
+	unsigned long long	length;
+	unsigned long long	total_ua;
+};
+
+unsigned int powerbuf_stream_sessions(powerbuf_t pb);
+void powerbuf_stream_info(powerbuf_t pb, unsigned int rev_idx,
+			  struct powerbuf_stream_info *info);
+
+/* Read the samples of a session in order. powerbuf_stream_read() fills
+ * in up to max samples and returns the number read, which is 0 at the
+ * end of the session, or -1 if an error occurs. The buffer must not be
+ * modified while a stream is open.
+ */
+struct powerbuf_stream;
+
+struct powerbuf_stream *powerbuf_stream_open(powerbuf_t pb,
+					     unsigned int rev_idx);
+int powerbuf_stream_read(struct powerbuf_stream *st,
+			 unsigned int *current_ua, address_t *mab,
+			 unsigned int max);
+void powerbuf_stream_close(struct powerbuf_stream *st);
+
+/* Export every session available through the stream interface to a
+ * compact binary file, or import such a file. Samples are stored in
+ * columns, delta and varint-encoded as in the spill file.
+ *
+ * Importing replaces the contents of the buffer, and fails if the file
+ * was recorded with a different sample interval. If the file holds
+ * more samples than the buffer, only the most recent are kept (unless
+ * spill mode is enabled).
+ *
+ * Both functions return 0 on success or -1 if an error occurs. If an
+ * import fails part way, the buffer holds the sessions read so far.
+ */
+int powerbuf_export(powerbuf_t pb, const char *path);
+int powerbuf_import(powerbuf_t pb, const char *path);
+
 #endif
@@ -16,65 +16,392 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "device.h"
 #include "prog.h"
 #include "output.h"
+#include "vector.h"
+#include "opdb.h"
 
 void prog_init(struct prog_data *prog, int flags)
 {
 	memset(prog, 0, sizeof(*prog));
+	prog->dev = device_default;
 	prog->flags = flags;
 }
 
-int prog_flush(struct prog_data *prog)
+int prog_erase_flags(void)
 {
-	if (!prog->len)
-		return 0;
+	int flags = PROG_WANT_ERASE;
 
-	if (!prog->have_erased && (prog->flags & PROG_WANT_ERASE)) {
-		printc("Erasing...\n");
-		if (device_erase(DEVICE_ERASE_MAIN, 0) < 0)
-			return -1;
+	if (opdb_get_boolean("incremental_prog"))
+		flags |= PROG_INCREMENTAL;
+	if (opdb_get_boolean("sparse_erase"))
+		flags |= PROG_SPARSE_ERASE;
 
-		printc("Programming...\n");
-		prog->have_erased = 1;
-	}
+	return flags;
+}
+
+/* Write or verify a single piece of data, no larger than
+ * PROG_BUFSIZE.
+ */
+static int prog_piece(struct prog_data *prog, const char *section,
+		      address_t addr, const uint8_t *data, int len)
+{
+	device_t dev = prog->dev;
 
-	printc_dbg("%s %4d bytes at %04x",
+	/* One call per line, so that gang workers don't interleave */
+	printc_dbg("%s %4d bytes at %04x%s%s%s...\n",
 		   (prog->flags & PROG_VERIFY) ? "Verifying" : "Writing",
-		   prog->len, prog->addr);
-	if (prog->section[0])
-		printc_dbg(" [section: %s]", prog->section);
-	printc_dbg("...\n");
+		   len, addr,
+		   (section && section[0]) ? " [section: " : "",
+		   (section && section[0]) ? section : "",
+		   (section && section[0]) ? "]" : "");
 
 	if (prog->flags & PROG_VERIFY) {
 		uint8_t cmp_buf[PROG_BUFSIZE];
 		int i;
 
-		if (device_readmem(prog->addr, cmp_buf, prog->len) < 0)
+		/* Data is read back only if the checksums disagree, in
+		 * order to locate the first bad byte.
+		 */
+		i = device_verify_dev(dev, addr, data, len);
+		if (i < 0)
+			return -1;
+
+		if (i) {
+			prog->total_written += len;
+			return 0;
+		}
+
+		if (device_readmem_dev(dev, addr, cmp_buf, len) < 0)
 			return -1;
 
-		for (i = 0; i < prog->len; i++)
-			if (cmp_buf[i] != prog->buf[i]) {
+		for (i = 0; i < len; i++)
+			if (cmp_buf[i] != data[i]) {
 				printc("\x1b[1mERROR:\x1b[0m "
 				       "mismatch at %04x (read %02x, "
 				       "expected %02x)\n",
-				       prog->addr + i,
-				       cmp_buf[i], prog->buf[i]);
+				       addr + i,
+				       cmp_buf[i], data[i]);
 				return -1;
 			}
+
+		printc_dbg("Checksum mismatch at %04x, but data read "
+			   "back is correct\n", addr);
 	} else {
-		if (device_writemem(prog->addr, prog->buf, prog->len) < 0)
+		if (device_writemem_dev(dev, addr, data, len) < 0)
 			return -1;
 	}
 
-	prog->total_written += prog->len;
+	prog->total_written += len;
+	return 0;
+}
+
+/* Erase (if necessary), then write or verify a block of data. The block
+ * is processed in place, so it need not fit in the feed buffer.
+ */
+static int prog_block(struct prog_data *prog, const char *section,
+		      address_t addr, const uint8_t *data, address_t len)
+{
+	if (!prog->have_erased && (prog->flags & PROG_WANT_ERASE)) {
+		printc("Erasing...\n");
+		if (device_erase_dev(prog->dev, DEVICE_ERASE_MAIN, 0) < 0)
+			return -1;
+
+		printc("Programming...\n");
+		prog->have_erased = 1;
+	}
+
+	while (len) {
+		int count = len > PROG_BUFSIZE ? PROG_BUFSIZE : len;
+
+		if (prog_piece(prog, section, addr, data, count) < 0)
+			return -1;
+
+		addr += count;
+		data += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+int prog_flush(struct prog_data *prog)
+{
+	if (!prog->len)
+		return 0;
+
+	if (prog_block(prog, prog->section, prog->addr,
+		       prog->buf, prog->len) < 0)
+		return -1;
+
 	prog->addr += prog->len;
 	prog->len = 0;
 	return 0;
 }
 
+/* Is this a region of segmented main flash, which would be cleared by
+ * a main memory erase?
+ */
+static int is_main_flash(const struct chipinfo_memory *m)
+{
+	return m && m->type == CHIPINFO_MEMTYPE_FLASH && m->seg_size &&
+		!strcmp(m->name, "Main");
+}
+
+/* Bring a single flash segment up to date. The buffer holds the
+ * expected contents of the whole segment, and lo..hi is the range
+ * covered by image data.
+ */
+static int prog_segment(struct prog_data *prog, const char *section,
+			address_t base, const uint8_t *buf, address_t size,
+			address_t lo, address_t hi)
+{
+	int r = device_verify_dev(prog->dev, base, buf, size);
+
+	if (r < 0)
+		return -1;
+
+	prog->segs_checked++;
+
+	if (r) {
+		printc_dbg("Segment at %04x is unchanged\n", base);
+		return 0;
+	}
+
+	printc_dbg("Erasing segment at %04x...\n", base);
+	if (device_erase_dev(prog->dev, DEVICE_ERASE_SEGMENT, base) < 0)
+		return -1;
+
+	prog->segs_updated++;
+	return prog_block(prog, section, lo, buf + (lo - base), hi - lo);
+}
+
+/* Program an image segment by segment. Data destined for main flash is
+ * gathered into whole flash segments, which are then compared against
+ * the device. Anything else is written as usual.
+ */
+static int prog_incremental(struct prog_data *prog, const struct image *img)
+{
+	const struct chipinfo *chip = prog->dev->chip;
+	uint8_t *buf = NULL;
+	address_t buf_size = 0;
+	address_t offset = 0;
+	int i = 0;
+
+	printc("Programming incrementally...\n");
+	prog->have_erased = 1;
+
+	while (i < img->num_segs) {
+		const struct image_segment *s = &img->segs[i];
+		const struct chipinfo_memory *m;
+		address_t addr = s->addr + offset;
+		address_t len = check_range(chip, addr, s->len - offset, &m);
+		address_t base;
+		address_t end;
+		address_t lo;
+		address_t hi;
+
+		if (!is_main_flash(m)) {
+			if (prog_block(prog, s->section, addr,
+				       s->data + offset, len) < 0)
+				goto fail;
+
+			offset += len;
+			if (offset >= s->len) {
+				offset = 0;
+				i++;
+			}
+
+			continue;
+		}
+
+		base = addr - (addr - m->offset) % m->seg_size;
+		end = base + m->seg_size;
+		if (end > m->offset + m->size)
+			end = m->offset + m->size;
+
+		if (buf_size < end - base) {
+			uint8_t *n = realloc(buf, end - base);
+
+			if (!n) {
+				printc_err("prog: can't allocate memory\n");
+				goto fail;
+			}
+
+			buf = n;
+			buf_size = end - base;
+		}
+
+		/* Collect everything which falls within this segment */
+		memset(buf, 0xff, end - base);
+		lo = end;
+		hi = base;
+
+		while (i < img->num_segs) {
+			const struct image_segment *t = &img->segs[i];
+			address_t a = t->addr + offset;
+			address_t n = t->len - offset;
+
+			if (a >= end)
+				break;
+
+			/* Overlapping data from an earlier segment */
+			if (a < base) {
+				address_t skip = base - a;
+
+				if (skip > n)
+					skip = n;
+
+				a += skip;
+				n -= skip;
+				offset += skip;
+			}
+
+			if (a + n > end)
+				n = end - a;
+
+			if (n) {
+				memcpy(buf + (a - base), t->data + offset, n);
+
+				if (a < lo)
+					lo = a;
+				if (a + n > hi)
+					hi = a + n;
+			}
+
+			offset += n;
+			if (offset < t->len)
+				break;
+
+			offset = 0;
+			i++;
+		}
+
+		if (prog_segment(prog, s->section, base, buf, end - base,
+				 lo, hi) < 0)
+			goto fail;
+	}
+
+	free(buf);
+	printc("%d of %d flash segments updated\n",
+	       prog->segs_updated, prog->segs_checked);
+	return 0;
+
+fail:
+	free(buf);
+	return -1;
+}
+
+/* Work out which segments of main flash are touched by the image, and
+ * erase only those. If every segment would be erased, a single main
+ * memory erase is issued instead.
+ */
+static int prog_erase_plan(struct prog_data *prog, const struct image *img)
+{
+	const struct chipinfo *chip = prog->dev->chip;
+	const struct chipinfo_memory *m;
+	struct vector plan;
+	int main_segs = 0;
+	int ret = -1;
+	int i;
+
+	for (m = chip->memory; m->name; m++)
+		if (is_main_flash(m))
+			main_segs += m->size / m->seg_size;
+
+	vector_init(&plan, sizeof(address_t));
+
+	for (i = 0; i < img->num_segs; i++) {
+		const struct image_segment *s = &img->segs[i];
+		address_t addr = s->addr;
+		address_t end = s->addr + s->len;
+
+		while (addr < end) {
+			address_t len = check_range(chip, addr, end - addr, &m);
+			address_t base;
+
+			if (!is_main_flash(m)) {
+				addr += len;
+				continue;
+			}
+
+			base = addr - (addr - m->offset) % m->seg_size;
+
+			/* Segments are visited in ascending order, so
+			 * duplicates are always adjacent.
+			 */
+			if (!plan.size ||
+			    VECTOR_AT(plan, plan.size - 1, address_t) != base)
+				if (vector_push(&plan, &base, 1) < 0) {
+					printc_err("prog: can't allocate "
+						   "memory\n");
+					goto out;
+				}
+
+			addr = base + m->seg_size;
+		}
+	}
+
+	prog->have_erased = 1;
+
+	if (plan.size && plan.size >= main_segs) {
+		printc("Erasing...\n");
+		if (device_erase_dev(prog->dev, DEVICE_ERASE_MAIN, 0) < 0)
+			goto out;
+	} else if (plan.size) {
+		printc("Erasing %d of %d segments...\n",
+		       plan.size, main_segs);
+
+		for (i = 0; i < plan.size; i++) {
+			address_t base = VECTOR_AT(plan, i, address_t);
+
+			printc_dbg("Erasing segment at %04x...\n", base);
+			if (device_erase_dev(prog->dev, DEVICE_ERASE_SEGMENT,
+					     base) < 0)
+				goto out;
+		}
+	}
+
+	printc("Programming...\n");
+	ret = 0;
+
+out:
+	vector_destroy(&plan);
+	return ret;
+}
+
+int prog_image(struct prog_data *prog, const struct image *img)
+{
+	int i;
+
+	if (prog_flush(prog) < 0)
+		return -1;
+
+	if ((prog->flags & PROG_INCREMENTAL) &&
+	    (prog->flags & PROG_WANT_ERASE) && !prog->have_erased &&
+	    prog->dev->chip && !device_is_fram(prog->dev))
+		return prog_incremental(prog, img);
+
+	if ((prog->flags & PROG_SPARSE_ERASE) &&
+	    (prog->flags & PROG_WANT_ERASE) && !prog->have_erased &&
+	    prog->dev->chip && !device_is_fram(prog->dev) &&
+	    prog_erase_plan(prog, img) < 0)
+		return -1;
+
+	for (i = 0; i < img->num_segs; i++) {
+		const struct image_segment *s = &img->segs[i];
+
+		if (prog_block(prog, s->section, s->addr,
+			       s->data, s->len) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 int prog_feed(struct prog_data *prog, const struct binfile_chunk *ch)
 {
 	const char *section = ch->name ? ch->name : "";
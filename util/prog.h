@@ -20,10 +20,17 @@
 #define PROG_H_
 
 #include "binfile.h"
+#include "image.h"
+#include "device.h"
 
 #define PROG_BUFSIZE    4096
 
 struct prog_data {
+	/* Device to be programmed. This is set to the default device by
+	 * prog_init(), but may be changed before feeding data.
+	 */
+	device_t	dev;
+
 	char		section[64];
 
 	uint8_t         buf[PROG_BUFSIZE];
@@ -34,13 +41,41 @@ struct prog_data {
 	int             have_erased;
 
 	address_t	total_written;
+
+	/* Flash segments examined and rewritten in incremental mode */
+	int		segs_checked;
+	int		segs_updated;
 };
 
 #define PROG_WANT_ERASE		0x01
 #define PROG_VERIFY		0x02
 
+/* Instead of erasing all of main memory, compare each flash segment
+ * touched by the image against the device, and erase and rewrite only
+ * those which differ. This applies only to prog_image(), and only in
+ * combination with PROG_WANT_ERASE.
+ */
+#define PROG_INCREMENTAL	0x04
+
+/* Instead of erasing all of main memory, erase only those flash
+ * segments touched by the image. This applies only to prog_image(),
+ * and only in combination with PROG_WANT_ERASE.
+ */
+#define PROG_SPARSE_ERASE	0x08
+
 void prog_init(struct prog_data *data, int flags);
+
+/* Flags for an erase-and-program operation, as selected by the
+ * incremental_prog and sparse_erase options.
+ */
+int prog_erase_flags(void);
 int prog_feed(struct prog_data *data, const struct binfile_chunk *ch);
 int prog_flush(struct prog_data *data);
 
+/* Program or verify every segment of a decoded image. Segments are
+ * passed to the device directly, without copying them through the
+ * feed buffer.
+ */
+int prog_image(struct prog_data *data, const struct image *img);
+
 #endif
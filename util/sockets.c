@@ -147,6 +147,53 @@ ssize_t sockets_recv(SOCKET s, void *buf, size_t len, int flags,
 	sockets_end(s);
 	return ret;
 }
+
+/* select() can't wait on the Ctrl+C event, so wait in short slices
+ * and check it in between.
+ */
+#define WAIT_SLICE_MS		50
+
+int sockets_wait_readable(const SOCKET *s, int count, int *ready,
+			  int timeout_ms)
+{
+	for (;;) {
+		int slice = WAIT_SLICE_MS;
+		struct timeval to;
+		fd_set r;
+		int n = 0;
+		int i;
+
+		if (ctrlc_check()) {
+			WSASetLastError(ERROR_OPERATION_ABORTED);
+			return -1;
+		}
+
+		if (timeout_ms >= 0 && timeout_ms < slice)
+			slice = timeout_ms;
+
+		to.tv_sec = 0;
+		to.tv_usec = slice * 1000;
+
+		FD_ZERO(&r);
+		for (i = 0; i < count; i++)
+			FD_SET(s[i], &r);
+
+		if (select(0, &r, NULL, NULL, &to) == SOCKET_ERROR)
+			return -1;
+
+		for (i = 0; i < count; i++) {
+			ready[i] = FD_ISSET(s[i], &r);
+			if (ready[i])
+				n++;
+		}
+
+		if (n || !timeout_ms)
+			return n;
+
+		if (timeout_ms > 0)
+			timeout_ms -= slice;
+	}
+}
 #else /* __Windows__ */
 SOCKET sockets_accept(SOCKET s, struct sockaddr *addr, socklen_t *addrlen)
 {
@@ -189,4 +236,36 @@ ssize_t sockets_recv(SOCKET s, void *buf, size_t buf_len, int flags,
 
 	return recv(s, buf, buf_len, flags);
 }
+
+int sockets_wait_readable(const SOCKET *s, int count, int *ready,
+			  int timeout_ms)
+{
+	struct timeval to = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000
+	};
+	SOCKET max = 0;
+	fd_set r;
+	int n = 0;
+	int i;
+
+	FD_ZERO(&r);
+	for (i = 0; i < count; i++) {
+		FD_SET(s[i], &r);
+		if (s[i] > max)
+			max = s[i];
+	}
+
+	if (select(max + 1, &r, NULL, NULL,
+		   timeout_ms < 0 ? NULL : &to) < 0)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		ready[i] = FD_ISSET(s[i], &r);
+		if (ready[i])
+			n++;
+	}
+
+	return n;
+}
 #endif
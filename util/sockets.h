@@ -30,6 +30,7 @@ typedef int socklen_t;
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -38,6 +39,7 @@ typedef int socklen_t;
 
 typedef int SOCKET;
 
+#define INVALID_SOCKET	(-1)
 #define SOCKET_ISERR(x) ((x) < 0)
 #endif
 
@@ -50,4 +52,15 @@ ssize_t sockets_send(SOCKET s, const void *buf, size_t len, int flags);
 ssize_t sockets_recv(SOCKET s, void *buf, size_t len, int flags,
 		     int timeout_ms, int *was_timeout);
 
+/* Wait until at least one of the given sockets is readable (or, for a
+ * listening socket, has a connection pending). A negative timeout
+ * waits forever. On return, ready[i] is non-zero for each readable
+ * socket.
+ *
+ * Returns the number of readable sockets, 0 if the timeout expired, or
+ * -1 if an error occurs or the wait is interrupted by Ctrl+C.
+ */
+int sockets_wait_readable(const SOCKET *s, int count, int *ready,
+			  int timeout_ms);
+
 #endif
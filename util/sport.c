@@ -52,6 +52,9 @@ struct baud_rate {
 
 static const struct baud_rate baud_rates[] = {
 	{9600,          B9600},
+	{19200,         B19200},
+	{38400,         B38400},
+	{57600,         B57600},
 	{115200,        B115200},
 	{460800,        B460800},
 	{500000,        B500000}
@@ -163,6 +166,24 @@ int sport_flush(sport_t s)
 	return tcflush(s, TCIFLUSH);
 }
 
+int sport_set_rate(sport_t s, int rate)
+{
+	struct termios attr;
+	int rate_code = rate_to_code(rate);
+
+	if (tcgetattr(s, &attr) < 0)
+		return -1;
+
+	if (rate_code >= 0) {
+		cfsetispeed(&attr, rate_code);
+		cfsetospeed(&attr, rate_code);
+	} else if (set_nonstandard_rate(s, &attr, rate) < 0) {
+		return -1;
+	}
+
+	return tcsetattr(s, TCSADRAIN, &attr);
+}
+
 int sport_set_modem(sport_t s, int bits)
 {
 	return ioctl(s, TIOCMSET, &bits);
@@ -201,6 +222,25 @@ int sport_write(sport_t s, const uint8_t *data, int len)
 	return write(s, data, len);
 }
 
+int sport_wait_input(sport_t s, int timeout_ms)
+{
+	struct timeval tv = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000
+	};
+	fd_set set;
+	int r;
+
+	FD_ZERO(&set);
+	FD_SET(s, &set);
+
+	r = select(s + 1, &set, NULL, NULL, &tv);
+	if (r < 0)
+		return -1;
+
+	return r > 0;
+}
+
 #else /* __Windows__ */
 
 sport_t sport_open(const char *device, int rate, int flags)
@@ -252,6 +292,21 @@ int sport_flush(sport_t s)
 	return 0;
 }
 
+int sport_set_rate(sport_t s, int rate)
+{
+	DCB params = {0};
+
+	if (!FlushFileBuffers(s) || !GetCommState(s, &params))
+		return -1;
+
+	params.BaudRate = rate;
+
+	if (!SetCommState(s, &params))
+		return -1;
+
+	return 0;
+}
+
 int sport_set_modem(sport_t s, int bits)
 {
 	if (!EscapeCommFunction(s, (bits & SPORT_MC_DTR) ? SETDTR : CLRDTR))
@@ -312,6 +367,26 @@ int sport_write(sport_t s, const uint8_t *data, int len)
 	return xfer_wait(s, &ovl);
 }
 
+int sport_wait_input(sport_t s, int timeout_ms)
+{
+	for (;;) {
+		COMSTAT stat;
+		DWORD errors;
+
+		if (!ClearCommError(s, &errors, &stat))
+			return -1;
+
+		if (stat.cbInQue)
+			return 1;
+
+		if (timeout_ms <= 0)
+			return 0;
+
+		Sleep(timeout_ms < 10 ? timeout_ms : 10);
+		timeout_ms -= 10;
+	}
+}
+
 #endif
 
 int sport_read_all(sport_t s, uint8_t *data, int len)
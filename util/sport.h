@@ -54,6 +54,11 @@ sport_t sport_open(const char *device, int rate, int flags);
 void sport_close(sport_t s);
 
 int sport_flush(sport_t s);
+
+/* Change the baud rate of an open port, after any pending output has
+ * been sent. Returns 0 on success or -1 if an error occurs.
+ */
+int sport_set_rate(sport_t s, int rate);
 int sport_set_modem(sport_t s, int bits);
 
 /* Read/write a serial port. These functions return the number of
@@ -62,6 +67,11 @@ int sport_set_modem(sport_t s, int bits);
 int sport_read(sport_t s, uint8_t *data, int len);
 int sport_write(sport_t s, const uint8_t *data, int len);
 
+/* Wait up to the given time for input to arrive. Returns 1 if there
+ * is input waiting, 0 if not, or -1 if an error occurs.
+ */
+int sport_wait_input(sport_t s, int timeout_ms);
+
 /* Same as above, but requires that all data be transferred. */
 int sport_read_all(sport_t s, uint8_t *data, int len);
 int sport_write_all(sport_t s, const uint8_t *data, int len);
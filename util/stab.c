@@ -109,6 +109,218 @@ static const struct btree_def addr_table_def = {
 	.data_size = 0
 };
 
+/************************************************************************
+ * Bulk-loaded tables
+ *
+ * Symbols loaded in bulk are kept in a single array sorted by address,
+ * with names referring to the caller's string table in place (or to a
+ * string pool, for a table frozen from the B+Trees). The name index is
+ * only built when a name is first looked up. While a table is loaded,
+ * the B+Trees are empty.
+ *
+ * Address lookups search a copy of the addresses in Eytzinger order
+ * (the implicit layout of a complete binary search tree, 1-based, with
+ * the children of k at 2k and 2k+1). The first few levels share a few
+ * cache lines, and the search has no unpredictable branches.
+ */
+
+struct stab_table {
+	struct stab_entry	*ents;
+	int			count;
+	/* Names, in a pool owned by the table */
+	char			*strings;
+
+	/* Indices of ents, sorted by name and then by seq. Built on
+	 * demand.
+	 */
+	uint32_t		*by_name;
+
+	/* Addresses in Eytzinger order, and the index in ents of each.
+	 * Element 0 is unused. If these couldn't be allocated, lookups
+	 * fall back to a binary search of ents.
+	 */
+	address_t		*eyt_addr;
+	uint32_t		*eyt_index;
+};
+
+static struct stab_table *table;
+
+/* qsort() has no context argument */
+static const struct stab_table *sort_table;
+
+static const char *entry_name(const struct stab_table *t,
+			      const struct stab_entry *e)
+{
+	return t->strings + e->name;
+}
+
+static int entry_addr_compare(const void *left, const void *right)
+{
+	const struct stab_entry *l = (const struct stab_entry *)left;
+	const struct stab_entry *r = (const struct stab_entry *)right;
+	int c;
+
+	if (l->addr < r->addr)
+		return -1;
+	if (l->addr > r->addr)
+		return 1;
+
+	c = strcmp(entry_name(sort_table, l), entry_name(sort_table, r));
+	if (c)
+		return c;
+
+	return l->seq < r->seq ? -1 : 1;
+}
+
+static int entry_name_compare(const void *left, const void *right)
+{
+	const struct stab_entry *l =
+		&sort_table->ents[*(const uint32_t *)left];
+	const struct stab_entry *r =
+		&sort_table->ents[*(const uint32_t *)right];
+	int c = strcmp(entry_name(sort_table, l), entry_name(sort_table, r));
+
+	if (c)
+		return c;
+
+	return l->seq < r->seq ? -1 : 1;
+}
+
+static void table_free(void)
+{
+	if (!table)
+		return;
+
+	free(table->strings);
+	free(table->ents);
+	free(table->by_name);
+	free(table->eyt_addr);
+	free(table->eyt_index);
+	free(table);
+	table = NULL;
+}
+
+static int table_build_name_index(struct stab_table *t)
+{
+	int i;
+
+	t->by_name = malloc(sizeof(t->by_name[0]) * (t->count + 1));
+	if (!t->by_name) {
+		printc_err("stab: can't allocate name index\n");
+		return -1;
+	}
+
+	for (i = 0; i < t->count; i++)
+		t->by_name[i] = i;
+
+	sort_table = t;
+	qsort(t->by_name, t->count, sizeof(t->by_name[0]),
+	      entry_name_compare);
+	return 0;
+}
+
+/* Find the last definition of the given name */
+static const struct stab_entry *table_find(struct stab_table *t,
+					   const char *name)
+{
+	const struct stab_entry *found = NULL;
+	int lo = 0;
+	int hi = t->count;
+
+	if (!t->by_name && table_build_name_index(t) < 0)
+		return NULL;
+
+	/* Find the first index whose name is greater than the one
+	 * we're looking for.
+	 */
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+		const struct stab_entry *e = &t->ents[t->by_name[mid]];
+
+		if (strcmp(entry_name(t, e), name) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo > 0) {
+		found = &t->ents[t->by_name[lo - 1]];
+		if (strcmp(entry_name(t, found), name))
+			found = NULL;
+	}
+
+	return found;
+}
+
+/* Fill the Eytzinger arrays by an in-order walk of the implicit tree.
+ * Returns the next index of ents to be placed.
+ */
+static uint32_t eyt_fill(struct stab_table *t, uint32_t i, uint32_t k)
+{
+	if (k > t->count)
+		return i;
+
+	i = eyt_fill(t, i, k * 2);
+	t->eyt_addr[k] = t->ents[i].addr;
+	t->eyt_index[k] = i;
+
+	return eyt_fill(t, i + 1, k * 2 + 1);
+}
+
+static void table_build_eytzinger(struct stab_table *t)
+{
+	t->eyt_addr = malloc(sizeof(t->eyt_addr[0]) * (t->count + 1));
+	t->eyt_index = malloc(sizeof(t->eyt_index[0]) * (t->count + 1));
+
+	if (!(t->eyt_addr && t->eyt_index)) {
+		free(t->eyt_addr);
+		free(t->eyt_index);
+		t->eyt_addr = NULL;
+		t->eyt_index = NULL;
+		return;
+	}
+
+	eyt_fill(t, 0, 1);
+}
+
+/* Find the last entry whose address is no greater than addr */
+static const struct stab_entry *table_nearest(const struct stab_table *t,
+					      address_t addr)
+{
+	int lo = 0;
+	int hi = t->count;
+
+	if (t->eyt_addr) {
+		uint32_t k = 1;
+
+		/* Descend to the right past every element <= addr */
+		while (k <= t->count)
+			k = k * 2 + (t->eyt_addr[k] <= addr);
+
+		/* Undo the right turns taken after the last left turn,
+		 * and that left turn itself. This leaves the first
+		 * element greater than addr, or 0 if there isn't one.
+		 */
+		while (k & 1)
+			k >>= 1;
+		k >>= 1;
+
+		hi = k ? t->eyt_index[k] : t->count;
+		return hi ? &t->ents[hi - 1] : NULL;
+	}
+
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (t->ents[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? &t->ents[lo - 1] : NULL;
+}
+
 /************************************************************************
  * Symbol table methods
  */
@@ -116,13 +328,320 @@ static const struct btree_def addr_table_def = {
 static btree_t         stab_sym;
 static btree_t         stab_addr;
 
+static int tree_set(const char *name, int value);
+
+static int index_compare(const void *left, const void *right)
+{
+	const uint32_t l = *(const uint32_t *)left;
+	const uint32_t r = *(const uint32_t *)right;
+
+	if (l < r)
+		return -1;
+
+	return l > r;
+}
+
+/* Convert a loaded table into ordinary symbols. Where a name is defined
+ * more than once, the last definition wins, just as if the symbols had
+ * been set one at a time. The B+Trees are empty while a table is
+ * loaded, so they can be built directly from sorted arrays.
+ */
+static int table_thaw(void)
+{
+	struct sym_key *skeys;
+	struct addr_key *akeys;
+	void *keys;
+	address_t *addrs;
+	uint32_t *win;
+	int ret = -1;
+	int n = 0;
+	int i;
+
+	if (!table)
+		return 0;
+
+	if (!table->by_name && table_build_name_index(table) < 0)
+		return -1;
+
+	/* Keys are large, so the same buffer is used for each tree */
+	keys = malloc(sizeof(*akeys) * (table->count + 1));
+	addrs = malloc(sizeof(addrs[0]) * (table->count + 1));
+	win = malloc(sizeof(win[0]) * (table->count + 1));
+	skeys = keys;
+	akeys = keys;
+
+	if (!(keys && addrs && win)) {
+		printc_err("stab: can't allocate memory\n");
+		goto out;
+	}
+
+	/* Truncating names to the key size preserves their order, so
+	 * entries with the same key are adjacent in the name index.
+	 */
+	for (i = 0; i < table->count; i++) {
+		const uint32_t idx = table->by_name[i];
+
+		sym_key_init(&skeys[n], entry_name(table, &table->ents[idx]));
+
+		if (n && !strcmp(skeys[n - 1].name, skeys[n].name)) {
+			if (table->ents[idx].seq > table->ents[win[n - 1]].seq)
+				win[n - 1] = idx;
+			continue;
+		}
+
+		win[n++] = idx;
+	}
+
+	for (i = 0; i < n; i++)
+		addrs[i] = table->ents[win[i]].addr;
+
+	if (btree_bulk_load(stab_sym, skeys, addrs, n) < 0)
+		goto out;
+
+	/* The table is in address order already */
+	qsort(win, n, sizeof(win[0]), index_compare);
+	for (i = 0; i < n; i++) {
+		const struct stab_entry *e = &table->ents[win[i]];
+
+		addr_key_init(&akeys[i], e->addr, entry_name(table, e));
+	}
+
+	if (btree_bulk_load(stab_addr, akeys, NULL, n) < 0) {
+		btree_clear(stab_sym);
+		goto out;
+	}
+
+	table_free();
+	ret = 0;
+ out:
+	free(keys);
+	free(addrs);
+	free(win);
+	return ret;
+}
+
 void stab_clear(void)
 {
+	table_free();
 	btree_clear(stab_sym);
 	btree_clear(stab_addr);
 }
 
+static int tree_is_empty(void)
+{
+	struct sym_key skey;
+
+	return btree_select(stab_sym, NULL, BTREE_FIRST, &skey, NULL) != 0;
+}
+
+/* Copy the names referred to by the entries into a new pool, and
+ * point the entries at the copies.
+ */
+static char *copy_names(struct stab_entry *ents, int count,
+			const char *strings)
+{
+	size_t pool_size = 0;
+	char *pool;
+	int i;
+
+	for (i = 0; i < count; i++)
+		pool_size += strlen(strings + ents[i].name) + 1;
+
+	pool = malloc(pool_size ? pool_size : 1);
+	if (!pool)
+		return NULL;
+
+	pool_size = 0;
+	for (i = 0; i < count; i++) {
+		const char *name = strings + ents[i].name;
+		const size_t len = strlen(name) + 1;
+
+		memcpy(pool + pool_size, name, len);
+		ents[i].name = pool_size;
+		pool_size += len;
+	}
+
+	return pool;
+}
+
+int stab_load(struct stab_entry *ents, int count, const char *strings)
+{
+	struct stab_table *t;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		ents[i].seq = i;
+
+	if (table || !tree_is_empty()) {
+		if (table_thaw() < 0)
+			ret = -1;
+
+		for (i = 0; i < count && !ret; i++)
+			ret = tree_set(strings + ents[i].name, ents[i].addr);
+
+		if (!ret)
+			ret = stab_freeze();
+
+		free(ents);
+		return ret;
+	}
+
+	t = malloc(sizeof(*t));
+	if (t)
+		t->strings = copy_names(ents, count, strings);
+
+	if (!(t && t->strings)) {
+		printc_err("stab: can't allocate memory\n");
+		free(t);
+		free(ents);
+		return -1;
+	}
+
+	t->ents = ents;
+	t->count = count;
+	t->by_name = NULL;
+
+	sort_table = t;
+	qsort(ents, count, sizeof(ents[0]), entry_addr_compare);
+	table_build_eytzinger(t);
+
+	table = t;
+	return 0;
+}
+
+int stab_freeze(void)
+{
+	struct stab_table *t;
+	const void *k;
+	size_t pool_size = 0;
+	char *pool;
+	int count = 0;
+	int ret;
+
+	if (table)
+		return 0;
+
+	/* Measure the symbols and their names */
+	ret = btree_select_ptr(stab_addr, NULL, BTREE_FIRST, &k, NULL);
+	while (!ret) {
+		const struct addr_key *akey = k;
+
+		count++;
+		pool_size += strlen(akey->name) + 1;
+		ret = btree_select_ptr(stab_addr, NULL, BTREE_NEXT, &k, NULL);
+	}
+
+	if (!count)
+		return 0;
+
+	t = malloc(sizeof(*t));
+	pool = malloc(pool_size);
+	if (t)
+		t->ents = malloc(sizeof(t->ents[0]) * count);
+
+	if (!(t && pool && t->ents)) {
+		printc_err("stab: can't allocate memory\n");
+		if (t)
+			free(t->ents);
+		free(t);
+		free(pool);
+		return -1;
+	}
+
+	/* The address tree is already in table order, and names are
+	 * unique, so they can be stored in order in a single pool.
+	 */
+	pool_size = 0;
+	count = 0;
+	ret = btree_select_ptr(stab_addr, NULL, BTREE_FIRST, &k, NULL);
+	while (!ret) {
+		const struct addr_key *akey = k;
+		struct stab_entry *e = &t->ents[count];
+		const size_t len = strlen(akey->name) + 1;
+
+		e->addr = akey->addr;
+		e->name = pool_size;
+		e->seq = count++;
+		memcpy(pool + pool_size, akey->name, len);
+		pool_size += len;
+
+		ret = btree_select_ptr(stab_addr, NULL, BTREE_NEXT, &k, NULL);
+	}
+
+	t->count = count;
+	t->strings = pool;
+	t->by_name = NULL;
+	table_build_eytzinger(t);
+
+	btree_clear(stab_sym);
+	btree_clear(stab_addr);
+	table = t;
+	return 0;
+}
+
+static int entry_seq_compare(const void *left, const void *right)
+{
+	const struct stab_entry *l = (const struct stab_entry *)left;
+	const struct stab_entry *r = (const struct stab_entry *)right;
+
+	return l->seq < r->seq ? -1 : 1;
+}
+
+int stab_save(struct stab_entry **ents_ret, int *count_ret,
+	      char **strings_ret)
+{
+	struct stab_entry *ents;
+	size_t pool_size = 1;
+	char *pool;
+	int i;
+
+	if (stab_freeze() < 0)
+		return -1;
+
+	*ents_ret = NULL;
+	*count_ret = 0;
+	*strings_ret = NULL;
+
+	if (!table)
+		return 0;
+
+	for (i = 0; i < table->count; i++) {
+		const struct stab_entry *e = &table->ents[i];
+		const size_t end = e->name + strlen(entry_name(table, e)) + 1;
+
+		if (end > pool_size)
+			pool_size = end;
+	}
+
+	ents = malloc(sizeof(ents[0]) * (table->count ? table->count : 1));
+	pool = malloc(pool_size);
+	if (!(ents && pool)) {
+		printc_err("stab: can't allocate memory\n");
+		free(ents);
+		free(pool);
+		return -1;
+	}
+
+	memcpy(ents, table->ents, sizeof(ents[0]) * table->count);
+	memcpy(pool, table->strings, pool_size);
+	qsort(ents, table->count, sizeof(ents[0]), entry_seq_compare);
+
+	*ents_ret = ents;
+	*count_ret = table->count;
+	*strings_ret = pool;
+	return 0;
+}
+
 int stab_set(const char *name, int value)
+{
+	if (table_thaw() < 0)
+		return -1;
+
+	return tree_set(name, value);
+}
+
+static int tree_set(const char *name, int value)
 {
 	struct sym_key skey;
 	struct addr_key akey;
@@ -154,17 +673,32 @@ int stab_nearest(address_t addr, char *ret_name, int max_len,
 		 address_t *ret_offset)
 {
 	struct addr_key akey;
+	const void *k;
 	int i;
 
+	if (table) {
+		const struct stab_entry *e = table_nearest(table, addr);
+
+		if (!e)
+			return -1;
+
+		strncpy(ret_name, entry_name(table, e), max_len);
+		ret_name[max_len - 1] = 0;
+		*ret_offset = addr - e->addr;
+		return 0;
+	}
+
 	akey.addr = addr;
 	for (i = 0; i < sizeof(akey.name); i++)
 		akey.name[i] = 0xff;
 	akey.name[sizeof(akey.name) - 1] = 0xff;
 
-	if (!btree_select(stab_addr, &akey, BTREE_LE, &akey, NULL)) {
-		strncpy(ret_name, akey.name, max_len);
+	if (!btree_select_ptr(stab_addr, &akey, BTREE_LE, &k, NULL)) {
+		const struct addr_key *found = k;
+
+		strncpy(ret_name, found->name, max_len);
 		ret_name[max_len - 1] = 0;
-		*ret_offset = addr - akey.addr;
+		*ret_offset = addr - found->addr;
 		return 0;
 	}
 
@@ -176,6 +710,16 @@ int stab_get(const char *name, address_t *value)
 	struct sym_key skey;
 	address_t addr;
 
+	if (table) {
+		const struct stab_entry *e = table_find(table, name);
+
+		if (!e)
+			return -1;
+
+		*value = e->addr;
+		return 0;
+	}
+
 	sym_key_init(&skey, name);
 	if (btree_get(stab_sym, &skey, &addr))
 		return -1;
@@ -190,6 +734,12 @@ int stab_del(const char *name)
 	address_t value;
 	struct addr_key akey;
 
+	if (table && !table_find(table, name))
+		return -1;
+
+	if (table_thaw() < 0)
+		return -1;
+
 	sym_key_init(&skey, name);
 	if (btree_get(stab_sym, &skey, &value))
 		return -1;
@@ -204,15 +754,28 @@ int stab_del(const char *name)
 int stab_enum(stab_callback_t cb, void *user_data)
 {
 	int ret;
-	struct addr_key akey;
+	const void *k;
+
+	if (table) {
+		int i;
 
-	ret = btree_select(stab_addr, NULL, BTREE_FIRST,
-			   &akey, NULL);
+		for (i = 0; i < table->count; i++) {
+			const struct stab_entry *e = &table->ents[i];
+
+			if (cb(user_data, entry_name(table, e), e->addr) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	ret = btree_select_ptr(stab_addr, NULL, BTREE_FIRST, &k, NULL);
 	while (!ret) {
-		if (cb(user_data, akey.name, akey.addr) < 0)
+		const struct addr_key *akey = k;
+
+		if (cb(user_data, akey->name, akey->addr) < 0)
 			return -1;
-		ret = btree_select(stab_addr, NULL, BTREE_NEXT,
-				   &akey, NULL);
+		ret = btree_select_ptr(stab_addr, NULL, BTREE_NEXT, &k, NULL);
 	}
 
 	return 0;
@@ -238,6 +801,7 @@ int stab_init(void)
 
 void stab_exit(void)
 {
+	table_free();
 	btree_free(stab_sym);
 	btree_free(stab_addr);
 }
@@ -54,6 +54,48 @@ int stab_get(const char *name, address_t *value);
  */
 int stab_del(const char *name);
 
+/* Load a table of symbols in bulk, taking ownership of the entry array
+ * (which must be allocated with malloc()). Entries are given in the
+ * order in which they'd otherwise have been passed to stab_set(), and
+ * names are offsets into a string table. The names are copied, so the
+ * string table need only remain valid for the duration of the call.
+ *
+ * If the symbol table is empty, the entries are adopted as-is: sorted
+ * by address, and with the name index built only when a name is first
+ * looked up. If a name appears more than once, lookups by name find the
+ * last definition, but each definition is used for address lookups.
+ * Any later modification converts the entries to ordinary symbols. A
+ * bulk load into a non-empty table is applied as a series of
+ * stab_set() calls, and the result is then frozen (see stab_freeze()).
+ *
+ * Returns 0 on success or -1 on error. The entry array is kept by the
+ * symbol table on success, and freed on error.
+ */
+struct stab_entry {
+	address_t		addr;
+	uint32_t		name;
+
+	/* Position in the order given. Filled in by stab_load(). */
+	uint32_t		seq;
+};
+
+int stab_load(struct stab_entry *ents, int count, const char *strings);
+
+/* Convert the symbols into a compact read-only table, which is faster
+ * to search by address. The table is converted back automatically if
+ * it's modified. This should be called after loading a batch of
+ * symbols. Returns 0 on success or -1 on error.
+ */
+int stab_freeze(void);
+
+/* Copy the symbol table, freezing it first. The entries are given in
+ * their original order, so that passing them to stab_load() after
+ * stab_clear() recreates the same table. The entry array and string
+ * table are allocated with malloc(), and are NULL if the table is
+ * empty. Returns 0 on success or -1 on error.
+ */
+int stab_save(struct stab_entry **ents, int *count, char **strings);
+
 /* Enumerate all symbols in the table */
 typedef int (*stab_callback_t)(void *user_data,
 			       const char *name, address_t value);
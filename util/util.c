@@ -322,6 +322,21 @@ int delay_ms(unsigned int s)
 }
 #endif
 
+#ifdef __Windows__
+unsigned long long time_ms(void)
+{
+	return GetTickCount64();
+}
+#else
+unsigned long long time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+#endif
+
 int base64_encode(const uint8_t *src, int len, char *dst, int max_len)
 {
 	static const char basis[] =
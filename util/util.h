@@ -63,6 +63,11 @@ char *expand_tilde(const char *path);
 int delay_s(unsigned int s);
 int delay_ms(unsigned int s);
 
+/* Fetch a monotonic timestamp, in milliseconds. This is only useful for
+ * measuring intervals.
+ */
+unsigned long long time_ms(void);
+
 /* Base64 encode a block without breaking into lines. Returns the number
  * of source bytes encoded. The output is nul-terminated.
  */